@@ -197,7 +197,7 @@ void jz_free_dma(unsigned int dmanr)
 	}
 
 	disable_dma(dmanr);
-	if (chan->irq)
+	if (chan->irq >= 0)
 		free_irq(chan->irq, chan->irq_dev);
 
 	chan->irq = -1;
@@ -0,0 +1,594 @@
+/*
+ * Compressed RAM block device for swap
+ *
+ * Every page written to /dev/ramzswap0 is compressed with LZO and kept in
+ * memory; reads decompress it again.  Swapping to it trades CPU time for
+ * memory, which is a far better deal on a small board than swapping to
+ * flash: nothing wears out and a page comes back in microseconds.
+ *
+ * Compressed pages live in a small size-class allocator: each class hands
+ * out fixed size slots carved from single pages, so the device never
+ * needs higher-order allocations while the system is short of memory.
+ * Pages which don't compress below half a page are kept as they are.
+ *
+ * The swap code tells us when a slot is freed (swap_slot_free_notify), so
+ * the memory of stale pages is given back right away instead of when the
+ * slot happens to be overwritten.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/init.h>
+#include <linux/bio.h>
+#include <linux/blkdev.h>
+#include <linux/genhd.h>
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/lzo.h>
+#include <linux/proc_fs.h>
+#include <linux/swap.h>
+
+#define SECTOR_SHIFT		9
+#define SECTORS_PER_PAGE_SHIFT	(PAGE_SHIFT - SECTOR_SHIFT)
+
+/* Default device size, in percent of RAM */
+#define DEFAULT_DISKSIZE_PERC	25
+
+/*
+ * Size classes are ZS_CLASS_DELTA bytes apart. The largest one still
+ * fits two objects in a page; anything bigger gains nothing over
+ * storing the page uncompressed.
+ */
+#define ZS_CLASS_DELTA		32
+#define ZS_MAX_SIZE		(((PAGE_SIZE - sizeof(struct zs_page)) / 2) \
+				 & ~(ZS_CLASS_DELTA - 1))
+#define ZS_NR_CLASSES		(ZS_MAX_SIZE / ZS_CLASS_DELTA)
+
+/* Header at the start of every page owned by a size class */
+struct zs_page {
+	struct list_head list;		/* on the class partial list */
+	void *free;			/* first free object */
+	unsigned short inuse;
+	unsigned short class;
+};
+
+struct zs_class {
+	struct list_head partial;	/* pages with free objects */
+	unsigned int size;
+};
+
+struct zs_pool {
+	spinlock_t lock;
+	unsigned long pages;
+	struct zs_class classes[];
+};
+
+/* Flags for table entries */
+#define RZS_ZERO		0x01	/* page was all zeroes, nothing stored */
+#define RZS_UNCOMPRESSED	0x02	/* obj is a whole page, not compressed */
+
+struct rzs_entry {
+	void *obj;
+	unsigned short size;
+	unsigned char flags;
+};
+
+struct rzs_stats {
+	u64 num_reads;
+	u64 num_writes;
+	u64 failed_reads;
+	u64 failed_writes;
+	u64 invalid_io;
+	u64 notify_free;
+	unsigned long pages_zero;
+	unsigned long pages_stored;	/* compressed or not, without zero pages */
+	unsigned long pages_expand;	/* stored uncompressed */
+	u64 compr_size;			/* bytes held in size classes */
+};
+
+struct ramzswap {
+	struct request_queue *queue;
+	struct gendisk *disk;
+	struct zs_pool *pool;
+	struct rzs_entry *table;
+	unsigned long nr_pages;
+
+	/* Protects table and stats */
+	spinlock_t lock;
+	struct rzs_stats stats;
+
+	/* Compression buffers, one user at a time */
+	struct mutex compress_lock;
+	void *compress_workmem;
+	void *compress_buffer;
+};
+
+static struct ramzswap *rzs;
+static int ramzswap_major;
+
+static unsigned long disksize_kb;
+module_param(disksize_kb, ulong, 0);
+MODULE_PARM_DESC(disksize_kb, "Device size in KiB "
+		 "(default " __stringify(DEFAULT_DISKSIZE_PERC) "% of RAM)");
+
+/*
+ * Size-class allocator
+ */
+
+static struct zs_pool *zs_create_pool(void)
+{
+	struct zs_pool *pool;
+	int i;
+
+	pool = kzalloc(sizeof(*pool) +
+		       ZS_NR_CLASSES * sizeof(struct zs_class), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	spin_lock_init(&pool->lock);
+	for (i = 0; i < ZS_NR_CLASSES; i++) {
+		INIT_LIST_HEAD(&pool->classes[i].partial);
+		pool->classes[i].size = (i + 1) * ZS_CLASS_DELTA;
+	}
+	return pool;
+}
+
+static void zs_destroy_pool(struct zs_pool *pool)
+{
+	WARN_ON(pool->pages);
+	kfree(pool);
+}
+
+/* Carve a fresh page into objects of the class size */
+static struct zs_page *zs_new_page(int class, unsigned int size, gfp_t gfp)
+{
+	struct zs_page *zp;
+	void *obj, *end;
+
+	zp = (void *)__get_free_page(gfp);
+	if (!zp)
+		return NULL;
+
+	zp->inuse = 0;
+	zp->class = class;
+	zp->free = obj = zp + 1;
+	end = (void *)zp + PAGE_SIZE - size;
+	while (obj + size <= end) {
+		*(void **)obj = obj + size;
+		obj += size;
+	}
+	*(void **)obj = NULL;
+	return zp;
+}
+
+static void *zs_malloc(struct zs_pool *pool, unsigned int size, gfp_t gfp)
+{
+	int class = (size - 1) / ZS_CLASS_DELTA;
+	struct zs_class *c = &pool->classes[class];
+	struct zs_page *zp;
+	void *obj;
+
+	BUG_ON(!size || size > ZS_MAX_SIZE);
+
+	spin_lock(&pool->lock);
+	if (list_empty(&c->partial)) {
+		spin_unlock(&pool->lock);
+		zp = zs_new_page(class, c->size, gfp);
+		if (!zp)
+			return NULL;
+		spin_lock(&pool->lock);
+		list_add(&zp->list, &c->partial);
+		pool->pages++;
+	}
+
+	zp = list_first_entry(&c->partial, struct zs_page, list);
+	obj = zp->free;
+	zp->free = *(void **)obj;
+	zp->inuse++;
+	if (!zp->free)
+		list_del_init(&zp->list);
+	spin_unlock(&pool->lock);
+
+	return obj;
+}
+
+static void zs_free(struct zs_pool *pool, void *obj)
+{
+	struct zs_page *zp = (void *)((unsigned long)obj & PAGE_MASK);
+	int was_full;
+
+	spin_lock(&pool->lock);
+	was_full = !zp->free;
+	*(void **)obj = zp->free;
+	zp->free = obj;
+	zp->inuse--;
+	if (!zp->inuse) {
+		if (!was_full)
+			list_del(&zp->list);
+		free_page((unsigned long)zp);
+		pool->pages--;
+	} else if (was_full) {
+		list_add(&zp->list, &pool->classes[zp->class].partial);
+	}
+	spin_unlock(&pool->lock);
+}
+
+/*
+ * Block device
+ */
+
+static int page_zero_filled(void *ptr)
+{
+	unsigned long *page = ptr;
+	unsigned int pos;
+
+	for (pos = 0; pos < PAGE_SIZE / sizeof(*page); pos++)
+		if (page[pos])
+			return 0;
+	return 1;
+}
+
+/* Called with rzs->lock held */
+static void ramzswap_free_entry(struct ramzswap *rzs, struct rzs_entry *e)
+{
+	if (e->flags & RZS_ZERO) {
+		rzs->stats.pages_zero--;
+	} else if (e->obj) {
+		if (e->flags & RZS_UNCOMPRESSED) {
+			free_page((unsigned long)e->obj);
+			rzs->stats.pages_expand--;
+		} else {
+			zs_free(rzs->pool, e->obj);
+			rzs->stats.compr_size -= e->size;
+		}
+		rzs->stats.pages_stored--;
+	}
+	e->obj = NULL;
+	e->size = 0;
+	e->flags = 0;
+}
+
+static int ramzswap_read(struct ramzswap *rzs, struct page *page,
+			 unsigned long index)
+{
+	struct rzs_entry *e;
+	size_t clen = PAGE_SIZE;
+	void *dst;
+	int ret = 0;
+
+	/*
+	 * A concurrent write or free of this slot frees the object, so it is
+	 * copied out with the lock held.
+	 */
+	dst = kmap_atomic(page, KM_USER0);
+	spin_lock(&rzs->lock);
+	e = &rzs->table[index];
+	rzs->stats.num_reads++;
+	if (!e->obj) {
+		/* Zero page, or never written (e.g. swap header probe) */
+		memset(dst, 0, PAGE_SIZE);
+	} else if (e->flags & RZS_UNCOMPRESSED) {
+		memcpy(dst, e->obj, PAGE_SIZE);
+	} else {
+		ret = lzo1x_decompress_safe(e->obj, e->size, dst, &clen);
+		if (ret != LZO_E_OK || clen != PAGE_SIZE)
+			ret = -EIO;
+	}
+	if (ret)
+		rzs->stats.failed_reads++;
+	spin_unlock(&rzs->lock);
+	kunmap_atomic(dst, KM_USER0);
+	flush_dcache_page(page);
+
+	if (ret)
+		printk(KERN_ERR "ramzswap: decompression failed for page %lu\n",
+		       index);
+	return ret;
+}
+
+static int ramzswap_write(struct ramzswap *rzs, struct page *page,
+			  unsigned long index)
+{
+	struct rzs_entry e = { NULL, 0, 0 };
+	struct rzs_entry old;
+	size_t clen;
+	void *src;
+	int ret;
+
+	mutex_lock(&rzs->compress_lock);
+	src = kmap_atomic(page, KM_USER0);
+	if (page_zero_filled(src)) {
+		kunmap_atomic(src, KM_USER0);
+		mutex_unlock(&rzs->compress_lock);
+		e.flags = RZS_ZERO;
+		goto store;
+	}
+	ret = lzo1x_1_compress(src, PAGE_SIZE, rzs->compress_buffer, &clen,
+			       rzs->compress_workmem);
+	kunmap_atomic(src, KM_USER0);
+	if (ret != LZO_E_OK) {
+		mutex_unlock(&rzs->compress_lock);
+		printk(KERN_ERR "ramzswap: compression failed for page %lu: "
+		       "%d\n", index, ret);
+		goto fail;
+	}
+
+	if (clen <= ZS_MAX_SIZE) {
+		e.obj = zs_malloc(rzs->pool, clen, GFP_NOIO | __GFP_NOWARN);
+		if (e.obj)
+			memcpy(e.obj, rzs->compress_buffer, clen);
+		e.size = clen;
+	}
+	mutex_unlock(&rzs->compress_lock);
+
+	if (clen > ZS_MAX_SIZE) {
+		/* Incompressible: keep the page as it is */
+		e.obj = (void *)__get_free_page(GFP_NOIO | __GFP_NOWARN);
+		if (e.obj) {
+			src = kmap_atomic(page, KM_USER0);
+			memcpy(e.obj, src, PAGE_SIZE);
+			kunmap_atomic(src, KM_USER0);
+		}
+		e.size = PAGE_SIZE;
+		e.flags = RZS_UNCOMPRESSED;
+	}
+	if (!e.obj)
+		goto fail;
+
+ store:
+	spin_lock(&rzs->lock);
+	old = rzs->table[index];
+	ramzswap_free_entry(rzs, &old);
+	rzs->table[index] = e;
+	rzs->stats.num_writes++;
+	if (e.flags & RZS_ZERO) {
+		rzs->stats.pages_zero++;
+	} else {
+		rzs->stats.pages_stored++;
+		if (e.flags & RZS_UNCOMPRESSED)
+			rzs->stats.pages_expand++;
+		else
+			rzs->stats.compr_size += e.size;
+	}
+	spin_unlock(&rzs->lock);
+	return 0;
+
+ fail:
+	spin_lock(&rzs->lock);
+	rzs->stats.failed_writes++;
+	spin_unlock(&rzs->lock);
+	return -ENOMEM;
+}
+
+static int ramzswap_make_request(struct request_queue *q, struct bio *bio)
+{
+	struct ramzswap *rzs = q->queuedata;
+	struct bio_vec *bvec;
+	unsigned long index;
+	int i, err = -EIO;
+
+	/* The block size is a page, but be strict about what we accept */
+	if ((bio->bi_sector & ((1 << SECTORS_PER_PAGE_SHIFT) - 1)) ||
+	    (bio->bi_size & (PAGE_SIZE - 1)))
+		goto invalid;
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+	if (index + (bio->bi_size >> PAGE_SHIFT) > rzs->nr_pages)
+		goto invalid;
+
+	bio_for_each_segment(bvec, bio, i) {
+		if (bvec->bv_offset || bvec->bv_len != PAGE_SIZE)
+			goto invalid;
+		if (bio_data_dir(bio) == WRITE)
+			err = ramzswap_write(rzs, bvec->bv_page, index);
+		else
+			err = ramzswap_read(rzs, bvec->bv_page, index);
+		if (err)
+			break;
+		index++;
+	}
+	bio_endio(bio, err);
+	return 0;
+
+ invalid:
+	spin_lock(&rzs->lock);
+	rzs->stats.invalid_io++;
+	spin_unlock(&rzs->lock);
+	bio_io_error(bio);
+	return 0;
+}
+
+/* Called from swap_entry_free() with swap_lock held */
+static void ramzswap_slot_free_notify(struct block_device *bdev,
+				      unsigned long index)
+{
+	struct ramzswap *rzs = bdev->bd_disk->private_data;
+
+	if (index >= rzs->nr_pages)
+		return;
+
+	spin_lock(&rzs->lock);
+	ramzswap_free_entry(rzs, &rzs->table[index]);
+	rzs->stats.notify_free++;
+	spin_unlock(&rzs->lock);
+}
+
+static struct block_device_operations ramzswap_fops = {
+	.owner			= THIS_MODULE,
+	.swap_slot_free_notify	= ramzswap_slot_free_notify,
+};
+
+#ifdef CONFIG_PROC_FS
+static int ramzswap_read_proc(char *page, char **start, off_t off,
+			      int count, int *eof, void *data)
+{
+	struct ramzswap *rzs = data;
+	struct rzs_stats s;
+	unsigned long pool_pages, mem_used, ratio = 0;
+	u64 orig;
+	int len;
+
+	spin_lock(&rzs->lock);
+	s = rzs->stats;
+	spin_unlock(&rzs->lock);
+	spin_lock(&rzs->pool->lock);
+	pool_pages = rzs->pool->pages;
+	spin_unlock(&rzs->pool->lock);
+
+	mem_used = (pool_pages + s.pages_expand) << PAGE_SHIFT;
+	orig = (u64)s.pages_stored << PAGE_SHIFT;
+	if (s.pages_stored)
+		ratio = (unsigned long)((u64)mem_used * 100 >> PAGE_SHIFT) /
+			s.pages_stored;
+
+	len = sprintf(page,
+		      "DiskSize:       %8lu kB\n"
+		      "NumReads:       %8llu\n"
+		      "NumWrites:      %8llu\n"
+		      "FailedReads:    %8llu\n"
+		      "FailedWrites:   %8llu\n"
+		      "InvalidIO:      %8llu\n"
+		      "NotifyFree:     %8llu\n"
+		      "ZeroPages:      %8lu\n"
+		      "StoredPages:    %8lu\n"
+		      "IncompressPages:%8lu\n"
+		      "OrigDataSize:   %8llu kB\n"
+		      "ComprDataSize:  %8llu kB\n"
+		      "MemUsedTotal:   %8lu kB\n"
+		      "MemUsedPercent: %8lu %%\n",
+		      rzs->nr_pages << (PAGE_SHIFT - 10),
+		      (unsigned long long)s.num_reads,
+		      (unsigned long long)s.num_writes,
+		      (unsigned long long)s.failed_reads,
+		      (unsigned long long)s.failed_writes,
+		      (unsigned long long)s.invalid_io,
+		      (unsigned long long)s.notify_free,
+		      s.pages_zero, s.pages_stored, s.pages_expand,
+		      (unsigned long long)(orig >> 10),
+		      (unsigned long long)(s.compr_size >> 10),
+		      mem_used >> 10, ratio);
+
+	*eof = 1;
+	return len;
+}
+#endif
+
+static int __init ramzswap_init(void)
+{
+	int ret = -ENOMEM;
+
+	if (!disksize_kb)
+		disksize_kb = (totalram_pages << (PAGE_SHIFT - 10)) *
+			      DEFAULT_DISKSIZE_PERC / 100;
+
+	rzs = kzalloc(sizeof(*rzs), GFP_KERNEL);
+	if (!rzs)
+		return -ENOMEM;
+
+	rzs->nr_pages = disksize_kb >> (PAGE_SHIFT - 10);
+	if (!rzs->nr_pages) {
+		ret = -EINVAL;
+		goto out_free_dev;
+	}
+	spin_lock_init(&rzs->lock);
+	mutex_init(&rzs->compress_lock);
+
+	rzs->table = vmalloc(rzs->nr_pages * sizeof(*rzs->table));
+	if (!rzs->table)
+		goto out_free_dev;
+	memset(rzs->table, 0, rzs->nr_pages * sizeof(*rzs->table));
+
+	rzs->compress_workmem = kmalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
+	rzs->compress_buffer = kmalloc(lzo1x_worst_compress(PAGE_SIZE),
+				       GFP_KERNEL);
+	rzs->pool = zs_create_pool();
+	if (!rzs->compress_workmem || !rzs->compress_buffer || !rzs->pool)
+		goto out_free_mem;
+
+	ramzswap_major = register_blkdev(0, "ramzswap");
+	if (ramzswap_major < 0) {
+		ret = ramzswap_major;
+		goto out_free_mem;
+	}
+
+	rzs->queue = blk_alloc_queue(GFP_KERNEL);
+	if (!rzs->queue)
+		goto out_unregister;
+	rzs->queue->queuedata = rzs;
+	blk_queue_make_request(rzs->queue, ramzswap_make_request);
+	blk_queue_hardsect_size(rzs->queue, PAGE_SIZE);
+	blk_queue_bounce_limit(rzs->queue, BLK_BOUNCE_ANY);
+
+	rzs->disk = alloc_disk(1);
+	if (!rzs->disk)
+		goto out_free_queue;
+	rzs->disk->major = ramzswap_major;
+	rzs->disk->first_minor = 0;
+	rzs->disk->fops = &ramzswap_fops;
+	rzs->disk->private_data = rzs;
+	rzs->disk->queue = rzs->queue;
+	rzs->disk->flags |= GENHD_FL_SUPPRESS_PARTITION_INFO;
+	strcpy(rzs->disk->disk_name, "ramzswap0");
+	set_capacity(rzs->disk, (sector_t)rzs->nr_pages <<
+				SECTORS_PER_PAGE_SHIFT);
+	add_disk(rzs->disk);
+
+#ifdef CONFIG_PROC_FS
+	create_proc_read_entry("ramzswap", 0, NULL, ramzswap_read_proc, rzs);
+#endif
+
+	printk(KERN_INFO "ramzswap: /dev/ramzswap0 ready, %lu kB\n",
+	       disksize_kb);
+	return 0;
+
+ out_free_queue:
+	blk_cleanup_queue(rzs->queue);
+ out_unregister:
+	unregister_blkdev(ramzswap_major, "ramzswap");
+ out_free_mem:
+	if (rzs->pool)
+		zs_destroy_pool(rzs->pool);
+	kfree(rzs->compress_buffer);
+	kfree(rzs->compress_workmem);
+	vfree(rzs->table);
+ out_free_dev:
+	kfree(rzs);
+	return ret;
+}
+
+static void __exit ramzswap_exit(void)
+{
+	unsigned long index;
+
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("ramzswap", NULL);
+#endif
+	del_gendisk(rzs->disk);
+	put_disk(rzs->disk);
+	blk_cleanup_queue(rzs->queue);
+	unregister_blkdev(ramzswap_major, "ramzswap");
+
+	for (index = 0; index < rzs->nr_pages; index++)
+		ramzswap_free_entry(rzs, &rzs->table[index]);
+
+	zs_destroy_pool(rzs->pool);
+	kfree(rzs->compress_buffer);
+	kfree(rzs->compress_workmem);
+	vfree(rzs->table);
+	kfree(rzs);
+}
+
+module_init(ramzswap_init);
+module_exit(ramzswap_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Compressed RAM block device for swap");
@@ -74,6 +74,52 @@ static int do_blktrans_request(struct mtd_blktrans_ops *tr,
 	}
 }
 
+/*
+ * Hand a whole request to a translation layer which can do several sectors
+ * at a time. Segments which follow each other in memory are merged into one
+ * call. The queue bounces highmem pages, so page_address() is fine here.
+ */
+static int do_blktrans_request_sects(struct mtd_blktrans_ops *tr,
+				     struct mtd_blktrans_dev *dev,
+				     struct request *req)
+{
+	struct req_iterator iter;
+	struct bio_vec *bvec;
+	unsigned long block, nsect = 0;
+	char *buf = NULL, *p;
+	int write = rq_data_dir(req) == WRITE;
+
+	if (req->sector + req->nr_sectors > get_capacity(req->rq_disk))
+		return 0;
+
+	if (write && !tr->writesects)
+		return 0;
+
+	block = req->sector << 9 >> tr->blkshift;
+
+	rq_for_each_segment(bvec, req, iter) {
+		p = page_address(bvec->bv_page) + bvec->bv_offset;
+		if (nsect && p == buf + (nsect << tr->blkshift)) {
+			nsect += bvec->bv_len >> tr->blkshift;
+			continue;
+		}
+
+		if (nsect) {
+			if (write ? tr->writesects(dev, block, nsect, buf) :
+				    tr->readsects(dev, block, nsect, buf))
+				return 0;
+			block += nsect;
+		}
+		buf = p;
+		nsect = bvec->bv_len >> tr->blkshift;
+	}
+
+	if (nsect && (write ? tr->writesects(dev, block, nsect, buf) :
+			      tr->readsects(dev, block, nsect, buf)))
+		return 0;
+	return 1;
+}
+
 static int mtd_blktrans_thread(void *arg)
 {
 	struct mtd_blktrans_ops *tr = arg;
@@ -103,6 +149,18 @@ static int mtd_blktrans_thread(void *arg)
 
 		spin_unlock_irq(rq->queue_lock);
 
+		if (tr->readsects && blk_fs_request(req)) {
+			mutex_lock(&dev->lock);
+			res = do_blktrans_request_sects(tr, dev, req);
+			mutex_unlock(&dev->lock);
+
+			spin_lock_irq(rq->queue_lock);
+
+			__blk_end_request(req, res ? 0 : -EIO,
+					  blk_rq_bytes(req));
+			continue;
+		}
+
 		mutex_lock(&dev->lock);
 		res = do_blktrans_request(tr, dev, req);
 		mutex_unlock(&dev->lock);
@@ -19,26 +19,51 @@
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/blktrans.h>
 #include <linux/mutex.h>
+#include <linux/bitops.h>
+#include <linux/err.h>
 
 
+#define MTDBLK_SECT_SHIFT	9
+#define MTDBLK_SECT_SIZE	(1 << MTDBLK_SECT_SHIFT)
+#define MTDBLK_MAX_CACHE	16
+
+/*
+ * One cached flash sector. Only the 512 byte blocks set in @valid have been
+ * written, the rest is read back from flash when the sector is written out.
+ */
+struct mtdblk_cache {
+	struct list_head lru;
+	unsigned long offset;
+	unsigned char *data;
+	unsigned long *valid;
+	enum { STATE_EMPTY, STATE_DIRTY } state;
+};
+
 static struct mtdblk_dev {
 	struct mtd_info *mtd;
 	int count;
 	struct mutex cache_mutex;
-	unsigned char *cache_data;
-	unsigned long cache_offset;
 	unsigned int cache_size;
-	enum { STATE_EMPTY, STATE_CLEAN, STATE_DIRTY } cache_state;
+	int cache_count;
+	struct mtdblk_cache *cache;
+	struct list_head lru;		/* most recently used first */
 } *mtdblks[MAX_MTD_DEVICES];
 
+static int cache_sectors = 4;
+module_param(cache_sectors, int, 0444);
+MODULE_PARM_DESC(cache_sectors, "Number of flash sectors cached for writing per device (1-16, default 4)");
+
 /*
  * Cache stuff...
  *
  * Since typical flash erasable sectors are much larger than what Linux's
  * buffer cache can handle, we must implement read-modify-write on flash
  * sectors for each block write requests.  To avoid over-erasing flash sectors
- * and to speed things up, we locally cache a whole flash sector while it is
- * being written to until a different sector is required.
+ * and to speed things up, we locally cache a few whole flash sectors while
+ * they are being written to, and write the least recently used one out when
+ * a different sector is required.  The unwritten parts of a sector are only
+ * read when it is written out, so a sector which is completely overwritten
+ * is never read.
  */
 
 static void erase_callback(struct erase_info *done)
@@ -96,42 +121,132 @@ static int erase_write (struct mtd_info *mtd, unsigned long pos,
 }
 
 
-static int write_cached_data (struct mtdblk_dev *mtdblk)
+static int write_cached_data (struct mtdblk_dev *mtdblk,
+			      struct mtdblk_cache *c)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
-	int ret;
+	int nsect = mtdblk->cache_size >> MTDBLK_SECT_SHIFT;
+	int i, n, ret;
+	size_t retlen;
 
-	if (mtdblk->cache_state != STATE_DIRTY)
+	if (c->state != STATE_DIRTY)
 		return 0;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "mtdblock: writing cached data for \"%s\" "
 			"at 0x%lx, size 0x%x\n", mtd->name,
-			mtdblk->cache_offset, mtdblk->cache_size);
+			c->offset, mtdblk->cache_size);
+
+	/* Fill in what was not written from the flash */
+	for (i = find_first_zero_bit(c->valid, nsect); i < nsect;
+	     i = find_next_zero_bit(c->valid, nsect, i + n)) {
+		n = find_next_bit(c->valid, nsect, i) - i;
+		ret = mtd->read(mtd, c->offset + (i << MTDBLK_SECT_SHIFT),
+				n << MTDBLK_SECT_SHIFT, &retlen,
+				c->data + (i << MTDBLK_SECT_SHIFT));
+		if (ret && ret != -EUCLEAN)
+			return ret;
+		if (retlen != n << MTDBLK_SECT_SHIFT)
+			return -EIO;
+	}
 
-	ret = erase_write (mtd, mtdblk->cache_offset,
-			   mtdblk->cache_size, mtdblk->cache_data);
+	ret = erase_write (mtd, c->offset, mtdblk->cache_size, c->data);
 	if (ret)
 		return ret;
 
 	/*
-	 * Here we could argubly set the cache state to STATE_CLEAN.
+	 * Here we could argubly keep the data as a read cache.
 	 * However this could lead to inconsistency since we will not
 	 * be notified if this content is altered on the flash by other
 	 * means.  Let's declare it empty and leave buffering tasks to
 	 * the buffer cache instead.
 	 */
-	mtdblk->cache_state = STATE_EMPTY;
+	c->state = STATE_EMPTY;
+	bitmap_zero(c->valid, nsect);
+	list_move_tail(&c->lru, &mtdblk->lru);
 	return 0;
 }
 
+static int write_all_cached_data (struct mtdblk_dev *mtdblk)
+{
+	struct mtdblk_cache *c, *n;
+	int err, ret = 0;
+
+	list_for_each_entry_safe(c, n, &mtdblk->lru, lru) {
+		err = write_cached_data(mtdblk, c);
+		if (err)
+			ret = err;
+	}
+	return ret;
+}
+
+static struct mtdblk_cache *find_cache (struct mtdblk_dev *mtdblk,
+					unsigned long sect_start)
+{
+	struct mtdblk_cache *c;
+
+	list_for_each_entry(c, &mtdblk->lru, lru) {
+		if (c->state == STATE_EMPTY)
+			break;	/* empty ones are at the tail */
+		if (c->offset == sect_start)
+			return c;
+	}
+	return NULL;
+}
+
+static int alloc_cache (struct mtdblk_dev *mtdblk, struct mtdblk_cache *c)
+{
+	int nsect = mtdblk->cache_size >> MTDBLK_SECT_SHIFT;
+
+	c->data = vmalloc(mtdblk->cache_size);
+	c->valid = kzalloc(BITS_TO_LONGS(nsect) * sizeof(long), GFP_KERNEL);
+	if (c->data && c->valid)
+		return 0;
+
+	vfree(c->data);
+	kfree(c->valid);
+	c->data = NULL;
+	c->valid = NULL;
+	return -ENOMEM;
+}
+
+/*
+ * Get the cache entry for the flash sector at @sect_start and make it the
+ * most recently used one. Cache buffers are only allocated once they are
+ * needed; if that fails an already allocated entry is reused.
+ */
+static struct mtdblk_cache *get_cache (struct mtdblk_dev *mtdblk,
+				       unsigned long sect_start)
+{
+	struct mtdblk_cache *c;
+	int ret;
+
+	c = find_cache(mtdblk, sect_start);
+	if (c)
+		goto out;
+
+	list_for_each_entry_reverse(c, &mtdblk->lru, lru)
+		if (c->data || !alloc_cache(mtdblk, c))
+			break;
+	if (&c->lru == &mtdblk->lru)
+		return ERR_PTR(-ENOMEM);
+
+	ret = write_cached_data(mtdblk, c);
+	if (ret)
+		return ERR_PTR(ret);
+	c->offset = sect_start;
+out:
+	list_move(&c->lru, &mtdblk->lru);
+	return c;
+}
 
 static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			    int len, const char *buf)
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
-	int ret;
+	int i, ret;
 
 	DEBUG(MTD_DEBUG_LEVEL2, "mtdblock: write on \"%s\" at 0x%lx, size 0x%x\n",
 		mtd->name, pos, len);
@@ -150,40 +265,31 @@ static int do_cached_write (struct mtdblk_dev *mtdblk, unsigned long pos,
 			/*
 			 * We are covering a whole sector.  Thus there is no
 			 * need to bother with the cache while it may still be
-			 * useful for other partial writes.
+			 * useful for other partial writes.  Anything cached
+			 * for this sector is stale now.
 			 */
+			c = find_cache(mtdblk, sect_start);
+			if (c) {
+				c->state = STATE_EMPTY;
+				bitmap_zero(c->valid,
+					    sect_size >> MTDBLK_SECT_SHIFT);
+				list_move_tail(&c->lru, &mtdblk->lru);
+			}
 			ret = erase_write (mtd, pos, size, buf);
 			if (ret)
 				return ret;
 		} else {
 			/* Partial sector: need to use the cache */
-
-			if (mtdblk->cache_state == STATE_DIRTY &&
-			    mtdblk->cache_offset != sect_start) {
-				ret = write_cached_data(mtdblk);
-				if (ret)
-					return ret;
-			}
-
-			if (mtdblk->cache_state == STATE_EMPTY ||
-			    mtdblk->cache_offset != sect_start) {
-				/* fill the cache with the current sector */
-				mtdblk->cache_state = STATE_EMPTY;
-				ret = mtd->read(mtd, sect_start, sect_size,
-						&retlen, mtdblk->cache_data);
-				if (ret)
-					return ret;
-				if (retlen != sect_size)
-					return -EIO;
-
-				mtdblk->cache_offset = sect_start;
-				mtdblk->cache_size = sect_size;
-				mtdblk->cache_state = STATE_CLEAN;
-			}
+			c = get_cache(mtdblk, sect_start);
+			if (IS_ERR(c))
+				return PTR_ERR(c);
 
 			/* write data to our local cache */
-			memcpy (mtdblk->cache_data + offset, buf, size);
-			mtdblk->cache_state = STATE_DIRTY;
+			memcpy (c->data + offset, buf, size);
+			for (i = offset >> MTDBLK_SECT_SHIFT;
+			     i < (offset + size) >> MTDBLK_SECT_SHIFT; i++)
+				set_bit(i, c->valid);
+			c->state = STATE_DIRTY;
 		}
 
 		buf += size;
@@ -200,6 +306,7 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 {
 	struct mtd_info *mtd = mtdblk->mtd;
 	unsigned int sect_size = mtdblk->cache_size;
+	struct mtdblk_cache *c;
 	size_t retlen;
 	int ret;
 
@@ -222,10 +329,23 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 		 * contains what we want, otherwise we read the data directly
 		 * from flash.
 		 */
-		if (mtdblk->cache_state != STATE_EMPTY &&
-		    mtdblk->cache_offset == sect_start) {
-			memcpy (buf, mtdblk->cache_data + offset, size);
+		c = find_cache(mtdblk, sect_start);
+		if (c && test_bit(offset >> MTDBLK_SECT_SHIFT, c->valid)) {
+			size = MTDBLK_SECT_SIZE - (offset & (MTDBLK_SECT_SIZE - 1));
+			if (size > len)
+				size = len;
+			memcpy (buf, c->data + offset, size);
 		} else {
+			if (c) {
+				/* Read up to the next cached block */
+				unsigned int next = find_next_bit(c->valid,
+					sect_size >> MTDBLK_SECT_SHIFT,
+					offset >> MTDBLK_SECT_SHIFT);
+
+				next <<= MTDBLK_SECT_SHIFT;
+				if (size > next - offset)
+					size = next - offset;
+			}
 			ret = mtd->read(mtd, pos, size, &retlen, buf);
 			if (ret)
 				return ret;
@@ -241,27 +361,44 @@ static int do_cached_read (struct mtdblk_dev *mtdblk, unsigned long pos,
 	return 0;
 }
 
+static int mtdblock_readsects(struct mtd_blktrans_dev *dev,
+			      unsigned long block, unsigned long nsect,
+			      char *buf)
+{
+	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_read(mtdblk, block << MTDBLK_SECT_SHIFT,
+			     nsect << MTDBLK_SECT_SHIFT, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
+}
+
+static int mtdblock_writesects(struct mtd_blktrans_dev *dev,
+			       unsigned long block, unsigned long nsect,
+			       char *buf)
+{
+	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
+	int ret;
+
+	mutex_lock(&mtdblk->cache_mutex);
+	ret = do_cached_write(mtdblk, block << MTDBLK_SECT_SHIFT,
+			      nsect << MTDBLK_SECT_SHIFT, buf);
+	mutex_unlock(&mtdblk->cache_mutex);
+	return ret;
+}
+
 static int mtdblock_readsect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
-	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	return do_cached_read(mtdblk, block<<9, 512, buf);
+	return mtdblock_readsects(dev, block, 1, buf);
 }
 
 static int mtdblock_writesect(struct mtd_blktrans_dev *dev,
 			      unsigned long block, char *buf)
 {
-	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
-	if (unlikely(!mtdblk->cache_data && mtdblk->cache_size)) {
-		mtdblk->cache_data = vmalloc(mtdblk->mtd->erasesize);
-		if (!mtdblk->cache_data)
-			return -EINTR;
-		/* -EINTR is not really correct, but it is the best match
-		 * documented in man 2 write for all cases.  We could also
-		 * return -EAGAIN sometimes, but why bother?
-		 */
-	}
-	return do_cached_write(mtdblk, block<<9, 512, buf);
+	return mtdblock_writesects(dev, block, 1, buf);
 }
 
 static int mtdblock_open(struct mtd_blktrans_dev *mbd)
@@ -286,10 +423,21 @@ static int mtdblock_open(struct mtd_blktrans_dev *mbd)
 	mtdblk->mtd = mtd;
 
 	mutex_init(&mtdblk->cache_mutex);
-	mtdblk->cache_state = STATE_EMPTY;
+	INIT_LIST_HEAD(&mtdblk->lru);
 	if ( !(mtdblk->mtd->flags & MTD_NO_ERASE) && mtdblk->mtd->erasesize) {
+		int i;
+
 		mtdblk->cache_size = mtdblk->mtd->erasesize;
-		mtdblk->cache_data = NULL;
+		mtdblk->cache_count = clamp(cache_sectors, 1, MTDBLK_MAX_CACHE);
+		mtdblk->cache = kcalloc(mtdblk->cache_count,
+					sizeof(struct mtdblk_cache), GFP_KERNEL);
+		if (!mtdblk->cache) {
+			kfree(mtdblk);
+			return -ENOMEM;
+		}
+		/* The buffers are allocated on the first write */
+		for (i = 0; i < mtdblk->cache_count; i++)
+			list_add_tail(&mtdblk->cache[i].lru, &mtdblk->lru);
 	}
 
 	mtdblks[dev] = mtdblk;
@@ -307,15 +455,21 @@ static int mtdblock_release(struct mtd_blktrans_dev *mbd)
    	DEBUG(MTD_DEBUG_LEVEL1, "mtdblock_release\n");
 
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	write_all_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
 	if (!--mtdblk->count) {
+		int i;
+
 		/* It was the last usage. Free the device */
 		mtdblks[dev] = NULL;
 		if (mtdblk->mtd->sync)
 			mtdblk->mtd->sync(mtdblk->mtd);
-		vfree(mtdblk->cache_data);
+		for (i = 0; i < mtdblk->cache_count; i++) {
+			vfree(mtdblk->cache[i].data);
+			kfree(mtdblk->cache[i].valid);
+		}
+		kfree(mtdblk->cache);
 		kfree(mtdblk);
 	}
 	DEBUG(MTD_DEBUG_LEVEL1, "ok\n");
@@ -327,13 +481,15 @@ static int mtdblock_flush(struct mtd_blktrans_dev *dev)
 {
 	struct mtdblk_dev *mtdblk = mtdblks[dev->devnum];
 
+	int ret;
+
 	mutex_lock(&mtdblk->cache_mutex);
-	write_cached_data(mtdblk);
+	ret = write_all_cached_data(mtdblk);
 	mutex_unlock(&mtdblk->cache_mutex);
 
 	if (mtdblk->mtd->sync)
 		mtdblk->mtd->sync(mtdblk->mtd);
-	return 0;
+	return ret;
 }
 
 static void mtdblock_add_mtd(struct mtd_blktrans_ops *tr, struct mtd_info *mtd)
@@ -386,6 +542,8 @@ static struct mtd_blktrans_ops mtdblock_tr = {
 	.release	= mtdblock_release,
 	.readsect	= mtdblock_readsect,
 	.writesect	= mtdblock_writesect,
+	.readsects	= mtdblock_readsects,
+	.writesects	= mtdblock_writesects,
 	.add_mtd	= mtdblock_add_mtd,
 	.remove_dev	= mtdblock_remove_dev,
 	.owner		= THIS_MODULE,
@@ -104,6 +104,8 @@ int del_mtd_device (struct mtd_info *mtd)
 {
 	int ret;
 
+	mtd_erase_flush(mtd);
+
 	mutex_lock(&mtd_table_mutex);
 
 	if (mtd_table[mtd->index] != mtd) {
@@ -0,0 +1,188 @@
+/*
+ * Asynchronous erase queue for MTD devices.
+ *
+ * Most MTD drivers erase synchronously: mtd->erase() only returns once the
+ * chip is done, which takes milliseconds on NAND. Users which know a block
+ * is obsolete long before they need it again can hand the erase over to
+ * this queue and carry on; a single kernel thread issues the erases in
+ * order and reports back through instr->callback.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version
+ * 2 of the License, or (at your option) any later version.
+ */
+
+#include <linux/module.h>
+#include <linux/kernel.h>
+#include <linux/sched.h>
+#include <linux/kthread.h>
+#include <linux/freezer.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
+#include <linux/mutex.h>
+#include <linux/err.h>
+#include <linux/mtd/mtd.h>
+
+/* Queued requests are chained through erase_info->next */
+static DEFINE_SPINLOCK(erase_queue_lock);
+static struct erase_info *erase_head;
+static struct erase_info **erase_tail = &erase_head;
+/* Device the thread is currently erasing on, if any */
+static struct mtd_info *erase_running;
+
+static DECLARE_WAIT_QUEUE_HEAD(erase_done_wait);
+static DEFINE_MUTEX(erase_task_mutex);
+static struct task_struct *erase_task;
+
+static int mtd_erase_thread(void *unused)
+{
+	struct erase_info *instr;
+	struct mtd_info *mtd;
+	int ret;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		spin_lock(&erase_queue_lock);
+		instr = erase_head;
+		if (!instr) {
+			set_current_state(TASK_INTERRUPTIBLE);
+			spin_unlock(&erase_queue_lock);
+			if (!kthread_should_stop())
+				schedule();
+			__set_current_state(TASK_RUNNING);
+			try_to_freeze();
+			continue;
+		}
+		erase_head = instr->next;
+		if (!erase_head)
+			erase_tail = &erase_head;
+		/* The callback may free instr, so remember the device */
+		mtd = instr->mtd;
+		erase_running = mtd;
+		spin_unlock(&erase_queue_lock);
+
+		/*
+		 * -EAGAIN and -ENOMEM are transient, a synchronous caller
+		 * would have refiled the block and tried again later.
+		 */
+		while ((ret = mtd->erase(mtd, instr)) == -EAGAIN ||
+		       ret == -ENOMEM) {
+			if (kthread_should_stop())
+				break;
+			schedule_timeout_uninterruptible(HZ / 10);
+		}
+		if (ret) {
+			/*
+			 * Drivers only call back on success, the submitter
+			 * is long gone, so report the failure that way too.
+			 */
+			DEBUG(MTD_DEBUG_LEVEL0, "mtd_erase: erase at 0x%08x "
+			      "on \"%s\" failed: %d\n", instr->addr,
+			      mtd->name, ret);
+			instr->state = MTD_ERASE_FAILED;
+			if (instr->callback)
+				instr->callback(instr);
+		}
+
+		spin_lock(&erase_queue_lock);
+		erase_running = NULL;
+		spin_unlock(&erase_queue_lock);
+		wake_up_all(&erase_done_wait);
+		cond_resched();
+	}
+	return 0;
+}
+
+static struct task_struct *mtd_erase_get_task(void)
+{
+	struct task_struct *task;
+
+	mutex_lock(&erase_task_mutex);
+	if (!erase_task) {
+		task = kthread_run(mtd_erase_thread, NULL, "mtd_erase");
+		if (IS_ERR(task))
+			printk(KERN_WARNING "mtd_erase: cannot start erase "
+			       "thread (%ld), erasing synchronously\n",
+			       PTR_ERR(task));
+		else
+			erase_task = task;
+	}
+	task = erase_task;
+	mutex_unlock(&erase_task_mutex);
+	return task;
+}
+
+/**
+ *	mtd_erase_async - queue an erase for the background thread
+ *	@mtd: MTD device to erase on
+ *	@instr: erase request, must stay allocated until the callback ran
+ *
+ *	Same contract as mtd->erase(): a non-zero return means the request
+ *	was refused and the callback will not be called. On zero the
+ *	callback runs later from the erase thread, with instr->state set to
+ *	MTD_ERASE_DONE or MTD_ERASE_FAILED. The callback must not sleep on
+ *	other erases, in particular it must not call mtd_erase_flush().
+ */
+int mtd_erase_async(struct mtd_info *mtd, struct erase_info *instr)
+{
+	struct task_struct *task;
+
+	if (!mtd->erase)
+		return -EROFS;
+
+	task = mtd_erase_get_task();
+	if (!task)
+		return mtd->erase(mtd, instr);
+
+	instr->mtd = mtd;
+	instr->next = NULL;
+
+	spin_lock(&erase_queue_lock);
+	*erase_tail = instr;
+	erase_tail = &instr->next;
+	spin_unlock(&erase_queue_lock);
+
+	wake_up_process(task);
+	return 0;
+}
+
+static int mtd_erase_busy(struct mtd_info *mtd)
+{
+	struct erase_info *instr;
+	int busy;
+
+	spin_lock(&erase_queue_lock);
+	busy = erase_running == mtd;
+	for (instr = erase_head; instr && !busy; instr = instr->next)
+		busy = instr->mtd == mtd;
+	spin_unlock(&erase_queue_lock);
+
+	return busy;
+}
+
+/**
+ *	mtd_erase_flush - wait for queued erases on a device
+ *	@mtd: MTD device
+ *
+ *	Returns once every erase queued on @mtd by mtd_erase_async() has
+ *	finished and its callback has returned.
+ */
+void mtd_erase_flush(struct mtd_info *mtd)
+{
+	wait_event(erase_done_wait, !mtd_erase_busy(mtd));
+}
+
+EXPORT_SYMBOL_GPL(mtd_erase_async);
+EXPORT_SYMBOL_GPL(mtd_erase_flush);
+
+static void __exit mtd_erase_queue_exit(void)
+{
+	if (erase_task)
+		kthread_stop(erase_task);
+}
+
+module_exit(mtd_erase_queue_exit);
+
+MODULE_LICENSE("GPL");
+MODULE_DESCRIPTION("Asynchronous erase queue for MTD devices");
@@ -15,6 +15,8 @@
 #include <linux/module.h>
 #include <linux/delay.h>
 #include <linux/init.h>
+#include <linux/interrupt.h>
+#include <linux/completion.h>
 
 #include <linux/mtd/mtd.h>
 #include <linux/mtd/nand.h>
@@ -22,6 +24,7 @@
 #include <linux/mtd/partitions.h>
 
 #include <asm/io.h>
+#include <asm/addrspace.h>
 #include <asm/jzsoc.h>
 
 #define NAND_DATA_PORT	       0xB8000000  /* read-write area */
@@ -303,6 +306,171 @@ static void jz_device_setup(void)
 //	REG_EMC_SMCR1 = 0x0fff7700;
 }
 
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+
+/*
+ * Page data goes through an auto-request DMA channel in 32 byte bursts,
+ * which is a lot quicker than a readb()/writeb() loop over the bus.
+ * The ECC unit sees the data either way since it snoops the NAND port.
+ * Short transfers (OOB, status) and buffers that aren't cache line aligned
+ * lowmem, e.g. vmalloc()ed ones, use the CPU.
+ *
+ * A failed transfer has moved the NAND column on by an unknown amount, so
+ * it can't be redone by the CPU. read_buf/write_buf have no way to return
+ * an error either: they set jz_nand_dma_err, and the page read/write
+ * wrappers below turn that into an error for the whole page.
+ */
+#define JZ_NAND_DMA_MIN		256	/* more than any OOB area */
+#define JZ_NAND_DMA_ALIGN	32
+#define JZ_NAND_DMA_TIMEOUT	(HZ / 10)
+
+static int jz_nand_dma_chan = -1;
+static int jz_nand_dma_err;
+static u32 jz_nand_dma_stat;
+static DECLARE_COMPLETION(jz_nand_dma_done);
+
+static int (*jz_nand_read_page_ecc)(struct mtd_info *mtd,
+				    struct nand_chip *chip, uint8_t *buf);
+static int (*jz_nand_read_page_raw)(struct mtd_info *mtd,
+				    struct nand_chip *chip, uint8_t *buf);
+static int (*jz_nand_write_page_orig)(struct mtd_info *mtd,
+				      struct nand_chip *chip,
+				      const uint8_t *buf, int page,
+				      int cached, int raw);
+
+static irqreturn_t jz_nand_dma_irq(int irq, void *dev_id)
+{
+	int dmanr = jz_nand_dma_chan;
+
+	if (dmanr < 0)
+		return IRQ_NONE;
+	jz_nand_dma_stat = REG_DMAC_DCCSR(dmanr);
+	REG_DMAC_DCCSR(dmanr) = 0;
+	complete(&jz_nand_dma_done);
+	return IRQ_HANDLED;
+}
+
+static int jz_nand_dma_ok(const void *buf, int len)
+{
+	unsigned long addr = (unsigned long)buf;
+
+	return jz_nand_dma_chan >= 0 && len >= JZ_NAND_DMA_MIN &&
+		KSEGX(addr) == KSEG0 &&
+		!(addr & (JZ_NAND_DMA_ALIGN - 1)) &&
+		!(len & (JZ_NAND_DMA_ALIGN - 1));
+}
+
+static int jz_nand_dma_xfer(const void *buf, int len, int to_nand)
+{
+	int dmanr = jz_nand_dma_chan;
+	unsigned long addr = (unsigned long)buf;
+
+	if (to_nand)
+		dma_cache_wback(addr, len);
+	else
+		dma_cache_wback_inv(addr, len);
+
+	REG_DMAC_DCCSR(dmanr) = 0;
+	REG_DMAC_DRSR(dmanr) = DMAC_DRSR_RS_AUTO;
+	if (to_nand) {
+		REG_DMAC_DSAR(dmanr) = CPHYSADDR(addr);
+		REG_DMAC_DTAR(dmanr) = CPHYSADDR(NAND_DATA_PORT);
+		REG_DMAC_DCMD(dmanr) = DMA_32BYTE_TX_CMD | DMAC_DCMD_TIE;
+	} else {
+		REG_DMAC_DSAR(dmanr) = CPHYSADDR(NAND_DATA_PORT);
+		REG_DMAC_DTAR(dmanr) = CPHYSADDR(addr);
+		REG_DMAC_DCMD(dmanr) = DMA_32BYTE_RX_CMD | DMAC_DCMD_TIE;
+	}
+	REG_DMAC_DTCR(dmanr) = len / 32;
+	INIT_COMPLETION(jz_nand_dma_done);
+	REG_DMAC_DCCSR(dmanr) = DMAC_DCCSR_NDES | DMAC_DCCSR_EN;
+	REG_DMAC_DMACR |= DMAC_DMACR_DMAE;
+
+	if (!wait_for_completion_timeout(&jz_nand_dma_done,
+					 JZ_NAND_DMA_TIMEOUT)) {
+		REG_DMAC_DCCSR(dmanr) = 0;
+		synchronize_irq(IRQ_DMA_0 + dmanr);
+		printk(KERN_ERR "NAND: DMA %s timed out\n",
+		       to_nand ? "write" : "read");
+		return -ETIMEDOUT;
+	}
+
+	if (!(jz_nand_dma_stat & DMAC_DCCSR_TT)) {
+		printk(KERN_ERR "NAND: DMA %s failed, DCCSR %08x\n",
+		       to_nand ? "write" : "read", jz_nand_dma_stat);
+		return -EIO;
+	}
+	return 0;
+}
+
+static void jz_nand_read_buf(struct mtd_info *mtd, u_char *buf, int len)
+{
+	struct nand_chip *this = mtd->priv;
+	int i;
+
+	if (jz_nand_dma_ok(buf, len)) {
+		if (jz_nand_dma_xfer(buf, len, 0))
+			jz_nand_dma_err = 1;
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		buf[i] = readb(this->IO_ADDR_R);
+}
+
+static void jz_nand_write_buf(struct mtd_info *mtd, const u_char *buf, int len)
+{
+	struct nand_chip *this = mtd->priv;
+	int i;
+
+	if (jz_nand_dma_ok(buf, len)) {
+		if (jz_nand_dma_xfer(buf, len, 1))
+			jz_nand_dma_err = 1;
+		return;
+	}
+
+	for (i = 0; i < len; i++)
+		writeb(buf[i], this->IO_ADDR_W);
+}
+
+static int jz_nand_read_page(struct mtd_info *mtd, struct nand_chip *chip,
+			     uint8_t *buf)
+{
+	int ret;
+
+	jz_nand_dma_err = 0;
+	ret = jz_nand_read_page_ecc(mtd, chip, buf);
+	if (jz_nand_dma_err)
+		return -EIO;
+	return ret;
+}
+
+static int jz_nand_read_page_dma_raw(struct mtd_info *mtd,
+				     struct nand_chip *chip, uint8_t *buf)
+{
+	int ret;
+
+	jz_nand_dma_err = 0;
+	ret = jz_nand_read_page_raw(mtd, chip, buf);
+	if (jz_nand_dma_err)
+		return -EIO;
+	return ret;
+}
+
+static int jz_nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
+			      const uint8_t *buf, int page, int cached, int raw)
+{
+	int ret;
+
+	jz_nand_dma_err = 0;
+	ret = jz_nand_write_page_orig(mtd, chip, buf, page, cached, raw);
+	if (jz_nand_dma_err)
+		return -EIO;
+	return ret;
+}
+
+#endif /* CONFIG_MTD_NAND_JZ4740_DMA */
+
 #ifdef CONFIG_MTD_HW_HM_ECC
 
 static int jzsoc_nand_calculate_hm_ecc(struct mtd_info* mtd, 
@@ -525,6 +693,39 @@ static int jzsoc_nand_calculate_rs_ecc(struct mtd_info* mtd, const u_char* dat,
 
 #endif /* CONFIG_MTD_HW_RS_ECC */
 
+#ifdef CONFIG_MTD_NAND_JZ4740_FLASH_BBT
+/*
+ * Same markers as the generic flash bbt, plus a crc right behind the
+ * version byte. Bytes 8..16 are free in the oob with either ECC layout.
+ */
+static uint8_t jz_bbt_pattern[] = {'B', 'b', 't', '0' };
+static uint8_t jz_mirror_pattern[] = {'1', 't', 'b', 'B' };
+
+static struct nand_bbt_descr jz_bbt_main_descr = {
+	.options = NAND_BBT_LASTBLOCK | NAND_BBT_CREATE | NAND_BBT_WRITE
+		| NAND_BBT_2BIT | NAND_BBT_VERSION | NAND_BBT_PERCHIP
+		| NAND_BBT_CRC,
+	.offs =	8,
+	.len = 4,
+	.veroffs = 12,
+	.crcoffs = 13,
+	.maxblocks = 4,
+	.pattern = jz_bbt_pattern
+};
+
+static struct nand_bbt_descr jz_bbt_mirror_descr = {
+	.options = NAND_BBT_LASTBLOCK | NAND_BBT_CREATE | NAND_BBT_WRITE
+		| NAND_BBT_2BIT | NAND_BBT_VERSION | NAND_BBT_PERCHIP
+		| NAND_BBT_CRC,
+	.offs =	8,
+	.len = 4,
+	.veroffs = 12,
+	.crcoffs = 13,
+	.maxblocks = 4,
+	.pattern = jz_mirror_pattern
+};
+#endif /* CONFIG_MTD_NAND_JZ4740_FLASH_BBT */
+
 /*
  * Main initialization routine
  */
@@ -560,6 +761,15 @@ int __init jznand_init(void)
         this->cmd_ctrl = jz_hwcontrol;
         this->dev_ready = jz_device_ready;
 
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	jz_nand_dma_chan = jz_request_dma(DMA_ID_AUTO, "nand",
+					  jz_nand_dma_irq, IRQF_DISABLED, NULL);
+	if (jz_nand_dma_chan < 0)
+		printk(KERN_WARNING "NAND: no DMA channel, using PIO\n");
+	this->read_buf = jz_nand_read_buf;
+	this->write_buf = jz_nand_write_buf;
+#endif
+
 #ifdef CONFIG_MTD_HW_HM_ECC
 	this->ecc.calculate = jzsoc_nand_calculate_hm_ecc;
 	this->ecc.correct   = jzsoc_nand_hm_correct_data;
@@ -585,17 +795,54 @@ int __init jznand_init(void)
         /* 20 us command delay time */
         this->chip_delay = 20;
 
+#ifdef CONFIG_MTD_NAND_JZ4740_FLASH_BBT
+	this->options |= NAND_USE_FLASH_BBT;
+	this->bbt_td = &jz_bbt_main_descr;
+	this->bbt_md = &jz_bbt_mirror_descr;
+#endif
+
 	/* Scan to find existance of the device */
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	/*
+	 * Hook the page read/write paths before the bad block table scan
+	 * reads any pages, so DMA errors are reported from the start.
+	 */
+	this->options |= NAND_SKIP_BBTSCAN;
+	if (nand_scan_ident(jz_mtd, 1) || nand_scan_tail(jz_mtd))
+		goto out_dma;
+
+	jz_nand_read_page_ecc = this->ecc.read_page;
+	this->ecc.read_page = jz_nand_read_page;
+	jz_nand_read_page_raw = this->ecc.read_page_raw;
+	this->ecc.read_page_raw = jz_nand_read_page_dma_raw;
+	jz_nand_write_page_orig = this->write_page;
+	this->write_page = jz_nand_write_page;
+
+	this->options &= ~NAND_SKIP_BBTSCAN;
+	if (this->scan_bbt(jz_mtd)) {
+		nand_release(jz_mtd);
+		goto out_dma;
+	}
+#else
 	if (nand_scan(jz_mtd, 1)) {
 		kfree (jz_mtd);
 		return -ENXIO;
 	}
+#endif
 
 	/* Register the partitions */
 	nr_partitions = sizeof(partition_info) / sizeof(struct mtd_partition);
 	add_mtd_partitions(jz_mtd, partition_info, nr_partitions);
 
 	return 0;
+
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+out_dma:
+	if (jz_nand_dma_chan >= 0)
+		jz_free_dma(jz_nand_dma_chan);
+	kfree (jz_mtd);
+	return -ENXIO;
+#endif
 }
 module_init(jznand_init);
 
@@ -613,6 +860,11 @@ static void __exit jznand_cleanup(void)
 	/* Unregister the device */
 	del_mtd_device (jz_mtd);
 
+#ifdef CONFIG_MTD_NAND_JZ4740_DMA
+	if (jz_nand_dma_chan >= 0)
+		jz_free_dma(jz_nand_dma_chan);
+#endif
+
 	/* Free internal data buffers */
 	kfree (this->data_buf);
 
@@ -19,7 +19,6 @@
  *	rework for 2K page size chips
  *
  *  TODO:
- *	Enable cached programming for 2k page size chips
  *	Check, if mtd->ecctype should be set to MTD_ECC_HW
  *	if we have HW ecc support.
  *	The AG-AND chips have nice features for speed improvement,
@@ -1607,12 +1606,6 @@ static int nand_write_page(struct mtd_info *mtd, struct nand_chip *chip,
 	else
 		chip->ecc.write_page(mtd, chip, buf);
 
-	/*
-	 * Cached progamming disabled for now, Not sure if its worth the
-	 * trouble. The speed gain is not very impressive. (2.3->2.6Mib/s)
-	 */
-	cached = 0;
-
 	if (!cached || !(chip->options & NAND_CACHEPRG)) {
 
 		chip->cmdfunc(mtd, NAND_CMD_PAGEPROG, -1, -1);
@@ -1710,6 +1703,7 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 	uint8_t *oob = ops->oobbuf;
 	uint8_t *buf = ops->datbuf;
 	int ret, subpage;
+	int prev_cached = 0;
 
 	ops->retlen = 0;
 	if (!writelen)
@@ -1750,7 +1744,13 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 
 	while(1) {
 		int bytes = mtd->writesize;
-		int cached = writelen > bytes && page != blockmask;
+#ifdef CONFIG_MTD_NAND_CACHE_PROGRAM
+		int cached = writelen > bytes &&
+			(page & blockmask) != blockmask &&
+			(chip->options & NAND_CACHEPRG);
+#else
+		int cached = 0;
+#endif
 		uint8_t *wbuf = buf;
 
 		/* Partial page write ? */
@@ -1771,6 +1771,21 @@ static int nand_do_write_ops(struct mtd_info *mtd, loff_t to,
 		if (ret)
 			break;
 
+		/*
+		 * A cache programmed page is still being programmed when
+		 * write_page returns. Its result shows up in the N-1 status
+		 * bit after the next page. The first page of a run has no
+		 * such predecessor, so the bit means nothing there.
+		 */
+		if (prev_cached &&
+		    (chip->waitfunc(mtd, chip) & NAND_STATUS_FAIL_N1)) {
+			/* The previous page was not written either */
+			writelen += mtd->writesize;
+			ret = -EIO;
+			break;
+		}
+		prev_cached = cached;
+
 		writelen -= bytes;
 		if (!writelen)
 			break;
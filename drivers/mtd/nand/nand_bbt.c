@@ -61,6 +61,7 @@
 #include <linux/bitops.h>
 #include <linux/delay.h>
 #include <linux/vmalloc.h>
+#include <linux/crc32.h>
 
 /**
  * check_pattern - [GENERIC] check if a pattern is in the buffer
@@ -719,6 +720,13 @@ static int write_bbt(struct mtd_info *mtd, uint8_t *buf,
 			}
 		}
 
+		/* Protect the table data against partial writes */
+		if (td->options & NAND_BBT_CRC) {
+			__le32 crc = cpu_to_le32(crc32(~0, &buf[offs],
+						       numblocks >> sft));
+			memcpy(&buf[ooboffs + td->crcoffs], &crc, sizeof(crc));
+		}
+
 		memset(&einfo, 0, sizeof(einfo));
 		einfo.mtd = mtd;
 		einfo.addr = (unsigned long)to;
@@ -761,6 +769,62 @@ static inline int nand_memory_bbt(struct mtd_info *mtd, struct nand_bbt_descr *b
 	return create_bbt(mtd, this->buffers->databuf, bd, -1);
 }
 
+/**
+ * check_bbt_crc - [GENERIC] verify the crc of a bbt found on the device
+ * @mtd:	MTD device structure
+ * @buf:	temporary buffer
+ * @td:		descriptor for the bad block table
+ * @chip:	the chip number
+ *
+ * A table whose pattern and version were found, but whose data does not
+ * match the stored crc was only partially written, e.g. due to a power
+ * loss during nand_update_bbt. Forget about it, so the other copy is used
+ * and the broken one gets rewritten instead of trusting garbage.
+*/
+static void check_bbt_crc(struct mtd_info *mtd, uint8_t *buf,
+			  struct nand_bbt_descr *td, int chip)
+{
+	struct nand_chip *this = mtd->priv;
+	struct mtd_oob_ops ops;
+	size_t retlen, len;
+	loff_t from;
+	__le32 crc;
+	int res, numblocks, bits;
+
+	if (!(td->options & NAND_BBT_CRC) || td->pages[chip] == -1)
+		return;
+
+	if (td->options & NAND_BBT_PERCHIP)
+		numblocks = (int)(this->chipsize >> this->bbt_erase_shift);
+	else
+		numblocks = (int)(mtd->size >> this->bbt_erase_shift);
+	bits = td->options & NAND_BBT_NRBITS_MSK;
+	len = (numblocks * bits) >> 3;
+	from = ((loff_t) td->pages[chip]) << this->page_shift;
+
+	/* ECC errors are fine here, the crc tells whether the data is sane */
+	res = mtd->read(mtd, from, len, &retlen, buf);
+	if (res < 0 && retlen != len)
+		goto bad;
+
+	ops.mode = MTD_OOB_PLACE;
+	ops.ooboffs = 0;
+	ops.ooblen = mtd->oobsize;
+	ops.oobbuf = &buf[len];
+	ops.datbuf = NULL;
+	res = mtd->read_oob(mtd, from, &ops);
+	if (res < 0 || ops.oobretlen != ops.ooblen)
+		goto bad;
+
+	memcpy(&crc, &buf[len + td->crcoffs], sizeof(crc));
+	if (le32_to_cpu(crc) == crc32(~0, buf, len))
+		return;
+ bad:
+	printk(KERN_WARNING "nand_bbt: Bad block table at page %d is "
+	       "corrupted, ignoring it\n", td->pages[chip]);
+	td->pages[chip] = -1;
+}
+
 /**
  * check_create - [GENERIC] create and write bbt(s) if necessary
  * @mtd:	MTD device structure
@@ -793,6 +857,10 @@ static int check_create(struct mtd_info *mtd, uint8_t *buf, struct nand_bbt_desc
 		rd2 = NULL;
 		/* Per chip or per device ? */
 		chipsel = (td->options & NAND_BBT_PERCHIP) ? i : -1;
+		/* Drop table copies which were not written completely */
+		check_bbt_crc(mtd, buf, td, i);
+		if (md)
+			check_bbt_crc(mtd, buf, md, i);
 		/* Mirrored table avilable ? */
 		if (md) {
 			if (td->pages[i] == -1 && md->pages[i] == -1) {
@@ -1054,18 +1122,24 @@ int nand_update_bbt(struct mtd_info *mtd, loff_t offs)
 	if (md)
 		md->version[chip]++;
 
+	/*
+	 * The copies are rewritten one after the other, so an interrupted
+	 * update always leaves one complete table behind. With NAND_BBT_CRC
+	 * the broken copy is detected at the next boot and restored from the
+	 * other one, instead of rescanning the whole chip.
+	 */
+
 	/* Write the bad block table to the device ? */
-	if ((writeops & 0x01) && (td->options & NAND_BBT_WRITE)) {
+	if ((writeops & 0x01) && (td->options & NAND_BBT_WRITE))
 		res = write_bbt(mtd, buf, td, md, chipsel);
-		if (res < 0)
-			goto out;
-	}
+
 	/* Write the mirror bad block table to the device ? */
 	if ((writeops & 0x02) && md && (md->options & NAND_BBT_WRITE)) {
-		res = write_bbt(mtd, buf, md, td, chipsel);
+		int ret = write_bbt(mtd, buf, md, td, chipsel);
+		if (!res)
+			res = ret;
 	}
 
- out:
 	kfree(buf);
 	return res;
 }
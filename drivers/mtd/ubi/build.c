@@ -28,9 +28,11 @@
  * specified, UBI does not attach any MTD device, but it is possible to do
  * later using the "UBI control device".
  *
- * At the moment we only attach UBI devices by scanning, which will become a
- * bottleneck when flashes reach certain large size. Then one may improve UBI
- * and add other methods, although it does not seem to be easy to do.
+ * UBI devices are attached by scanning, which becomes a bottleneck when
+ * flashes reach certain large size. If fastmap support is enabled, UBI first
+ * tries to attach the device using the fastmap, which requires scanning only
+ * a small number of physical eraseblocks, and falls back to full scanning if
+ * there is no valid fastmap on the media.
  */
 
 #include <linux/err.h>
@@ -41,6 +43,7 @@
 #include <linux/miscdevice.h>
 #include <linux/log2.h>
 #include <linux/kthread.h>
+#include <linux/reboot.h>
 #include "ubi.h"
 
 /* Maximum length of the 'mtd=' parameter */
@@ -438,17 +441,18 @@ static void uif_close(struct ubi_device *ubi)
  * This function returns zero in case of success and a negative error code in
  * case of failure.
  *
- * Note, currently this is the only method to attach UBI devices. Hopefully in
- * the future we'll have more scalable attaching methods and avoid full media
- * scanning. But even in this case scanning will be needed as a fall-back
- * attaching method if there are some on-flash table corruptions.
+ * If there is a valid fastmap on the media, it is used instead of scanning all
+ * physical eraseblocks. Full scanning is the fall-back method in case the
+ * fastmap is absent or corrupted.
  */
 static int attach_by_scanning(struct ubi_device *ubi)
 {
 	int err;
 	struct ubi_scan_info *si;
 
-	si = ubi_scan(ubi);
+	si = ubi_scan_fastmap(ubi);
+	if (!si)
+		si = ubi_scan(ubi);
 	if (IS_ERR(si))
 		return PTR_ERR(si);
 
@@ -469,14 +473,21 @@ static int attach_by_scanning(struct ubi_device *ubi)
 	if (err)
 		goto out_wl;
 
+	err = ubi_fastmap_init(ubi);
+	if (err)
+		goto out_eba;
+
 	ubi_scan_destroy_si(si);
 	return 0;
 
+out_eba:
+	ubi_eba_close(ubi);
 out_wl:
 	ubi_wl_close(ubi);
 out_vtbl:
 	vfree(ubi->vtbl);
 out_si:
+	ubi_fastmap_close(ubi);
 	ubi_scan_destroy_si(si);
 	return err;
 }
@@ -762,6 +773,9 @@ int ubi_attach_mtd_dev(struct mtd_info *mtd, int ubi_num, int vid_hdr_offset)
 	mutex_init(&ubi->ckvol_mutex);
 	mutex_init(&ubi->volumes_mutex);
 	spin_lock_init(&ubi->volumes_lock);
+	mutex_init(&ubi->fm_mutex);
+	mutex_init(&ubi->fm_check_mutex);
+	init_rwsem(&ubi->fm_sem);
 
 	ubi_msg("attaching mtd%d to ubi%d", mtd->index, ubi_num);
 
@@ -838,6 +852,7 @@ out_uif:
 out_detach:
 	ubi_eba_close(ubi);
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	vfree(ubi->vtbl);
 out_free:
 	vfree(ubi->peb_buf1);
@@ -894,13 +909,27 @@ int ubi_detach_mtd_dev(int ubi_num, int anyway)
 	/*
 	 * Before freeing anything, we have to stop the background thread to
 	 * prevent it from doing anything on this device while we are freeing.
+	 * Disable it first, so that nothing wakes it up once it has exited.
 	 */
-	if (ubi->bgt_thread)
+	if (ubi->bgt_thread) {
+		spin_lock(&ubi->wl_lock);
+		ubi->thread_enabled = 0;
+		spin_unlock(&ubi->wl_lock);
 		kthread_stop(ubi->bgt_thread);
+	}
+
+	/*
+	 * Leave an up-to-date fastmap to speed up the next attach. The erase
+	 * works this queues for the old fastmap PEBs are dropped by
+	 * 'ubi_wl_close()', the next attach finds those PEBs stale and erases
+	 * them.
+	 */
+	ubi_update_fastmap(ubi);
 
 	uif_close(ubi);
 	ubi_eba_close(ubi);
 	ubi_wl_close(ubi);
+	ubi_fastmap_close(ubi);
 	vfree(ubi->vtbl);
 	put_mtd_device(ubi->mtd);
 	vfree(ubi->peb_buf1);
@@ -941,6 +970,41 @@ static struct mtd_info * __init open_mtd_device(const char *mtd_dev)
 	return mtd;
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * ubi_reboot_notifier - write fastmap of all UBI devices before reboot.
+ * @nb: notifier block
+ * @event: reboot event
+ * @unused: not used
+ */
+static int ubi_reboot_notifier(struct notifier_block *nb, unsigned long event,
+			       void *unused)
+{
+	int i;
+	struct ubi_device *ubi;
+
+	for (i = 0; i < UBI_MAX_DEVICES; i++) {
+		ubi = ubi_get_device(i);
+		if (!ubi)
+			continue;
+		ubi_update_fastmap(ubi);
+		ubi_put_device(ubi);
+	}
+
+	return NOTIFY_DONE;
+}
+
+static struct notifier_block ubi_reboot_nb = {
+	.notifier_call = ubi_reboot_notifier,
+};
+
+#define ubi_register_reboot() register_reboot_notifier(&ubi_reboot_nb)
+#define ubi_unregister_reboot() unregister_reboot_notifier(&ubi_reboot_nb)
+#else
+#define ubi_register_reboot() 0
+#define ubi_unregister_reboot()
+#endif
+
 static int __init ubi_init(void)
 {
 	int err, i, k;
@@ -1004,6 +1068,12 @@ static int __init ubi_init(void)
 		}
 	}
 
+	err = ubi_register_reboot();
+	if (err) {
+		ubi_err("cannot register reboot notifier");
+		goto out_detach;
+	}
+
 	return 0;
 
 out_detach:
@@ -1030,6 +1100,7 @@ static void __exit ubi_exit(void)
 {
 	int i;
 
+	ubi_unregister_reboot();
 	for (i = 0; i < UBI_MAX_DEVICES; i++)
 		if (ubi_devices[i]) {
 			mutex_lock(&ubi_devices_mutex);
@@ -39,6 +39,14 @@
  * stored in the volume identifier header. This means that each VID header has
  * a unique sequence number. The sequence number is only increased an we assume
  * 64 bits is enough to never overflow.
+ *
+ * If the device was attached using the fastmap, the EBA table is built from
+ * the fastmap and the mappings which came from it are verified lazily, when
+ * the logical eraseblock is accessed for the first time (see
+ * 'check_mapping()'). Any change of the EBA table is done with
+ * @ubi->fm_sem held for reading, which is taken together with the logical
+ * eraseblock write lock. This guarantees that the fastmap unit sees the EBA
+ * table in a consistent state when it writes the fastmap.
  */
 
 #include <linux/slab.h>
@@ -50,14 +58,14 @@
 #define EBA_RESERVED_PEBS 1
 
 /**
- * next_sqnum - get next sequence number.
+ * ubi_next_sqnum - get next sequence number.
  * @ubi: UBI device description object
  *
  * This function returns next sequence number to use, which is just the current
  * global sequence counter value. It also increases the global sequence
  * counter.
  */
-static unsigned long long next_sqnum(struct ubi_device *ubi)
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi)
 {
 	unsigned long long sqnum;
 
@@ -258,11 +266,12 @@ static int leb_write_lock(struct ubi_device *ubi, int vol_id, int lnum)
 	if (IS_ERR(le))
 		return PTR_ERR(le);
 	down_write(&le->mutex);
+	ubi_fm_down_read(ubi);
 	return 0;
 }
 
 /**
- * leb_write_lock - lock logical eraseblock for writing.
+ * leb_write_trylock - lock logical eraseblock for writing.
  * @ubi: UBI device description object
  * @vol_id: volume ID
  * @lnum: logical eraseblock number
@@ -280,8 +289,12 @@ static int leb_write_trylock(struct ubi_device *ubi, int vol_id, int lnum)
 	le = ltree_add_entry(ubi, vol_id, lnum);
 	if (IS_ERR(le))
 		return PTR_ERR(le);
-	if (down_write_trylock(&le->mutex))
-		return 0;
+	if (down_write_trylock(&le->mutex)) {
+		/* The fastmap is being written, treat this as contention */
+		if (ubi_fm_down_read_trylock(ubi))
+			return 0;
+		up_write(&le->mutex);
+	}
 
 	/* Contention, cancel */
 	spin_lock(&ubi->ltree_lock);
@@ -321,11 +334,121 @@ static void leb_write_unlock(struct ubi_device *ubi, int vol_id, int lnum)
 		free = 0;
 	spin_unlock(&ubi->ltree_lock);
 
+	ubi_fm_up_read(ubi);
 	up_write(&le->mutex);
 	if (free)
 		kfree(le);
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+/**
+ * check_mapping - verify a mapping which came from the fastmap.
+ * @ubi: UBI device description object
+ * @vol: volume description object
+ * @lnum: logical eraseblock number
+ * @pnum: physical eraseblock @lnum is mapped to (may be changed)
+ *
+ * The fastmap does not know about logical eraseblocks which were un-mapped and
+ * erased after it had been written, so the first time such a mapping is used,
+ * the VID header of physical eraseblock @pnum is read to make sure it still
+ * belongs to @lnum. If the physical eraseblock turns out to be erased, the
+ * logical eraseblock is un-mapped and @pnum is set to %UBI_LEB_UNMAPPED.
+ *
+ * The logical eraseblock has to be locked and @ubi->fm_sem has to be held for
+ * reading. Returns zero in case of success and a negative error code in case
+ * of failure.
+ */
+static int check_mapping(struct ubi_device *ubi, struct ubi_volume *vol,
+			 int lnum, int *pnum)
+{
+	int err = 0;
+	struct ubi_vid_hdr *vid_hdr;
+
+	if (!ubi_fm_unverified(ubi, *pnum))
+		return 0;
+
+	mutex_lock(&ubi->fm_check_mutex);
+	/* Somebody else might have checked it meanwhile */
+	*pnum = vol->eba_tbl[lnum];
+	if (!ubi_fm_unverified(ubi, *pnum))
+		goto out_unlock;
+
+	vid_hdr = ubi_zalloc_vid_hdr(ubi, GFP_NOFS);
+	if (!vid_hdr) {
+		err = -ENOMEM;
+		goto out_unlock;
+	}
+
+	err = ubi_io_read_vid_hdr(ubi, *pnum, vid_hdr, 0);
+	if (err < 0)
+		goto out_free;
+
+	if (err == UBI_IO_PEB_FREE || err == UBI_IO_PEB_EMPTY ||
+	    err == UBI_IO_BAD_VID_HDR) {
+		dbg_eba("LEB %d:%d was un-mapped after the fastmap was written",
+			vol->vol_id, lnum);
+		clear_bit(*pnum, ubi->fm_checkmap);
+		vol->eba_tbl[lnum] = UBI_LEB_UNMAPPED;
+		err = ubi_wl_put_peb(ubi, *pnum, err == UBI_IO_BAD_VID_HDR);
+		*pnum = UBI_LEB_UNMAPPED;
+		goto out_free;
+	}
+
+	if (be32_to_cpu(vid_hdr->vol_id) != vol->vol_id ||
+	    be32_to_cpu(vid_hdr->lnum) != lnum) {
+		ubi_err("fastmap maps LEB %d:%d to PEB %d, which contains "
+			"LEB %d:%d", vol->vol_id, lnum, *pnum,
+			be32_to_cpu(vid_hdr->vol_id),
+			be32_to_cpu(vid_hdr->lnum));
+		ubi_ro_mode(ubi);
+		err = -EINVAL;
+		goto out_free;
+	}
+
+	clear_bit(*pnum, ubi->fm_checkmap);
+	err = 0;
+
+out_free:
+	ubi_free_vid_hdr(ubi, vid_hdr);
+out_unlock:
+	mutex_unlock(&ubi->fm_check_mutex);
+	return err;
+}
+#else
+#define check_mapping(ubi, vol, lnum, pnum) 0
+#endif
+
+/**
+ * ubi_eba_is_mapped - check if a logical eraseblock is mapped.
+ * @ubi: UBI device description object
+ * @vol: volume description object
+ * @lnum: logical eraseblock number
+ *
+ * This function returns %1 if logical eraseblock @lnum is mapped, %0 if not,
+ * and a negative error code in case of failure.
+ */
+int ubi_eba_is_mapped(struct ubi_device *ubi, struct ubi_volume *vol, int lnum)
+{
+	int err, pnum = vol->eba_tbl[lnum];
+
+	if (!ubi_fm_unverified(ubi, pnum))
+		return pnum >= 0;
+
+	err = leb_read_lock(ubi, vol->vol_id, lnum);
+	if (err)
+		return err;
+
+	pnum = vol->eba_tbl[lnum];
+	ubi_fm_down_read(ubi);
+	err = check_mapping(ubi, vol, lnum, &pnum);
+	ubi_fm_up_read(ubi);
+	leb_read_unlock(ubi, vol->vol_id, lnum);
+	if (err)
+		return err;
+
+	return pnum >= 0;
+}
+
 /**
  * ubi_eba_unmap_leb - un-map logical eraseblock.
  * @ubi: UBI device description object
@@ -394,6 +517,16 @@ int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 		return err;
 
 	pnum = vol->eba_tbl[lnum];
+	if (ubi_fm_unverified(ubi, pnum)) {
+		ubi_fm_down_read(ubi);
+		err = check_mapping(ubi, vol, lnum, &pnum);
+		ubi_fm_up_read(ubi);
+		if (err) {
+			leb_read_unlock(ubi, vol_id, lnum);
+			return err;
+		}
+	}
+
 	if (pnum < 0) {
 		/*
 		 * The logical eraseblock is not mapped, fill the whole buffer
@@ -539,7 +672,7 @@ retry:
 		goto out_put;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	err = ubi_io_write_vid_hdr(ubi, new_pnum, vid_hdr);
 	if (err)
 		goto write_error;
@@ -620,6 +753,12 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 		return err;
 
 	pnum = vol->eba_tbl[lnum];
+	err = check_mapping(ubi, vol, lnum, &pnum);
+	if (err) {
+		leb_write_unlock(ubi, vol_id, lnum);
+		return err;
+	}
+
 	if (pnum >= 0) {
 		dbg_eba("write %d bytes at offset %d of LEB %d:%d, PEB %d",
 			len, offset, vol_id, lnum, pnum);
@@ -648,7 +787,7 @@ int ubi_eba_write_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
 	}
 
 	vid_hdr->vol_type = UBI_VID_DYNAMIC;
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -709,7 +848,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -764,7 +903,7 @@ int ubi_eba_write_leb_st(struct ubi_device *ubi, struct ubi_volume *vol,
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -829,7 +968,7 @@ write_error:
 		return err;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -882,7 +1021,7 @@ int ubi_eba_atomic_leb_change(struct ubi_device *ubi, struct ubi_volume *vol,
 	if (err)
 		goto out_mutex;
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	vid_hdr->vol_id = cpu_to_be32(vol_id);
 	vid_hdr->lnum = cpu_to_be32(lnum);
 	vid_hdr->compat = ubi_get_compat(ubi, vol_id);
@@ -950,7 +1089,7 @@ write_error:
 		goto out_leb_unlock;
 	}
 
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 	ubi_msg("try another PEB");
 	goto retry;
 }
@@ -1081,7 +1220,7 @@ int ubi_eba_copy_leb(struct ubi_device *ubi, int from, int to,
 		vid_hdr->data_size = cpu_to_be32(data_size);
 		vid_hdr->data_crc = cpu_to_be32(crc);
 	}
-	vid_hdr->sqnum = cpu_to_be64(next_sqnum(ubi));
+	vid_hdr->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
 
 	err = ubi_io_write_vid_hdr(ubi, to, vid_hdr);
 	if (err)
@@ -0,0 +1,1043 @@
+/*
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See
+ * the GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * UBI fastmap unit.
+ *
+ * This unit is responsible for storing a snapshot of the UBI device state on
+ * the flash and for attaching the device using this snapshot, which is much
+ * faster than scanning all physical eraseblocks.
+ *
+ * The fastmap is stored in the internal fastmap volume (%UBI_FM_VOLUME_ID).
+ * Its first logical eraseblock (the anchor) always lives in one of the first
+ * %UBI_FM_MAX_START physical eraseblocks, so only those have to be looked at
+ * to find the fastmap. The anchor starts with &struct ubi_fm_hdr which lists
+ * all physical eraseblocks of the fastmap and is followed by the records
+ * describing the state of every physical eraseblock (see
+ * &struct ubi_fm_hdr).
+ *
+ * The fastmap stays valid after it has been written as long as every
+ * physical eraseblock which is given out by the WL unit is scanned on the next
+ * attach. To achieve this, the fastmap refers to a pool of free eraseblocks
+ * which are scanned, and the WL unit hands out only pool eraseblocks while the
+ * fastmap is valid. When the pool is exhausted or the fastmap cannot describe
+ * some change (e.g., an eraseblock went bad), the fastmap is invalidated by
+ * erasing the anchor and the background thread writes a new one.
+ *
+ * Logical eraseblocks may be un-mapped and their physical eraseblocks erased
+ * after the fastmap was written. Such mappings are detected lazily: physical
+ * eraseblocks mapped by the fastmap are marked in @ubi->fm_checkmap and their
+ * VID headers are checked by the EBA unit when they are accessed for the first
+ * time.
+ *
+ * Erase counters stored in the fastmap may be behind the ones on the media,
+ * the WL unit picks up the on-flash values when it erases eraseblocks.
+ */
+
+#include <linux/crc32.h>
+#include <linux/bitops.h>
+#include "ubi.h"
+
+/* Per-eraseblock markers used when the fastmap is processed */
+#define FM_PEB_UNSEEN    0
+#define FM_PEB_SCAN      1
+#define FM_PEB_DESCRIBED 2
+
+/**
+ * fm_size - maximum size of the fastmap.
+ * @ubi: UBI device description object
+ *
+ * Each physical eraseblock is described by at most one logical eraseblock
+ * record, which is the largest record type.
+ */
+static int fm_size(const struct ubi_device *ubi)
+{
+	return sizeof(struct ubi_fm_hdr) +
+	       (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+	       sizeof(struct ubi_fm_volume) +
+	       ubi->peb_count * sizeof(struct ubi_fm_leb);
+}
+
+/**
+ * fm_pool_size - size of the fastmap pool for a device.
+ * @ubi: UBI device description object
+ */
+static int fm_pool_size(const struct ubi_device *ubi)
+{
+	return clamp(ubi->peb_count / 20, 8, 256);
+}
+
+/**
+ * find_anchor - find the fastmap anchor.
+ * @ubi: UBI device description object
+ * @vh: VID header buffer to use
+ * @stale: array where stale anchors are stored
+ * @stale_cnt: number of stale anchors is returned here
+ *
+ * This function looks for logical eraseblock 0 of the fastmap volume with the
+ * highest sequence number among the first %UBI_FM_MAX_START physical
+ * eraseblocks. The other anchors found are stale, they may be left if an
+ * unclean reboot happened while a new fastmap was written. Returns the anchor
+ * physical eraseblock number, %-ENOENT if there is no fastmap and another
+ * negative error code in case of failure.
+ */
+static int find_anchor(struct ubi_device *ubi, struct ubi_vid_hdr *vh,
+		       int *stale, int *stale_cnt)
+{
+	int pnum, err, anchor = -ENOENT;
+	unsigned long long sqnum = 0;
+
+	*stale_cnt = 0;
+	for (pnum = 0; pnum < ubi->peb_count && pnum < UBI_FM_MAX_START;
+	     pnum++) {
+		err = ubi_io_is_bad(ubi, pnum);
+		if (err < 0)
+			return err;
+		if (err)
+			continue;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+		if (err < 0)
+			return err;
+		if (err && err != UBI_IO_BITFLIPS)
+			continue;
+
+		if (be32_to_cpu(vh->vol_id) != UBI_FM_VOLUME_ID ||
+		    be32_to_cpu(vh->lnum) != 0)
+			continue;
+
+		if (anchor < 0 || be64_to_cpu(vh->sqnum) > sqnum) {
+			if (anchor >= 0)
+				stale[(*stale_cnt)++] = anchor;
+			anchor = pnum;
+			sqnum = be64_to_cpu(vh->sqnum);
+		} else
+			stale[(*stale_cnt)++] = pnum;
+	}
+
+	return anchor;
+}
+
+/**
+ * read_fastmap - read and check the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: the anchor physical eraseblock
+ * @vh: VID header buffer to use
+ * @bitflips: set to %1 if bit-flips were detected
+ *
+ * This function reads the fastmap header and records into a vmalloc'ed buffer
+ * and checks them. Returns the buffer in case of success, %NULL if the
+ * fastmap is corrupted and an error pointer in case of failure.
+ */
+static struct ubi_fm_hdr *read_fastmap(struct ubi_device *ubi, int anchor,
+				       struct ubi_vid_hdr *vh, int *bitflips)
+{
+	int i, err, pnum, len, offs, size, data_size, fm_peb_count;
+	unsigned long long sqnum;
+	struct ubi_fm_hdr *fmh;
+	void *buf;
+
+	fmh = kmalloc(sizeof(struct ubi_fm_hdr), GFP_KERNEL);
+	if (!fmh)
+		return ERR_PTR(-ENOMEM);
+
+	err = ubi_io_read_data(ubi, fmh, anchor, 0, sizeof(struct ubi_fm_hdr));
+	if (err == UBI_IO_BITFLIPS)
+		*bitflips = 1;
+	else if (err) {
+		buf = err < 0 && err != -EBADMSG ? ERR_PTR(err) : NULL;
+		goto out_fmh;
+	}
+
+	buf = NULL;
+	if (be32_to_cpu(fmh->magic) != UBI_FM_HDR_MAGIC ||
+	    fmh->version != UBI_FM_FMT_VERSION ||
+	    crc32(UBI_CRC32_INIT, fmh, UBI_FM_HDR_SIZE_CRC) !=
+	    be32_to_cpu(fmh->hdr_crc)) {
+		dbg_bld("bad fastmap header at PEB %d", anchor);
+		goto out_fmh;
+	}
+
+	fm_peb_count = be32_to_cpu(fmh->fm_peb_count);
+	data_size = be32_to_cpu(fmh->data_size);
+	if (be32_to_cpu(fmh->peb_count) != ubi->peb_count ||
+	    fm_peb_count <= 0 || fm_peb_count > UBI_FM_MAX_BLOCKS ||
+	    be32_to_cpu(fmh->fm_pebs[0]) != anchor || data_size < 0 ||
+	    data_size > fm_peb_count * ubi->leb_size -
+			(int)sizeof(struct ubi_fm_hdr)) {
+		ubi_warn("inconsistent fastmap header at PEB %d", anchor);
+		goto out_fmh;
+	}
+
+	size = sizeof(struct ubi_fm_hdr) + data_size;
+	buf = vmalloc(size);
+	if (!buf) {
+		buf = ERR_PTR(-ENOMEM);
+		goto out_fmh;
+	}
+
+	sqnum = be64_to_cpu(fmh->sqnum);
+	for (i = 0, offs = 0; offs < size; i++, offs += ubi->leb_size) {
+		pnum = be32_to_cpu(fmh->fm_pebs[i]);
+		if (pnum < 0 || pnum >= ubi->peb_count)
+			goto out_corrupted;
+
+		err = ubi_io_read_vid_hdr(ubi, pnum, vh, 0);
+		if (err < 0)
+			goto out_err;
+		if (err == UBI_IO_BITFLIPS)
+			*bitflips = 1;
+		else if (err)
+			goto out_corrupted;
+
+		if (be32_to_cpu(vh->vol_id) != UBI_FM_VOLUME_ID ||
+		    be32_to_cpu(vh->lnum) != i ||
+		    be64_to_cpu(vh->sqnum) <= sqnum)
+			goto out_corrupted;
+
+		len = min_t(int, ubi->leb_size, size - offs);
+		err = ubi_io_read_data(ubi, buf + offs, pnum, 0, len);
+		if (err == UBI_IO_BITFLIPS)
+			*bitflips = 1;
+		else if (err == -EBADMSG)
+			goto out_corrupted;
+		else if (err)
+			goto out_err;
+	}
+
+	if (crc32(UBI_CRC32_INIT, buf + sizeof(struct ubi_fm_hdr),
+		  data_size) != be32_to_cpu(fmh->data_crc))
+		goto out_corrupted;
+
+	kfree(fmh);
+	return buf;
+
+out_err:
+	vfree(buf);
+	buf = ERR_PTR(err > 0 ? -EIO : err);
+	goto out_fmh;
+out_corrupted:
+	ubi_warn("fastmap at PEB %d is corrupted", anchor);
+	vfree(buf);
+	buf = NULL;
+out_fmh:
+	kfree(fmh);
+	return buf;
+}
+
+/**
+ * fm_record - get the next fastmap record.
+ * @pos: current position, advanced past the record
+ * @end: end of the records
+ * @size: size of the record
+ *
+ * Returns a pointer to the record or %NULL if the records are truncated.
+ */
+static void *fm_record(void **pos, void *end, int size)
+{
+	void *rec = *pos;
+
+	if (end - rec < size)
+		return NULL;
+	*pos = rec + size;
+	return rec;
+}
+
+/**
+ * mark_peb - mark a physical eraseblock as seen in the fastmap.
+ * @ubi: UBI device description object
+ * @seen: per-eraseblock markers
+ * @pnum: the physical eraseblock number
+ * @how: %FM_PEB_SCAN or %FM_PEB_DESCRIBED
+ *
+ * Returns zero in case of success and %-EINVAL if @pnum is invalid or was
+ * already seen.
+ */
+static int mark_peb(const struct ubi_device *ubi, u8 *seen, int pnum, int how)
+{
+	if (pnum < 0 || pnum >= ubi->peb_count || seen[pnum] != FM_PEB_UNSEEN) {
+		ubi_warn("bad or duplicated PEB %d in the fastmap", pnum);
+		return -EINVAL;
+	}
+
+	seen[pnum] = how;
+	return 0;
+}
+
+/**
+ * account_ec - account the erase counter of a described physical eraseblock.
+ * @si: scanning information
+ * @ec: the erase counter
+ */
+static void account_ec(struct ubi_scan_info *si, int ec)
+{
+	si->ec_sum += ec;
+	si->ec_count += 1;
+	if (ec > si->max_ec)
+		si->max_ec = ec;
+	if (ec < si->min_ec)
+		si->min_ec = ec;
+}
+
+/**
+ * add_ec_records - add free or erase fastmap records to a scanning list.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: per-eraseblock markers
+ * @pos: current position in the records
+ * @end: end of the records
+ * @count: number of records
+ * @list: the list to add the eraseblocks to
+ */
+static int add_ec_records(struct ubi_device *ubi, struct ubi_scan_info *si,
+			  u8 *seen, void **pos, void *end, int count,
+			  struct list_head *list)
+{
+	int i, err, pnum, ec;
+	struct ubi_fm_ec *fme;
+
+	for (i = 0; i < count; i++) {
+		fme = fm_record(pos, end, sizeof(struct ubi_fm_ec));
+		if (!fme)
+			return -EINVAL;
+
+		pnum = be32_to_cpu(fme->pnum);
+		ec = be32_to_cpu(fme->ec);
+		if (ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+			return -EINVAL;
+
+		err = mark_peb(ubi, seen, pnum, FM_PEB_DESCRIBED);
+		if (err)
+			return err;
+
+		err = ubi_scan_add_to_list(si, pnum, ec, list);
+		if (err)
+			return err;
+		account_ec(si, ec);
+	}
+
+	return 0;
+}
+
+/**
+ * add_volume_records - add a fastmap volume record to scanning information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @seen: per-eraseblock markers
+ * @pos: current position in the records
+ * @end: end of the records
+ * @sqnum: sequence number of the fastmap
+ *
+ * Logical eraseblocks of the volume are added as if their VID headers were
+ * read from the flash, with the sequence number of the fastmap.
+ */
+static int add_volume_records(struct ubi_device *ubi, struct ubi_scan_info *si,
+			      u8 *seen, void **pos, void *end, __be64 sqnum)
+{
+	int i, err, pnum, lnum, ec, leb_count, used_ebs, vol_type;
+	struct ubi_fm_volume *fmv;
+	struct ubi_fm_leb *fml;
+	struct ubi_vid_hdr vh;
+
+	fmv = fm_record(pos, end, sizeof(struct ubi_fm_volume));
+	if (!fmv)
+		return -EINVAL;
+
+	leb_count = be32_to_cpu(fmv->leb_count);
+	used_ebs = be32_to_cpu(fmv->used_ebs);
+	vol_type = fmv->vol_type;
+	if (leb_count < 0 || leb_count > ubi->peb_count ||
+	    (vol_type != UBI_VID_DYNAMIC && vol_type != UBI_VID_STATIC))
+		return -EINVAL;
+
+	memset(&vh, 0, sizeof(struct ubi_vid_hdr));
+	vh.vol_type = vol_type;
+	vh.compat = fmv->compat;
+	vh.vol_id = fmv->vol_id;
+	vh.used_ebs = fmv->used_ebs;
+	vh.data_pad = fmv->data_pad;
+	vh.sqnum = sqnum;
+
+	for (i = 0; i < leb_count; i++) {
+		fml = fm_record(pos, end, sizeof(struct ubi_fm_leb));
+		if (!fml)
+			return -EINVAL;
+
+		pnum = be32_to_cpu(fml->pnum);
+		lnum = be32_to_cpu(fml->lnum);
+		ec = be32_to_cpu(fml->ec);
+		if (lnum < 0 || ec < 0 || ec > UBI_MAX_ERASECOUNTER)
+			return -EINVAL;
+
+		err = mark_peb(ubi, seen, pnum, FM_PEB_DESCRIBED);
+		if (err)
+			return err;
+
+		vh.lnum = fml->lnum;
+		if (vol_type == UBI_VID_STATIC) {
+			if (lnum == used_ebs - 1)
+				vh.data_size = fmv->last_eb_bytes;
+			else
+				vh.data_size = cpu_to_be32(ubi->leb_size -
+						be32_to_cpu(fmv->data_pad));
+		}
+
+		err = ubi_scan_add_used(ubi, si, pnum, ec, &vh, fml->scrub);
+		if (err)
+			return err;
+		account_ec(si, ec);
+		set_bit(pnum, ubi->fm_checkmap);
+	}
+
+	return 0;
+}
+
+/**
+ * process_fastmap - build scanning information from the fastmap.
+ * @ubi: UBI device description object
+ * @fmh: the fastmap header followed by the records
+ * @scanned: number of scanned physical eraseblocks is returned here
+ *
+ * This function adds the physical eraseblocks described by the fastmap to the
+ * scanning information and scans all the others. Returns the scanning
+ * information in case of success and an error pointer in case of failure,
+ * %-EINVAL means the fastmap is inconsistent.
+ */
+static struct ubi_scan_info *process_fastmap(struct ubi_device *ubi,
+					     struct ubi_fm_hdr *fmh,
+					     int *scanned)
+{
+	int i, err, pnum, fm_peb_count, found = 0;
+	void *pos = fmh + 1, *end = pos + be32_to_cpu(fmh->data_size);
+	struct ubi_scan_info *si;
+	struct ubi_scan_leb *seb, *tmp;
+	u8 *seen;
+
+	seen = kzalloc(ubi->peb_count, GFP_KERNEL);
+	if (!seen)
+		return ERR_PTR(-ENOMEM);
+
+	si = ubi_scan_start(ubi);
+	if (IS_ERR(si)) {
+		kfree(seen);
+		return si;
+	}
+
+	/* The fastmap eraseblocks themselves are scanned */
+	fm_peb_count = be32_to_cpu(fmh->fm_peb_count);
+	for (i = 0; i < fm_peb_count; i++) {
+		err = mark_peb(ubi, seen, be32_to_cpu(fmh->fm_pebs[i]),
+			       FM_PEB_SCAN);
+		if (err)
+			goto out_finish;
+	}
+
+	err = -EINVAL;
+	for (i = 0; i < be32_to_cpu(fmh->scan_count); i++) {
+		__be32 *p = fm_record(&pos, end, sizeof(__be32));
+
+		if (!p)
+			goto out_finish;
+		err = mark_peb(ubi, seen, be32_to_cpu(*p), FM_PEB_SCAN);
+		if (err)
+			goto out_finish;
+	}
+
+	err = add_ec_records(ubi, si, seen, &pos, end,
+			     be32_to_cpu(fmh->free_count), &si->free);
+	if (err)
+		goto out_finish;
+
+	err = add_ec_records(ubi, si, seen, &pos, end,
+			     be32_to_cpu(fmh->erase_count), &si->erase);
+	if (err)
+		goto out_finish;
+
+	for (i = 0; i < be32_to_cpu(fmh->vol_count); i++) {
+		err = add_volume_records(ubi, si, seen, &pos, end, fmh->sqnum);
+		if (err)
+			goto out_finish;
+	}
+
+	if (pos != end) {
+		err = -EINVAL;
+		goto out_finish;
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (seen[pnum] == FM_PEB_DESCRIBED)
+			continue;
+
+		cond_resched();
+		err = ubi_scan_peb(ubi, si, pnum);
+		if (err < 0)
+			goto out_finish;
+		*scanned += 1;
+	}
+
+	ubi_scan_finish(ubi, si);
+	si->is_empty = 0;
+	if (si->max_sqnum < be64_to_cpu(fmh->sqnum))
+		si->max_sqnum = be64_to_cpu(fmh->sqnum);
+
+	/*
+	 * Only the eraseblocks of this fastmap are kept in the @si->fm list,
+	 * leftovers of older fastmaps are erased.
+	 */
+	list_for_each_entry_safe(seb, tmp, &si->fm, u.list) {
+		if (seb->lnum < fm_peb_count &&
+		    seb->pnum == be32_to_cpu(fmh->fm_pebs[seb->lnum]))
+			found += 1;
+		else
+			list_move_tail(&seb->u.list, &si->erase);
+	}
+
+	if (found != fm_peb_count) {
+		ubi_warn("%d of %d fastmap PEBs are missing",
+			 fm_peb_count - found, fm_peb_count);
+		err = -EINVAL;
+		goto out_si;
+	}
+
+	/* Free eraseblocks which were scanned become the pool */
+	ubi->fm_pool_count = 0;
+	list_for_each_entry(seb, &si->free, u.list) {
+		if (ubi->fm_pool_count == ubi->fm_pool_size)
+			break;
+		if (seen[seb->pnum] != FM_PEB_DESCRIBED)
+			ubi->fm_pool[ubi->fm_pool_count++] = seb->pnum;
+	}
+
+	kfree(seen);
+	return si;
+
+out_finish:
+	ubi_scan_finish(ubi, si);
+out_si:
+	ubi_scan_destroy_si(si);
+	kfree(seen);
+	return ERR_PTR(err);
+}
+
+/**
+ * ubi_scan_fastmap - attach an UBI device using the fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function looks for the fastmap and builds the scanning information
+ * from it. Returns the scanning information in case of success and %NULL if
+ * there is no usable fastmap, in which case the device has to be scanned.
+ */
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi)
+{
+	int i, err, anchor, stale_cnt, bitflips = 0, scanned = 0;
+	int stale[UBI_FM_MAX_START];
+	struct ubi_scan_info *si = NULL;
+	struct ubi_vid_hdr *vh;
+	struct ubi_fm_hdr *fmh;
+
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vh)
+		return NULL;
+
+	anchor = find_anchor(ubi, vh, stale, &stale_cnt);
+	if (anchor < 0) {
+		if (anchor != -ENOENT)
+			ubi_warn("error %d while looking for fastmap", anchor);
+		else
+			dbg_bld("no fastmap found");
+		goto out_vh;
+	}
+
+	fmh = read_fastmap(ubi, anchor, vh, &bitflips);
+	if (!fmh || IS_ERR(fmh))
+		goto out_vh;
+
+	/*
+	 * Stale anchors have to go before anything else, otherwise they would
+	 * be picked up if the current fastmap is invalidated.
+	 */
+	for (i = 0; i < stale_cnt; i++) {
+		dbg_bld("erase stale fastmap anchor at PEB %d", stale[i]);
+		err = ubi_io_sync_erase(ubi, stale[i], 0);
+		if (err < 0)
+			goto out_fmh;
+	}
+
+	ubi->fm_pool_size = fm_pool_size(ubi);
+	ubi->fm_pool = kmalloc(ubi->fm_pool_size * sizeof(int), GFP_KERNEL);
+	ubi->fm_checkmap = kzalloc(BITS_TO_LONGS(ubi->peb_count) *
+				   sizeof(unsigned long), GFP_KERNEL);
+	if (!ubi->fm_pool || !ubi->fm_checkmap)
+		goto out_fm;
+
+	si = process_fastmap(ubi, fmh, &scanned);
+	if (IS_ERR(si)) {
+		ubi_warn("cannot attach by fastmap, error %d", (int)PTR_ERR(si));
+		si = NULL;
+		goto out_fm;
+	}
+
+	ubi->fm_attached = 1;
+	if (bitflips)
+		ubi->fm_update = 1;
+	ubi_msg("attached by fastmap, %d of %d PEBs scanned",
+		scanned, ubi->peb_count);
+	goto out_fmh;
+
+out_fm:
+	ubi_fastmap_close(ubi);
+out_fmh:
+	vfree(fmh);
+out_vh:
+	ubi_free_vid_hdr(ubi, vh);
+	return si;
+}
+
+/**
+ * invalidate_fastmap - invalidate the fastmap on the media.
+ * @ubi: UBI device description object
+ *
+ * This function erases the fastmap anchor, so the device will be scanned when
+ * it is attached next time. Has to be called with @ubi->fm_mutex held.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int invalidate_fastmap(struct ubi_device *ubi)
+{
+	int err;
+
+	if (!ubi->fm_valid)
+		return 0;
+
+	dbg_msg("invalidate fastmap, anchor PEB %d", ubi->fm_wl[0]->pnum);
+	err = ubi_wl_erase_fm_peb(ubi, ubi->fm_wl[0]);
+	if (err) {
+		ubi_err("cannot invalidate fastmap, error %d", err);
+		ubi_ro_mode(ubi);
+		return err;
+	}
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_valid = 0;
+	ubi->fm_pool_count = 0;
+	spin_unlock(&ubi->wl_lock);
+	return 0;
+}
+
+/**
+ * ubi_fastmap_invalidate - invalidate the fastmap and schedule a new one.
+ * @ubi: UBI device description object
+ *
+ * This function is called when the fastmap cannot describe the device any
+ * longer. Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubi_fastmap_invalidate(struct ubi_device *ubi)
+{
+	int err;
+
+	if (ubi->fm_disabled)
+		return 0;
+
+	mutex_lock(&ubi->fm_mutex);
+	err = invalidate_fastmap(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+	if (!err)
+		ubi_wl_schedule_fm_update(ubi);
+	return err;
+}
+
+/**
+ * put_new_pebs - return physical eraseblocks of a fastmap which was not
+ * written.
+ * @ubi: UBI device description object
+ * @new_wl: the eraseblocks
+ * @count: number of eraseblocks
+ * @bad: the eraseblock which caused the failure (tortured), or %-1
+ */
+static void put_new_pebs(struct ubi_device *ubi, struct ubi_wl_entry **new_wl,
+			 int count, int bad)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (ubi_wl_put_fm_peb(ubi, new_wl[i], i == bad))
+			ubi_ro_mode(ubi);
+}
+
+/**
+ * write_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * The caller has to make sure the EBA and WL units do not change anything
+ * (see 'ubi_update_fastmap()'). Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+static int write_fastmap(struct ubi_device *ubi)
+{
+	int i, err, pnum, idx, lnum, size, offs, len, fm_pebs, pool_count;
+	int scan_count = 0, free_count = 0, erase_count = 0, vol_count = 0;
+	struct ubi_wl_entry *new_wl[UBI_FM_MAX_BLOCKS];
+	struct ubi_fm_hdr *fmh;
+	struct ubi_vid_hdr *vh;
+	int *ec, *pool;
+	void *buf, *pos;
+	u8 *state;
+
+	err = -ENOMEM;
+	state = vmalloc(ubi->peb_count);
+	ec = vmalloc(ubi->peb_count * sizeof(int));
+	pool = kmalloc(ubi->fm_pool_size * sizeof(int), GFP_KERNEL);
+	buf = vmalloc(ubi->fm_reserved * ubi->leb_size);
+	vh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!state || !ec || !pool || !buf || !vh)
+		goto out_free;
+	memset(buf, 0, ubi->fm_reserved * ubi->leb_size);
+
+	ubi_wl_fm_peb_states(ubi, state, ec);
+
+	/* Estimate the size to find out how many eraseblocks are needed */
+	size = sizeof(struct ubi_fm_hdr) +
+	       (ubi->vtbl_slots + UBI_INT_VOL_COUNT) *
+	       sizeof(struct ubi_fm_volume);
+	for (pnum = 0; pnum < ubi->peb_count; pnum++)
+		if (state[pnum] == UBI_FM_PEB_FREE ||
+		    state[pnum] == UBI_FM_PEB_ERASE ||
+		    state[pnum] == UBI_FM_PEB_FM)
+			size += sizeof(struct ubi_fm_ec);
+		else
+			size += sizeof(struct ubi_fm_leb);
+	fm_pebs = DIV_ROUND_UP(size, ubi->leb_size);
+	ubi_assert(fm_pebs <= ubi->fm_reserved);
+
+	/*
+	 * Eraseblocks which the current fastmap treats as free must not be
+	 * touched while it is valid, except the anchor which is written last.
+	 */
+	if (ubi->fm_valid && ubi->fm_pool_count < fm_pebs - 1) {
+		err = invalidate_fastmap(ubi);
+		if (err)
+			goto out_free;
+	}
+
+	for (i = 0; i < fm_pebs; i++) {
+		new_wl[i] = ubi_wl_get_fm_peb(ubi, i == 0);
+		if (!new_wl[i]) {
+			ubi_warn("no free PEBs for the fastmap");
+			put_new_pebs(ubi, new_wl, i, -1);
+			err = -ENOSPC;
+			goto out_free;
+		}
+		state[new_wl[i]->pnum] = UBI_FM_PEB_NEW;
+	}
+
+	pool_count = ubi_wl_fm_pool(ubi, pool, ubi->fm_pool_size);
+	for (i = 0; i < pool_count; i++)
+		state[pool[i]] = UBI_FM_PEB_POOL;
+
+	/* Find out which used eraseblocks are described by volume records */
+	for (idx = 0; idx < ubi->vtbl_slots + UBI_INT_VOL_COUNT; idx++) {
+		struct ubi_volume *vol = ubi->volumes[idx];
+
+		if (!vol)
+			continue;
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0)
+				continue;
+			if (state[pnum] == UBI_FM_PEB_USED)
+				state[pnum] = UBI_FM_PEB_MAPPED;
+			else if (state[pnum] == UBI_FM_PEB_SCRUB)
+				state[pnum] = UBI_FM_PEB_MAPPED_SCRUB;
+		}
+	}
+
+	fmh = buf;
+	pos = fmh + 1;
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (state[pnum] == UBI_FM_PEB_UNKNOWN ||
+		    state[pnum] == UBI_FM_PEB_USED ||
+		    state[pnum] == UBI_FM_PEB_SCRUB ||
+		    state[pnum] == UBI_FM_PEB_POOL) {
+			*(__be32 *)pos = cpu_to_be32(pnum);
+			pos += sizeof(__be32);
+			scan_count += 1;
+		}
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (state[pnum] == UBI_FM_PEB_FREE) {
+			struct ubi_fm_ec *fme = pos;
+
+			fme->pnum = cpu_to_be32(pnum);
+			fme->ec = cpu_to_be32(ec[pnum]);
+			pos += sizeof(struct ubi_fm_ec);
+			free_count += 1;
+		}
+	}
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
+		if (state[pnum] == UBI_FM_PEB_ERASE ||
+		    state[pnum] == UBI_FM_PEB_FM) {
+			struct ubi_fm_ec *fme = pos;
+
+			fme->pnum = cpu_to_be32(pnum);
+			fme->ec = cpu_to_be32(ec[pnum]);
+			pos += sizeof(struct ubi_fm_ec);
+			erase_count += 1;
+		}
+	}
+
+	for (idx = 0; idx < ubi->vtbl_slots + UBI_INT_VOL_COUNT; idx++) {
+		struct ubi_volume *vol = ubi->volumes[idx];
+		struct ubi_fm_volume *fmv;
+		int leb_count = 0;
+
+		if (!vol)
+			continue;
+
+		fmv = pos;
+		pos += sizeof(struct ubi_fm_volume);
+		fmv->vol_id = cpu_to_be32(vol->vol_id);
+		fmv->used_ebs = cpu_to_be32(vol->used_ebs);
+		fmv->last_eb_bytes = cpu_to_be32(vol->last_eb_bytes);
+		fmv->data_pad = cpu_to_be32(vol->data_pad);
+		if (vol->vol_type == UBI_DYNAMIC_VOLUME)
+			fmv->vol_type = UBI_VID_DYNAMIC;
+		else
+			fmv->vol_type = UBI_VID_STATIC;
+		if (vol->vol_id == UBI_LAYOUT_VOLUME_ID)
+			fmv->compat = UBI_LAYOUT_VOLUME_COMPAT;
+
+		for (lnum = 0; lnum < vol->reserved_pebs; lnum++) {
+			struct ubi_fm_leb *fml;
+
+			pnum = vol->eba_tbl[lnum];
+			if (pnum < 0 || (state[pnum] != UBI_FM_PEB_MAPPED &&
+					 state[pnum] != UBI_FM_PEB_MAPPED_SCRUB))
+				continue;
+
+			fml = pos;
+			fml->pnum = cpu_to_be32(pnum);
+			fml->lnum = cpu_to_be32(lnum);
+			fml->ec = cpu_to_be32(ec[pnum]);
+			fml->scrub = state[pnum] == UBI_FM_PEB_MAPPED_SCRUB;
+			pos += sizeof(struct ubi_fm_leb);
+			leb_count += 1;
+		}
+
+		fmv->leb_count = cpu_to_be32(leb_count);
+		vol_count += 1;
+	}
+
+	size = pos - buf;
+	ubi_assert(size <= fm_pebs * ubi->leb_size);
+
+	fmh->magic = cpu_to_be32(UBI_FM_HDR_MAGIC);
+	fmh->version = UBI_FM_FMT_VERSION;
+	fmh->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+	fmh->peb_count = cpu_to_be32(ubi->peb_count);
+	fmh->data_size = cpu_to_be32(size - sizeof(struct ubi_fm_hdr));
+	fmh->data_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fmh + 1,
+					  size - sizeof(struct ubi_fm_hdr)));
+	fmh->fm_peb_count = cpu_to_be32(fm_pebs);
+	for (i = 0; i < fm_pebs; i++)
+		fmh->fm_pebs[i] = cpu_to_be32(new_wl[i]->pnum);
+	fmh->scan_count = cpu_to_be32(scan_count);
+	fmh->free_count = cpu_to_be32(free_count);
+	fmh->erase_count = cpu_to_be32(erase_count);
+	fmh->vol_count = cpu_to_be32(vol_count);
+	fmh->hdr_crc = cpu_to_be32(crc32(UBI_CRC32_INIT, fmh,
+					 UBI_FM_HDR_SIZE_CRC));
+
+	vh->vol_type = UBI_FM_VOLUME_TYPE;
+	vh->vol_id = cpu_to_be32(UBI_FM_VOLUME_ID);
+	vh->compat = UBI_FM_VOLUME_COMPAT;
+
+	/* The anchor goes last, it makes the new fastmap valid */
+	for (i = fm_pebs - 1; i >= 0; i--) {
+		pnum = new_wl[i]->pnum;
+		vh->lnum = cpu_to_be32(i);
+		vh->sqnum = cpu_to_be64(ubi_next_sqnum(ubi));
+
+		err = ubi_io_write_vid_hdr(ubi, pnum, vh);
+		if (err)
+			goto out_put;
+
+		offs = i * ubi->leb_size;
+		len = min_t(int, ubi->leb_size, size - offs);
+		if (len <= 0)
+			continue;
+
+		err = ubi_io_write_data(ubi, buf + offs, pnum, 0,
+					ALIGN(len, ubi->min_io_size));
+		if (err)
+			goto out_put;
+	}
+
+	/* The old anchor has to go first, then the rest of the old fastmap */
+	if (ubi->fm_valid) {
+		err = ubi_wl_erase_fm_peb(ubi, ubi->fm_wl[0]);
+		if (err) {
+			ubi_err("cannot erase old fastmap anchor, error %d",
+				err);
+			ubi_ro_mode(ubi);
+		}
+	}
+
+	spin_lock(&ubi->wl_lock);
+	memcpy(ubi->fm_pool, pool, pool_count * sizeof(int));
+	ubi->fm_pool_count = pool_count;
+	ubi->fm_valid = 1;
+	spin_unlock(&ubi->wl_lock);
+
+	for (i = 0; i < ubi->fm_peb_count; i++)
+		if (ubi_wl_put_fm_peb(ubi, ubi->fm_wl[i], 0))
+			ubi_ro_mode(ubi);
+	for (i = 0; i < fm_pebs; i++)
+		ubi->fm_wl[i] = new_wl[i];
+	ubi->fm_peb_count = fm_pebs;
+
+	dbg_msg("fastmap written: anchor PEB %d, %d PEBs, %d bytes",
+		new_wl[0]->pnum, fm_pebs, size);
+	err = 0;
+	goto out_free;
+
+out_put:
+	ubi_err("error %d while writing fastmap to PEB %d", err, pnum);
+	if (i == 0) {
+		/* The new anchor may look valid and the old one is outdated */
+		if (invalidate_fastmap(ubi))
+			ubi_ro_mode(ubi);
+	}
+	put_new_pebs(ubi, new_wl, fm_pebs, i);
+out_free:
+	ubi_free_vid_hdr(ubi, vh);
+	vfree(buf);
+	kfree(pool);
+	vfree(ec);
+	vfree(state);
+	return err;
+}
+
+/**
+ * ubi_update_fastmap - write a new fastmap.
+ * @ubi: UBI device description object
+ *
+ * This function stops all EBA and WL activity on the device and writes the
+ * fastmap describing its current state. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_update_fastmap(struct ubi_device *ubi)
+{
+	int err;
+
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_update = 0;
+	spin_unlock(&ubi->wl_lock);
+
+	if (ubi->ro_mode || ubi->fm_disabled)
+		return 0;
+
+	/*
+	 * Volume changes are excluded by @ubi->volumes_mutex, EBA changes by
+	 * @ubi->fm_sem, and the WL unit by @ubi->work_sem.
+	 */
+	mutex_lock(&ubi->volumes_mutex);
+	down_write(&ubi->fm_sem);
+	down_write(&ubi->work_sem);
+	mutex_lock(&ubi->fm_mutex);
+	err = write_fastmap(ubi);
+	mutex_unlock(&ubi->fm_mutex);
+	up_write(&ubi->work_sem);
+	up_write(&ubi->fm_sem);
+	mutex_unlock(&ubi->volumes_mutex);
+
+	return err;
+}
+
+/**
+ * ubi_fastmap_init - initialize the fastmap unit.
+ * @ubi: UBI device description object
+ *
+ * This function reserves physical eraseblocks for the fastmap and decides if
+ * the fastmap the device was attached by is still usable. If there is not
+ * enough space for the fastmap, it is disabled. Returns zero in case of
+ * success and a negative error code in case of failure.
+ */
+int ubi_fastmap_init(struct ubi_device *ubi)
+{
+	int i, ok = 0;
+
+	ubi->fm_pool_size = fm_pool_size(ubi);
+	if (!ubi->fm_pool) {
+		ubi->fm_pool = kmalloc(ubi->fm_pool_size * sizeof(int),
+				       GFP_KERNEL);
+		if (!ubi->fm_pool)
+			return -ENOMEM;
+	}
+
+	ubi->fm_reserved = DIV_ROUND_UP(fm_size(ubi), ubi->leb_size);
+
+	/* The old and the new fastmap co-exist while the new one is written */
+	spin_lock(&ubi->volumes_lock);
+	if (ubi->fm_reserved <= UBI_FM_MAX_BLOCKS &&
+	    ubi->avail_pebs >= 2 * ubi->fm_reserved) {
+		ubi->avail_pebs -= 2 * ubi->fm_reserved;
+		ubi->rsvd_pebs += 2 * ubi->fm_reserved;
+		ok = 1;
+	}
+	spin_unlock(&ubi->volumes_lock);
+
+	ubi->fm_valid = ubi->fm_attached;
+	if (!ok) {
+		ubi_warn("no room for fastmap (%d PEBs needed), disable it",
+			 2 * ubi->fm_reserved);
+		mutex_lock(&ubi->fm_mutex);
+		i = invalidate_fastmap(ubi);
+		mutex_unlock(&ubi->fm_mutex);
+		if (i)
+			return i;
+		ubi->fm_disabled = 1;
+		ubi->fm_pool_count = 0;
+		for (i = 0; i < ubi->fm_peb_count; i++)
+			if (ubi_wl_put_fm_peb(ubi, ubi->fm_wl[i], 0))
+				return -ENOMEM;
+		ubi->fm_peb_count = 0;
+		return 0;
+	}
+
+	if (!ubi->fm_valid)
+		ubi->fm_update = 1;
+	return 0;
+}
+
+/**
+ * ubi_fastmap_close - close the fastmap unit.
+ * @ubi: UBI device description object
+ *
+ * Note, wear-leveling entries of the fastmap eraseblocks are freed by the WL
+ * unit.
+ */
+void ubi_fastmap_close(struct ubi_device *ubi)
+{
+	kfree(ubi->fm_pool);
+	kfree(ubi->fm_checkmap);
+	ubi->fm_pool = NULL;
+	ubi->fm_checkmap = NULL;
+	ubi->fm_pool_count = 0;
+	ubi->fm_attached = 0;
+}
@@ -629,6 +629,6 @@ int ubi_is_mapped(struct ubi_volume_desc *desc, int lnum)
 	if (vol->upd_marker)
 		return -EBADF;
 
-	return vol->eba_tbl[lnum] >= 0;
+	return ubi_eba_is_mapped(vol->ubi, vol, lnum);
 }
 EXPORT_SYMBOL_GPL(ubi_is_mapped);
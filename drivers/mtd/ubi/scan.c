@@ -37,11 +37,27 @@
  *
  * Corrupted physical eraseblocks are put to the @corr list, free physical
  * eraseblocks are put to the @free list and the physical eraseblock to be
- * erased are put to the @erase list.
+ * erased are put to the @erase list. Physical eraseblocks of the fastmap
+ * volume are put to the @fm list.
+ *
+ * Normally all physical eraseblocks are scanned by 'ubi_scan()'. The fastmap
+ * unit builds the scanning information from the on-flash fastmap instead and
+ * uses 'ubi_scan_start()', 'ubi_scan_peb()' and 'ubi_scan_finish()' to scan
+ * only those physical eraseblocks which could have been changed since the
+ * fastmap was written.
+ *
+ * When the whole device is scanned, the UBI headers are read by a few kernel
+ * threads in batches of %SCAN_BATCH physical eraseblocks, while the headers of
+ * the previous batches are processed and added to the scanning information by
+ * the attaching task. This way checking the headers and comparing logical
+ * eraseblocks overlaps with flash I/O. The batches are processed strictly in
+ * physical eraseblock order, so the result is exactly the same as in case of
+ * sequential scanning.
  */
 
 #include <linux/err.h>
 #include <linux/crc32.h>
+#include <linux/kthread.h>
 #include <asm/div64.h>
 #include "ubi.h"
 
@@ -55,19 +71,91 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si);
 static struct ubi_ec_hdr *ech;
 static struct ubi_vid_hdr *vidh;
 
+/* Number of header reading threads used by 'ubi_scan()' */
+#define SCAN_THREADS 2
+
+/* How many physical eraseblocks are read by a thread in one go */
+#define SCAN_BATCH 32
+
+/* How many batches may be read ahead of the one being processed */
+#define SCAN_SLOTS (SCAN_THREADS + 2)
+
+/**
+ * struct scan_peb - UBI headers of a physical eraseblock.
+ * @pnum: physical eraseblock number
+ * @bad: what 'ubi_io_is_bad()' returned
+ * @ec_err: what 'ubi_io_read_ec_hdr()' returned
+ * @vid_err: what 'ubi_io_read_vid_hdr()' returned
+ * @ech: the EC header
+ * @vidh: the VID header
+ *
+ * The headers are only valid if the corresponding read functions succeeded.
+ */
+struct scan_peb {
+	int pnum;
+	int bad;
+	int ec_err;
+	int vid_err;
+	struct ubi_ec_hdr ech;
+	struct ubi_vid_hdr vidh;
+};
+
+/* States of a batch slot */
+enum {
+	SLOT_FREE,
+	SLOT_READING,
+	SLOT_READY,
+};
+
+/**
+ * struct scan_slot - a batch of physical eraseblocks being scanned.
+ * @state: %SLOT_FREE, %SLOT_READING or %SLOT_READY
+ * @first: first physical eraseblock of the batch
+ * @count: number of physical eraseblocks in the batch
+ * @pebs: headers of the physical eraseblocks
+ */
+struct scan_slot {
+	int state;
+	int first;
+	int count;
+	struct scan_peb pebs[SCAN_BATCH];
+};
+
+/**
+ * struct scan_ctx - parallel scanning context.
+ * @ubi: UBI device description object
+ * @lock: protects @next, @stop and the slot states
+ * @wait: the threads and the attaching task wait for slot state changes here
+ * @next: first physical eraseblock of the next batch to read
+ * @stop: set when the threads have to exit
+ * @running: number of running threads
+ * @exited: signaled when the last thread exits
+ * @slots: the batch slots
+ */
+struct scan_ctx {
+	struct ubi_device *ubi;
+	spinlock_t lock;
+	wait_queue_head_t wait;
+	int next;
+	int stop;
+	int running;
+	struct completion exited;
+	struct scan_slot slots[SCAN_SLOTS];
+};
+
 /**
- * add_to_list - add physical eraseblock to a list.
+ * ubi_scan_add_to_list - add physical eraseblock to a list.
  * @si: scanning information
  * @pnum: physical eraseblock number to add
  * @ec: erase counter of the physical eraseblock
  * @list: the list to add to
  *
- * This function adds physical eraseblock @pnum to free, erase, corrupted or
- * alien lists. Returns zero in case of success and a negative error code in
- * case of failure.
+ * This function adds physical eraseblock @pnum to free, erase, corrupted,
+ * alien or fastmap lists. Returns zero in case of success and a negative error
+ * code in case of failure.
  */
-static int add_to_list(struct ubi_scan_info *si, int pnum, int ec,
-		       struct list_head *list)
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list)
 {
 	struct ubi_scan_leb *seb;
 
@@ -79,6 +167,8 @@ static int add_to_list(struct ubi_scan_info *si, int pnum, int ec,
 		dbg_bld("add to corrupted: PEB %d, EC %d", pnum, ec);
 	else if (list == &si->alien)
 		dbg_bld("add to alien: PEB %d, EC %d", pnum, ec);
+	else if (list == &si->fm)
+		dbg_bld("add to fastmap: PEB %d, EC %d", pnum, ec);
 	else
 		BUG();
 
@@ -491,11 +581,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 				return err;
 
 			if (cmp_res & 4)
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->corr);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->corr);
 			else
-				err = add_to_list(si, seb->pnum, seb->ec,
-						  &si->erase);
+				err = ubi_scan_add_to_list(si, seb->pnum,
+							   seb->ec, &si->erase);
 			if (err)
 				return err;
 
@@ -516,9 +606,11 @@ int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 			 * previously.
 			 */
 			if (cmp_res & 4)
-				return add_to_list(si, pnum, ec, &si->corr);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->corr);
 			else
-				return add_to_list(si, pnum, ec, &si->erase);
+				return ubi_scan_add_to_list(si, pnum, ec,
+							    &si->erase);
 		}
 	}
 
@@ -742,24 +834,60 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 }
 
 /**
- * process_eb - read UBI headers, check them and add corresponding data
- * to the scanning information.
+ * read_headers - read UBI headers of a physical eraseblock.
  * @ubi: UBI device description object
- * @si: scanning information
  * @pnum: the physical eraseblock number
+ * @ec_buf: buffer of @ubi->ec_hdr_alsize bytes to read the EC header to
+ * @vid_buf: VID header buffer allocated by 'ubi_zalloc_vid_hdr()'
+ * @sp: where to store the results
+ *
+ * This function does all the I/O and header checking needed to scan a
+ * physical eraseblock, and may be called from several threads at a time. The
+ * results are then handled by 'process_eb()'.
+ */
+static void read_headers(struct ubi_device *ubi, int pnum,
+			 struct ubi_ec_hdr *ec_buf, struct ubi_vid_hdr *vid_buf,
+			 struct scan_peb *sp)
+{
+	sp->pnum = pnum;
+	sp->ec_err = sp->vid_err = 0;
+
+	sp->bad = ubi_io_is_bad(ubi, pnum);
+	if (sp->bad)
+		return;
+
+	sp->ec_err = ubi_io_read_ec_hdr(ubi, pnum, ec_buf, 0);
+	if (sp->ec_err < 0 || sp->ec_err == UBI_IO_PEB_EMPTY)
+		return;
+	memcpy(&sp->ech, ec_buf, sizeof(struct ubi_ec_hdr));
+
+	sp->vid_err = ubi_io_read_vid_hdr(ubi, pnum, vid_buf, 0);
+	if (sp->vid_err >= 0)
+		memcpy(&sp->vidh, vid_buf, sizeof(struct ubi_vid_hdr));
+}
+
+/**
+ * process_eb - check UBI headers and add corresponding data to the scanning
+ * information.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @sp: the headers read by 'read_headers()'
  *
  * This function returns a zero if the physical eraseblock was successfully
  * handled and a negative error code in case of failure.
  */
-static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum)
+static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si,
+		      struct scan_peb *sp)
 {
 	long long uninitialized_var(ec);
-	int err, bitflips = 0, vol_id, ec_corr = 0;
+	int err, bitflips = 0, vol_id, ec_corr = 0, pnum = sp->pnum;
+	struct ubi_ec_hdr *ech = &sp->ech;
+	struct ubi_vid_hdr *vidh = &sp->vidh;
 
 	dbg_bld("scan PEB %d", pnum);
 
 	/* Skip bad physical eraseblocks */
-	err = ubi_io_is_bad(ubi, pnum);
+	err = sp->bad;
 	if (err < 0)
 		return err;
 	else if (err) {
@@ -771,13 +899,14 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 		return 0;
 	}
 
-	err = ubi_io_read_ec_hdr(ubi, pnum, ech, 0);
+	err = sp->ec_err;
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
 		bitflips = 1;
 	else if (err == UBI_IO_PEB_EMPTY)
-		return add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC, &si->erase);
+		return ubi_scan_add_to_list(si, pnum, UBI_SCAN_UNKNOWN_EC,
+					    &si->erase);
 	else if (err == UBI_IO_BAD_EC_HDR) {
 		/*
 		 * We have to also look at the VID header, possibly it is not
@@ -817,7 +946,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 
 	/* OK, we've done with the EC header, let's look at the VID header */
 
-	err = ubi_io_read_vid_hdr(ubi, pnum, vidh, 0);
+	err = sp->vid_err;
 	if (err < 0)
 		return err;
 	else if (err == UBI_IO_BITFLIPS)
@@ -825,19 +954,38 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 	else if (err == UBI_IO_BAD_VID_HDR ||
 		 (err == UBI_IO_PEB_FREE && ec_corr)) {
 		/* VID header is corrupted */
-		err = add_to_list(si, pnum, ec, &si->corr);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	} else if (err == UBI_IO_PEB_FREE) {
 		/* No VID header - the physical eraseblock is free */
-		err = add_to_list(si, pnum, ec, &si->free);
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->free);
 		if (err)
 			return err;
 		goto adjust_mean_ec;
 	}
 
 	vol_id = be32_to_cpu(vidh->vol_id);
+	if (vol_id == UBI_FM_VOLUME_ID) {
+		struct ubi_scan_leb *seb;
+
+		/*
+		 * Fastmap physical eraseblocks are sorted out by the fastmap
+		 * unit, or just erased if the device is attached by scanning.
+		 */
+		err = ubi_scan_add_to_list(si, pnum, ec, &si->fm);
+		if (err)
+			return err;
+
+		seb = list_entry(si->fm.prev, struct ubi_scan_leb, u.list);
+		seb->lnum = be32_to_cpu(vidh->lnum);
+		seb->sqnum = be64_to_cpu(vidh->sqnum);
+		if (si->max_sqnum < seb->sqnum)
+			si->max_sqnum = seb->sqnum;
+		goto adjust_mean_ec;
+	}
+
 	if (vol_id > UBI_MAX_VOLUMES && vol_id != UBI_LAYOUT_VOLUME_ID) {
 		int lnum = be32_to_cpu(vidh->lnum);
 
@@ -846,7 +994,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 		case UBI_COMPAT_DELETE:
 			ubi_msg("\"delete\" compatible internal volume %d:%d"
 				" found, remove it", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->corr);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->corr);
 			if (err)
 				return err;
 			break;
@@ -861,7 +1009,7 @@ static int process_eb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum
 		case UBI_COMPAT_PRESERVE:
 			ubi_msg("\"preserve\" compatible internal volume %d:%d"
 				" found", vol_id, lnum);
-			err = add_to_list(si, pnum, ec, &si->alien);
+			err = ubi_scan_add_to_list(si, pnum, ec, &si->alien);
 			if (err)
 				return err;
 			si->alien_peb_count += 1;
@@ -893,18 +1041,16 @@ adjust_mean_ec:
 }
 
 /**
- * ubi_scan - scan an MTD device.
+ * ubi_scan_start - prepare for scanning an MTD device.
  * @ubi: UBI device description object
  *
- * This function does full scanning of an MTD device and returns complete
- * information about it. In case of failure, an error code is returned.
+ * This function allocates the scanning information object and the buffers
+ * used for reading UBI headers. The physical eraseblocks are then scanned
+ * with 'ubi_scan_peb()', and the scanning is completed by
+ * 'ubi_scan_finish()'. In case of failure, an error code is returned.
  */
-struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+struct ubi_scan_info *ubi_scan_start(struct ubi_device *ubi)
 {
-	int err, pnum;
-	struct rb_node *rb1, *rb2;
-	struct ubi_scan_volume *sv;
-	struct ubi_scan_leb *seb;
 	struct ubi_scan_info *si;
 
 	si = kzalloc(sizeof(struct ubi_scan_info), GFP_KERNEL);
@@ -915,10 +1061,10 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	INIT_LIST_HEAD(&si->free);
 	INIT_LIST_HEAD(&si->erase);
 	INIT_LIST_HEAD(&si->alien);
+	INIT_LIST_HEAD(&si->fm);
 	si->volumes = RB_ROOT;
 	si->is_empty = 1;
 
-	err = -ENOMEM;
 	ech = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
 	if (!ech)
 		goto out_si;
@@ -927,16 +1073,274 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 	if (!vidh)
 		goto out_ech;
 
-	for (pnum = 0; pnum < ubi->peb_count; pnum++) {
-		cond_resched();
+	return si;
+
+out_ech:
+	kfree(ech);
+out_si:
+	ubi_scan_destroy_si(si);
+	return ERR_PTR(-ENOMEM);
+}
 
-		dbg_msg("process PEB %d", pnum);
-		err = process_eb(ubi, si, pnum);
-		if (err < 0)
-			goto out_vidh;
+/**
+ * ubi_scan_peb - scan a physical eraseblock.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ * @pnum: the physical eraseblock number
+ *
+ * This function reads UBI headers of physical eraseblock @pnum and adds it to
+ * the scanning information. Returns zero in case of success and a negative
+ * error code in case of failure.
+ */
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum)
+{
+	static struct scan_peb sp;
+
+	dbg_msg("process PEB %d", pnum);
+	read_headers(ubi, pnum, ech, vidh, &sp);
+	return process_eb(ubi, si, &sp);
+}
+
+/**
+ * claim_slot - find the next batch to read.
+ * @ctx: scanning context
+ *
+ * Returns the slot to read the next batch to, %NULL if there is no free slot
+ * yet, and an error pointer if there is nothing more to read.
+ */
+static struct scan_slot *claim_slot(struct scan_ctx *ctx)
+{
+	struct scan_slot *slot = NULL;
+
+	spin_lock(&ctx->lock);
+	if (ctx->stop || ctx->next >= ctx->ubi->peb_count) {
+		slot = ERR_PTR(-ENOENT);
+		goto out_unlock;
 	}
 
-	dbg_msg("scanning is finished");
+	slot = &ctx->slots[(ctx->next / SCAN_BATCH) % SCAN_SLOTS];
+	if (slot->state != SLOT_FREE) {
+		slot = NULL;
+		goto out_unlock;
+	}
+
+	slot->state = SLOT_READING;
+	slot->first = ctx->next;
+	slot->count = min_t(int, SCAN_BATCH, ctx->ubi->peb_count - ctx->next);
+	ctx->next += SCAN_BATCH;
+
+out_unlock:
+	spin_unlock(&ctx->lock);
+	return slot;
+}
+
+/**
+ * set_slot_state - change state of a slot and wake up the waiters.
+ * @ctx: scanning context
+ * @slot: the slot
+ * @state: the new state
+ */
+static void set_slot_state(struct scan_ctx *ctx, struct scan_slot *slot,
+			   int state)
+{
+	spin_lock(&ctx->lock);
+	slot->state = state;
+	spin_unlock(&ctx->lock);
+	wake_up_all(&ctx->wait);
+}
+
+/**
+ * slot_ready - check if a slot was read.
+ * @ctx: scanning context
+ * @slot: the slot
+ */
+static int slot_ready(struct scan_ctx *ctx, struct scan_slot *slot)
+{
+	int ready;
+
+	spin_lock(&ctx->lock);
+	ready = slot->state == SLOT_READY;
+	spin_unlock(&ctx->lock);
+	return ready;
+}
+
+/**
+ * threads_running - check if any reading thread is still running.
+ * @ctx: scanning context
+ */
+static int threads_running(struct scan_ctx *ctx)
+{
+	int running;
+
+	spin_lock(&ctx->lock);
+	running = ctx->running;
+	spin_unlock(&ctx->lock);
+	return running;
+}
+
+/**
+ * scan_thread - UBI headers reading thread.
+ * @u: the scanning context
+ *
+ * The thread reads batches of physical eraseblocks into free slots until
+ * there is nothing more to read or it is told to stop.
+ */
+static int scan_thread(void *u)
+{
+	int i;
+	struct scan_ctx *ctx = u;
+	struct ubi_device *ubi = ctx->ubi;
+	struct ubi_ec_hdr *ec_buf;
+	struct ubi_vid_hdr *vid_buf;
+	struct scan_slot *slot;
+
+	ec_buf = kzalloc(ubi->ec_hdr_alsize, GFP_KERNEL);
+	vid_buf = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!ec_buf || !vid_buf)
+		goto out;
+
+	while (1) {
+		wait_event(ctx->wait, (slot = claim_slot(ctx)) != NULL);
+		if (IS_ERR(slot))
+			break;
+
+		for (i = 0; i < slot->count; i++)
+			read_headers(ubi, slot->first + i, ec_buf, vid_buf,
+				     &slot->pebs[i]);
+		set_slot_state(ctx, slot, SLOT_READY);
+	}
+
+out:
+	ubi_free_vid_hdr(ubi, vid_buf);
+	kfree(ec_buf);
+
+	spin_lock(&ctx->lock);
+	ctx->running -= 1;
+	if (ctx->running == 0)
+		complete(&ctx->exited);
+	spin_unlock(&ctx->lock);
+	wake_up_all(&ctx->wait);
+	return 0;
+}
+
+/**
+ * scan_all - scan all physical eraseblocks.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function starts the header reading threads and processes the batches
+ * they read, in physical eraseblock order. If no thread can be started, or
+ * all of them exit early, the remaining batches are read by the calling task.
+ * Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+static int scan_all(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	int i, err = 0, pnum, threads;
+	struct scan_ctx *ctx;
+	struct scan_slot *slot;
+	struct task_struct *thread;
+
+	ctx = vmalloc(sizeof(struct scan_ctx));
+	if (!ctx)
+		return -ENOMEM;
+
+	memset(ctx, 0, sizeof(struct scan_ctx));
+	ctx->ubi = ubi;
+	spin_lock_init(&ctx->lock);
+	init_waitqueue_head(&ctx->wait);
+	init_completion(&ctx->exited);
+
+	/*
+	 * Hold a reference of our own while starting the threads, so that
+	 * @ctx->exited is not completed by a thread which exits before the
+	 * others are started.
+	 */
+	ctx->running = 1;
+	for (threads = 0; threads < SCAN_THREADS; threads++) {
+		spin_lock(&ctx->lock);
+		ctx->running += 1;
+		spin_unlock(&ctx->lock);
+
+		thread = kthread_run(scan_thread, ctx, "ubi_scan%d_%d",
+				     ubi->ubi_num, threads);
+		if (IS_ERR(thread)) {
+			ubi_warn("cannot start scanning thread, error %d",
+				 (int)PTR_ERR(thread));
+			spin_lock(&ctx->lock);
+			ctx->running -= 1;
+			spin_unlock(&ctx->lock);
+			break;
+		}
+	}
+	spin_lock(&ctx->lock);
+	ctx->running -= 1;
+	spin_unlock(&ctx->lock);
+	dbg_bld("scanning with %d threads", threads);
+
+	for (pnum = 0; pnum < ubi->peb_count; pnum += SCAN_BATCH) {
+		slot = &ctx->slots[(pnum / SCAN_BATCH) % SCAN_SLOTS];
+		if (threads)
+			wait_event(ctx->wait, slot_ready(ctx, slot) ||
+					      !threads_running(ctx));
+
+		if (!slot_ready(ctx, slot)) {
+			/*
+			 * No threads (left), read the batch ourselves. Threads
+			 * finish the batches they claim before exiting, so
+			 * this one has not been claimed yet.
+			 */
+			slot = claim_slot(ctx);
+			ubi_assert(slot && !IS_ERR(slot));
+			for (i = 0; i < slot->count; i++)
+				read_headers(ubi, slot->first + i, ech, vidh,
+					     &slot->pebs[i]);
+		}
+
+		for (i = 0; i < slot->count; i++) {
+			cond_resched();
+			err = process_eb(ubi, si, &slot->pebs[i]);
+			if (err < 0)
+				goto out_stop;
+		}
+
+		set_slot_state(ctx, slot, SLOT_FREE);
+	}
+
+out_stop:
+	spin_lock(&ctx->lock);
+	ctx->stop = 1;
+	threads = ctx->running;
+	spin_unlock(&ctx->lock);
+	wake_up_all(&ctx->wait);
+	if (threads)
+		wait_for_completion(&ctx->exited);
+
+	vfree(ctx);
+	return err;
+}
+
+/**
+ * ubi_scan_finish - finish scanning an MTD device.
+ * @ubi: UBI device description object
+ * @si: scanning information
+ *
+ * This function calculates the mean erase counter, assigns it to physical
+ * eraseblocks with unknown erase counter, and frees the buffers allocated by
+ * 'ubi_scan_start()'. It has to be called before @si is destroyed, even if
+ * scanning failed.
+ */
+void ubi_scan_finish(struct ubi_device *ubi, struct ubi_scan_info *si)
+{
+	struct rb_node *rb1, *rb2;
+	struct ubi_scan_volume *sv;
+	struct ubi_scan_leb *seb;
+
+	if (vidh)
+		ubi_free_vid_hdr(ubi, vidh);
+	kfree(ech);
+	vidh = NULL;
+	ech = NULL;
 
 	/* Calculate mean erase counter */
 	if (si->ec_count) {
@@ -970,22 +1374,48 @@ struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
 		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
 			seb->ec = si->mean_ec;
 
+	list_for_each_entry(seb, &si->fm, u.list)
+		if (seb->ec == UBI_SCAN_UNKNOWN_EC)
+			seb->ec = si->mean_ec;
+}
+
+/**
+ * ubi_scan - scan an MTD device.
+ * @ubi: UBI device description object
+ *
+ * This function does full scanning of an MTD device and returns complete
+ * information about it. In case of failure, an error code is returned.
+ */
+struct ubi_scan_info *ubi_scan(struct ubi_device *ubi)
+{
+	int err;
+	struct ubi_scan_info *si;
+
+	si = ubi_scan_start(ubi);
+	if (IS_ERR(si))
+		return si;
+
+	err = scan_all(ubi, si);
+	if (err < 0) {
+		ubi_scan_finish(ubi, si);
+		goto out_si;
+	}
+
+	dbg_msg("scanning is finished");
+	ubi_scan_finish(ubi, si);
+
+	/* The fastmap is not used, so its physical eraseblocks are erased */
+	list_splice_init(&si->fm, &si->erase);
+
 	err = paranoid_check_si(ubi, si);
 	if (err) {
 		if (err > 0)
 			err = -EINVAL;
-		goto out_vidh;
+		goto out_si;
 	}
 
-	ubi_free_vid_hdr(ubi, vidh);
-	kfree(ech);
-
 	return si;
 
-out_vidh:
-	ubi_free_vid_hdr(ubi, vidh);
-out_ech:
-	kfree(ech);
 out_si:
 	ubi_scan_destroy_si(si);
 	return ERR_PTR(err);
@@ -1050,6 +1480,10 @@ void ubi_scan_destroy_si(struct ubi_scan_info *si)
 		list_del(&seb->u.list);
 		kfree(seb);
 	}
+	list_for_each_entry_safe(seb, seb_tmp, &si->fm, u.list) {
+		list_del(&seb->u.list);
+		kfree(seb);
+	}
 
 	/* Destroy the volume RB-tree */
 	rb = si->volumes.rb_node;
@@ -1093,6 +1527,7 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 	struct rb_node *rb1, *rb2;
 	struct ubi_scan_volume *sv;
 	struct ubi_scan_leb *seb, *last_seb;
+	struct ubi_vid_hdr *vidh;
 	uint8_t *buf;
 
 	/*
@@ -1212,6 +1647,10 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 	}
 
 	/* Check that scanning information is correct */
+	vidh = ubi_zalloc_vid_hdr(ubi, GFP_KERNEL);
+	if (!vidh)
+		return -ENOMEM;
+
 	ubi_rb_for_each_entry(rb1, sv, &si->volumes, rb) {
 		last_seb = NULL;
 		ubi_rb_for_each_entry(rb2, seb, &sv->root, u.rb) {
@@ -1226,6 +1665,7 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 				ubi_err("VID header is not OK (%d)", err);
 				if (err > 0)
 					err = -EIO;
+				ubi_free_vid_hdr(ubi, vidh);
 				return err;
 			}
 
@@ -1286,6 +1726,8 @@ static int paranoid_check_si(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
+	ubi_free_vid_hdr(ubi, vidh);
+
 	/*
 	 * Make sure that all the physical eraseblocks are in one of the lists
 	 * or trees.
@@ -1347,6 +1789,7 @@ bad_vid_hdr:
 	ubi_err("bad scanning information about volume %d", sv->vol_id);
 	ubi_dbg_dump_sv(sv);
 	ubi_dbg_dump_vid_hdr(vidh);
+	ubi_free_vid_hdr(ubi, vidh);
 
 out:
 	ubi_dbg_dump_stack();
@@ -94,6 +94,8 @@ struct ubi_scan_volume {
  * @alien: list of physical eraseblocks which should not be used by UBI (e.g.,
  * @bad_peb_count: count of bad physical eraseblocks
  * those belonging to "preserve"-compatible internal volumes)
+ * @fm: list of physical eraseblocks belonging to the fastmap volume (their
+ * @lnum and @sqnum fields are valid)
  * @vols_found: number of volumes found during scanning
  * @highest_vol_id: highest volume ID
  * @alien_peb_count: count of physical eraseblocks in the @alien list
@@ -115,6 +117,7 @@ struct ubi_scan_info {
 	struct list_head free;
 	struct list_head erase;
 	struct list_head alien;
+	struct list_head fm;
 	int bad_peb_count;
 	int vols_found;
 	int highest_vol_id;
@@ -147,6 +150,8 @@ static inline void ubi_scan_move_to_list(struct ubi_scan_volume *sv,
 		list_add_tail(&seb->u.list, list);
 }
 
+int ubi_scan_add_to_list(struct ubi_scan_info *si, int pnum, int ec,
+			 struct list_head *list);
 int ubi_scan_add_used(struct ubi_device *ubi, struct ubi_scan_info *si,
 		      int pnum, int ec, const struct ubi_vid_hdr *vid_hdr,
 		      int bitflips);
@@ -159,6 +164,9 @@ struct ubi_scan_leb *ubi_scan_get_free_peb(struct ubi_device *ubi,
 					   struct ubi_scan_info *si);
 int ubi_scan_erase_peb(struct ubi_device *ubi, const struct ubi_scan_info *si,
 		       int pnum, int ec);
+struct ubi_scan_info *ubi_scan_start(struct ubi_device *ubi);
+int ubi_scan_peb(struct ubi_device *ubi, struct ubi_scan_info *si, int pnum);
+void ubi_scan_finish(struct ubi_device *ubi, struct ubi_scan_info *si);
 struct ubi_scan_info *ubi_scan(struct ubi_device *ubi);
 void ubi_scan_destroy_si(struct ubi_scan_info *si);
 
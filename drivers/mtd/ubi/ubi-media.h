@@ -369,4 +369,133 @@ struct ubi_vtbl_record {
 	__be32  crc;
 } __attribute__ ((packed));
 
+/*
+ * The fastmap volume contains a snapshot of the UBI device state which allows
+ * to attach the device without scanning all physical eraseblocks. It is a
+ * "delete"-compatible internal volume, so older UBI implementations just
+ * erase it and scan the device as usual.
+ */
+#define UBI_FM_VOLUME_ID     (UBI_INTERNAL_VOL_START + 1)
+#define UBI_FM_VOLUME_TYPE   UBI_VID_DYNAMIC
+#define UBI_FM_VOLUME_COMPAT UBI_COMPAT_DELETE
+
+/* Fastmap header magic number (ASCII "UBIF") */
+#define UBI_FM_HDR_MAGIC 0x55424946
+
+/* The version of the fastmap on-flash format */
+#define UBI_FM_FMT_VERSION 1
+
+/* The maximum number of physical eraseblocks a fastmap may occupy */
+#define UBI_FM_MAX_BLOCKS 32
+
+/*
+ * The fastmap anchor (logical eraseblock 0 of the fastmap volume) is always
+ * stored in one of the first %UBI_FM_MAX_START physical eraseblocks, so only
+ * those have to be looked at to find the fastmap.
+ */
+#define UBI_FM_MAX_START 64
+
+/**
+ * struct ubi_fm_hdr - fastmap header.
+ * @magic: fastmap header magic number (%UBI_FM_HDR_MAGIC)
+ * @version: version of the fastmap format (%UBI_FM_FMT_VERSION)
+ * @padding1: reserved for future, zeroes
+ * @sqnum: global sequence number at the time the fastmap was written
+ * @peb_count: count of physical eraseblocks on the device
+ * @data_size: how many bytes of records follow the header
+ * @data_crc: CRC checksum of the records
+ * @fm_peb_count: how many physical eraseblocks the fastmap occupies
+ * @fm_pebs: the physical eraseblocks the fastmap occupies, in LEB order
+ * @scan_count: count of records in the scan list
+ * @free_count: count of records in the free list
+ * @erase_count: count of records in the erase list
+ * @vol_count: count of volume records
+ * @padding2: reserved for future, zeroes
+ * @hdr_crc: fastmap header CRC checksum
+ *
+ * The fastmap is stored in the logical eraseblocks of the fastmap volume, one
+ * after another, starting from the header which is followed by the records:
+ *   o the scan list: @scan_count physical eraseblock numbers (__be32) which
+ *     may have been changed after the fastmap was written and have to be
+ *     scanned when the device is attached;
+ *   o the free list: @free_count &struct ubi_fm_ec records describing free
+ *     physical eraseblocks;
+ *   o the erase list: @erase_count &struct ubi_fm_ec records describing
+ *     physical eraseblocks which have to be erased;
+ *   o @vol_count volume records (&struct ubi_fm_volume), each followed by its
+ *     logical eraseblock records (&struct ubi_fm_leb).
+ *
+ * Every good physical eraseblock which is not described by the fastmap
+ * records and is not part of the fastmap itself is scanned as well.
+ */
+struct ubi_fm_hdr {
+	__be32  magic;
+	__u8    version;
+	__u8    padding1[3];
+	__be64  sqnum;
+	__be32  peb_count;
+	__be32  data_size;
+	__be32  data_crc;
+	__be32  fm_peb_count;
+	__be32  fm_pebs[UBI_FM_MAX_BLOCKS];
+	__be32  scan_count;
+	__be32  free_count;
+	__be32  erase_count;
+	__be32  vol_count;
+	__u8    padding2[76];
+	__be32  hdr_crc;
+} __attribute__ ((packed));
+
+/* Size of the fastmap header without the ending CRC */
+#define UBI_FM_HDR_SIZE_CRC (sizeof(struct ubi_fm_hdr) - sizeof(__be32))
+
+/**
+ * struct ubi_fm_ec - fastmap record of a free or to be erased PEB.
+ * @pnum: physical eraseblock number
+ * @ec: erase counter
+ */
+struct ubi_fm_ec {
+	__be32  pnum;
+	__be32  ec;
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_volume - fastmap record of a volume.
+ * @vol_id: volume ID
+ * @leb_count: how many &struct ubi_fm_leb records follow
+ * @used_ebs: number of used logical eraseblocks (static volumes only)
+ * @last_eb_bytes: bytes in the last used logical eraseblock (static volumes
+ * only)
+ * @data_pad: how many bytes are not used at the end of logical eraseblocks
+ * @vol_type: volume type (%UBI_VID_DYNAMIC or %UBI_VID_STATIC)
+ * @compat: compatibility flags of the volume
+ * @padding: reserved, zeroes
+ */
+struct ubi_fm_volume {
+	__be32  vol_id;
+	__be32  leb_count;
+	__be32  used_ebs;
+	__be32  last_eb_bytes;
+	__be32  data_pad;
+	__u8    vol_type;
+	__u8    compat;
+	__u8    padding[2];
+} __attribute__ ((packed));
+
+/**
+ * struct ubi_fm_leb - fastmap record of a mapped logical eraseblock.
+ * @pnum: physical eraseblock the logical eraseblock is mapped to
+ * @lnum: logical eraseblock number
+ * @ec: erase counter of the physical eraseblock
+ * @scrub: if the physical eraseblock needs scrubbing
+ * @padding: reserved, zeroes
+ */
+struct ubi_fm_leb {
+	__be32  pnum;
+	__be32  lnum;
+	__be32  ec;
+	__u8    scrub;
+	__u8    padding[3];
+} __attribute__ ((packed));
+
 #endif /* !__UBI_MEDIA_H__ */
@@ -306,6 +306,25 @@ struct ubi_wl_entry;
  * @thread_enabled: if the background thread is enabled
  * @bgt_name: background thread name
  *
+ * @fm_wl: wear-leveling entries of the physical eraseblocks holding the current
+ *         fastmap, @fm_wl[0] is the anchor
+ * @fm_peb_count: number of physical eraseblocks in @fm_wl
+ * @fm_reserved: maximum number of physical eraseblocks a fastmap may take
+ * @fm_valid: if the fastmap on the media describes the current state
+ * @fm_disabled: if the fastmap is not used for this device
+ * @fm_attached: if the device was attached using the fastmap
+ * @fm_update: if the fastmap has to be written by the background thread
+ * @fm_pool: physical eraseblocks which may be handed out while the fastmap is
+ *           valid (they are scanned when the device is attached)
+ * @fm_pool_count: count of physical eraseblocks left in @fm_pool
+ * @fm_pool_size: maximum size of @fm_pool
+ * @fm_checkmap: bitmap of physical eraseblocks whose mapping came from the
+ *               fastmap and has not been verified yet
+ * @fm_mutex: serializes fastmap writing and invalidation
+ * @fm_check_mutex: serializes verification of mappings from @fm_checkmap
+ * @fm_sem: taken for reading while the EBA table is being changed and for
+ *          writing while the fastmap is being written
+ *
  * @flash_size: underlying MTD device size (in bytes)
  * @peb_count: count of physical eraseblocks on the MTD device
  * @peb_size: physical eraseblock size
@@ -388,6 +407,22 @@ struct ubi_device {
 	int thread_enabled;
 	char bgt_name[sizeof(UBI_BGT_NAME_PATTERN)+2];
 
+	/* Fastmap unit's stuff */
+	struct ubi_wl_entry *fm_wl[UBI_FM_MAX_BLOCKS];
+	int fm_peb_count;
+	int fm_reserved;
+	int fm_valid;
+	int fm_disabled;
+	int fm_attached;
+	int fm_update;
+	int *fm_pool;
+	int fm_pool_count;
+	int fm_pool_size;
+	unsigned long *fm_checkmap;
+	struct mutex fm_mutex;
+	struct mutex fm_check_mutex;
+	struct rw_semaphore fm_sem;
+
 	/* I/O unit's stuff */
 	long long flash_size;
 	int peb_count;
@@ -417,6 +452,33 @@ struct ubi_device {
 #endif
 };
 
+/*
+ * Physical eraseblock states used when the fastmap is written.
+ *
+ * UBI_FM_PEB_UNKNOWN: the state is unknown, the eraseblock has to be scanned
+ * UBI_FM_PEB_FREE: the eraseblock is free
+ * UBI_FM_PEB_USED: the eraseblock is used
+ * UBI_FM_PEB_SCRUB: the eraseblock is used and has to be scrubbed
+ * UBI_FM_PEB_ERASE: the eraseblock is going to be erased
+ * UBI_FM_PEB_FM: the eraseblock belongs to the current fastmap
+ * UBI_FM_PEB_POOL: the eraseblock is free but belongs to the pool
+ * UBI_FM_PEB_NEW: the eraseblock will hold the new fastmap
+ * UBI_FM_PEB_MAPPED: the eraseblock is used and is described by a volume record
+ * UBI_FM_PEB_MAPPED_SCRUB: the same, but the eraseblock has to be scrubbed
+ */
+enum {
+	UBI_FM_PEB_UNKNOWN = 0,
+	UBI_FM_PEB_FREE,
+	UBI_FM_PEB_USED,
+	UBI_FM_PEB_SCRUB,
+	UBI_FM_PEB_ERASE,
+	UBI_FM_PEB_FM,
+	UBI_FM_PEB_POOL,
+	UBI_FM_PEB_NEW,
+	UBI_FM_PEB_MAPPED,
+	UBI_FM_PEB_MAPPED_SCRUB,
+};
+
 extern struct kmem_cache *ubi_wl_entry_slab;
 extern struct file_operations ubi_ctrl_cdev_operations;
 extern struct file_operations ubi_cdev_operations;
@@ -462,7 +524,34 @@ void ubi_gluebi_updated(struct ubi_volume *vol);
 #define ubi_gluebi_updated(vol)
 #endif
 
+/* fastmap.c */
+#ifdef CONFIG_MTD_UBI_FASTMAP
+struct ubi_scan_info *ubi_scan_fastmap(struct ubi_device *ubi);
+int ubi_fastmap_init(struct ubi_device *ubi);
+void ubi_fastmap_close(struct ubi_device *ubi);
+int ubi_update_fastmap(struct ubi_device *ubi);
+int ubi_fastmap_invalidate(struct ubi_device *ubi);
+#define ubi_fm_down_read(ubi) down_read(&(ubi)->fm_sem)
+#define ubi_fm_down_read_trylock(ubi) down_read_trylock(&(ubi)->fm_sem)
+#define ubi_fm_up_read(ubi) up_read(&(ubi)->fm_sem)
+#define ubi_fm_unverified(ubi, pnum) \
+	((ubi)->fm_checkmap && (pnum) >= 0 && test_bit(pnum, (ubi)->fm_checkmap))
+#else
+#define ubi_scan_fastmap(ubi) NULL
+#define ubi_fastmap_init(ubi) 0
+#define ubi_fastmap_close(ubi)
+#define ubi_update_fastmap(ubi) 0
+#define ubi_fastmap_invalidate(ubi) 0
+#define ubi_fm_down_read(ubi)
+#define ubi_fm_down_read_trylock(ubi) 1
+#define ubi_fm_up_read(ubi)
+#define ubi_fm_unverified(ubi, pnum) 0
+#endif
+
 /* eba.c */
+unsigned long long ubi_next_sqnum(struct ubi_device *ubi);
+int ubi_eba_is_mapped(struct ubi_device *ubi, struct ubi_volume *vol,
+		      int lnum);
 int ubi_eba_unmap_leb(struct ubi_device *ubi, struct ubi_volume *vol,
 		      int lnum);
 int ubi_eba_read_leb(struct ubi_device *ubi, struct ubi_volume *vol, int lnum,
@@ -487,6 +576,15 @@ int ubi_wl_scrub_peb(struct ubi_device *ubi, int pnum);
 int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si);
 void ubi_wl_close(struct ubi_device *ubi);
 int ubi_thread(void *u);
+#ifdef CONFIG_MTD_UBI_FASTMAP
+void ubi_wl_fm_peb_states(struct ubi_device *ubi, u8 *state, int *ec);
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor);
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int torture);
+int ubi_wl_fm_pool(struct ubi_device *ubi, int *pool, int max);
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e);
+void ubi_wl_schedule_fm_update(struct ubi_device *ubi);
+#endif
 
 /* io.c */
 int ubi_io_read(const struct ubi_device *ubi, void *buf, int pnum, int offset,
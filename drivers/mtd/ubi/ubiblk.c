@@ -22,111 +22,210 @@
 #include <linux/vmalloc.h>
 #include <linux/hdreg.h>
 #include <linux/mutex.h>
+#include <linux/kthread.h>
+#include <linux/proc_fs.h>
+#include <linux/bitops.h>
+#include <asm/div64.h>
 #include "ubi.h"
 #include "ubiblk.h"
 
 #define UBIBLK_UNMAPPED 0
 #define UBIBLK_SECTOR_SIZE 512
+#define UBIBLK_SECTOR_SHIFT 9
+#define UBIBLK_MAX_CACHE 32
 
 extern void ubi_open_blkdev(int ubi_num, int vol_id, int mode);
 extern void ubi_close_blkdev(struct ubi_volume_desc *desc);
-static void ubiblk_setup_writecache(struct ubiblk_dev *ubiblk, int virt_block);				   
-static int ubiblk_flush_writecache(struct ubiblk_dev *ubiblk);
-extern int ubiblk_leb_change(struct ubiblk_dev *ubiblk);
 
 struct ubiblk_dev *ubiblks[UBI_MAX_VOLUMES];
-static unsigned short subpage_shift; 
+/* Protects ubiblks[] against the /proc reader */
+static DEFINE_MUTEX(ubiblks_mutex);
 
-static int ubiblk_flush_writecache(struct ubiblk_dev *ubiblk)
+static int cache_lebs = 4;
+module_param(cache_lebs, int, 0444);
+MODULE_PARM_DESC(cache_lebs, "Number of LEBs cached for writing per volume (1-32, default 4)");
+
+static int writeback_secs = 5;
+module_param(writeback_secs, int, 0644);
+MODULE_PARM_DESC(writeback_secs, "Age in seconds after which a dirty LEB is written back (default 5)");
+
+static inline int ubiblk_sects_per_leb(struct ubiblk_dev *ubiblk)
+{
+	return ubiblk->uv->vol->usable_leb_size >> UBIBLK_SECTOR_SHIFT;
+}
+
+/*
+ * Write a cached LEB back. The sectors which were not written are taken
+ * from the flash (or are 0xFF if the LEB is unmapped), and the whole LEB is
+ * then replaced atomically. Trailing empty min. I/O units are not written.
+ * Must be called with cache_mutex held.
+ */
+static int ubiblk_writeback(struct ubiblk_dev *ubiblk, struct ubiblk_cache *c)
 {
-	if (STATE_UNUSED == ubiblk->write_cache_state)
+	struct ubi_volume_desc *uv = ubiblk->uv;
+	int min_io_size = uv->vol->ubi->min_io_size;
+	int leb_size = uv->vol->usable_leb_size;
+	int sects = ubiblk_sects_per_leb(ubiblk);
+	unsigned char *buf = ubiblk->merge_buf;
+	int i, len, err;
+
+	if (c->lnum < 0 || find_first_bit(c->dirty, sects) >= sects)
 		return 0;
-	ubiblk_leb_change(ubiblk);
-	ubiblk->write_cache_state = STATE_UNUSED;
 
+	if (ubi_is_mapped(uv, c->lnum) == UBIBLK_UNMAPPED) {
+		memset(buf, 0xFF, leb_size);
+	} else if (ubiblk->read_cache_state == STATE_USED &&
+		   ubiblk->vbr == c->lnum) {
+		memcpy(buf, ubiblk->read_cache, leb_size);
+	} else {
+		err = ubi_leb_read(uv, c->lnum, buf, 0, leb_size, 0);
+		if (err && err != -EBADMSG)
+			return err;
+	}
+
+	for (i = find_first_bit(c->dirty, sects); i < sects;
+	     i = find_next_bit(c->dirty, sects, i + 1))
+		memcpy(buf + (i << UBIBLK_SECTOR_SHIFT),
+		       c->buf + (i << UBIBLK_SECTOR_SHIFT), UBIBLK_SECTOR_SIZE);
+
+	for (len = leb_size; len > 0; len -= min_io_size) {
+		unsigned char *p = buf + len - min_io_size;
+
+		for (i = 0; i < min_io_size; i++)
+			if (p[i] != 0xFF)
+				break;
+		if (i < min_io_size)
+			break;
+	}
+
+	/*
+	 * ubi_leb_change() does nothing for an empty buffer, and an
+	 * all-0xFF LEB reads back the same as an unmapped one anyway.
+	 */
+	if (len)
+		err = ubi_leb_change(uv, c->lnum, buf, len, UBI_UNKNOWN);
+	else
+		err = ubi_leb_unmap(uv, c->lnum);
+	if (err) {
+		ubi_err("cannot write back LEB %d of volume %d, error %d",
+			c->lnum, uv->vol->vol_id, err);
+		return err;
+	}
+
+	ubiblk->stats.leb_changes++;
+	ubiblk->stats.flash_bytes += len;
+	bitmap_zero(c->dirty, sects);
+
+	/* The merged LEB is the current contents, keep it as the read cache */
+	ubiblk->merge_buf = ubiblk->read_cache;
+	ubiblk->read_cache = buf;
+	ubiblk->vbr = c->lnum;
+	ubiblk->read_cache_state = STATE_USED;
 	return 0;
 }
 
-static void ubiblk_setup_writecache(struct ubiblk_dev *ubiblk, int virt_block)
+/* Write back all dirty LEBs, or only those older than @age jiffies */
+static int ubiblk_flush_cache(struct ubiblk_dev *ubiblk, unsigned long age)
 {
-	struct ubi_volume_desc *uv = ubiblk->uv;
-	struct ubi_device *ubi = uv->vol->ubi;
-	int ppb = ubi->leb_size / ubi->min_io_size;
-	unsigned short spp = ubi->min_io_size >> subpage_shift;
-
-	ubiblk->vbw = virt_block;
-	ubiblk->write_cache_state = STATE_USED;
-		
-	memset(ubiblk->page_sts, 0, ppb);
-	memset(ubiblk->subpage_sts, 0, ppb*spp);
+	struct ubiblk_cache *c, *n;
+	int err, ret = 0;
+
+	list_for_each_entry_safe(c, n, &ubiblk->lru, lru) {
+		if (c->lnum < 0)
+			continue;
+		if (age && time_before(jiffies, c->dirtied + age))
+			continue;
+		err = ubiblk_writeback(ubiblk, c);
+		if (err) {
+			ret = err;
+			continue;
+		}
+		/* Free entries are reused first */
+		c->lnum = -1;
+		list_move_tail(&c->lru, &ubiblk->lru);
+	}
+	return ret;
+}
+
+static struct ubiblk_cache *ubiblk_find_cache(struct ubiblk_dev *ubiblk,
+					      int lnum)
+{
+	struct ubiblk_cache *c;
+
+	list_for_each_entry(c, &ubiblk->lru, lru)
+		if (c->lnum == lnum)
+			return c;
+	return NULL;
 }
 
-static int do_cached_write (struct ubiblk_dev *ubiblk, unsigned long sector, 
+/*
+ * Get the cache entry for @lnum, making it the most recently used one. If
+ * the LEB is not cached, the least recently used entry is written back and
+ * reused.
+ */
+static struct ubiblk_cache *ubiblk_get_cache(struct ubiblk_dev *ubiblk,
+					     int lnum)
+{
+	struct ubiblk_cache *c;
+	int err;
+
+	c = ubiblk_find_cache(ubiblk, lnum);
+	if (c) {
+		ubiblk->stats.write_hits++;
+	} else {
+		c = list_entry(ubiblk->lru.prev, struct ubiblk_cache, lru);
+		if (c->lnum >= 0) {
+			ubiblk->stats.evictions++;
+			err = ubiblk_writeback(ubiblk, c);
+			if (err)
+				return ERR_PTR(err);
+		}
+		c->lnum = lnum;
+		c->dirtied = jiffies;
+	}
+
+	list_move(&c->lru, &ubiblk->lru);
+	return c;
+}
+
+static int do_cached_write (struct ubiblk_dev *ubiblk, unsigned long sector,
 			    int len, const char *buf)
 {
-	struct ubi_volume_desc *uv = ubiblk->uv;
-	struct ubi_device *ubi = uv->vol->ubi;
-	int ppb = ubi->leb_size / ubi->min_io_size;
-	unsigned short sectors_per_page =  ubi->min_io_size / len;
-	unsigned short sectors_in_page_shift = ffs(sectors_per_page) - 1;
-	unsigned short page_shift =  ffs(ubi->min_io_size) - 1;
-	unsigned short virt_block, page, subpage;
-	unsigned long virt_page; 
-	
-	virt_page = sector / sectors_per_page;
-	subpage = sector % sectors_per_page;
-	virt_block = virt_page / ppb; 
-	page = virt_page % ppb;
-	
-	if(ubi_is_mapped(uv, virt_block) == UBIBLK_UNMAPPED ){
-		mutex_lock(&ubiblk->cache_mutex);
-		ubiblk_flush_writecache(ubiblk);
+	int sects = ubiblk_sects_per_leb(ubiblk);
+	struct ubiblk_cache *c;
+	int offs = sector % sects;
+
+	mutex_lock(&ubiblk->cache_mutex);
+	c = ubiblk_get_cache(ubiblk, sector / sects);
+	if (IS_ERR(c)) {
 		mutex_unlock(&ubiblk->cache_mutex);
+		return PTR_ERR(c);
+	}
 
-		ubiblk_setup_writecache(ubiblk, virt_block);
-	} else {
-		if ( STATE_USED == ubiblk->write_cache_state ) {
-			if ( ubiblk->vbw != virt_block) {
-			// Commit before we start a new cache.
-				mutex_lock(&ubiblk->cache_mutex);
-				ubiblk_flush_writecache(ubiblk);
-				mutex_unlock(&ubiblk->cache_mutex);
-				
-				ubiblk_setup_writecache(ubiblk, virt_block);
-			} else {
-				//printk("cache hit: 0x%x\n", virt_page);
-			}
-		} else {
-//			printk("with existing mapping\n");
-			ubiblk_setup_writecache(ubiblk, virt_block);
-		}                        
-	}		
-	ubiblk->page_sts[page] = 1;
-	ubiblk->subpage_sts[(page<<sectors_in_page_shift) + subpage] = 1;
-	memcpy(&ubiblk->write_cache[(page<<page_shift) +(subpage<<subpage_shift)],
-	       buf,len);
+	set_bit(offs, c->dirty);
+	memcpy(c->buf + (offs << UBIBLK_SECTOR_SHIFT), buf, len);
+	ubiblk->stats.write_sectors++;
+	mutex_unlock(&ubiblk->cache_mutex);
 	return 0;
 }
 
-static int do_cached_read (struct ubiblk_dev *ubiblk, unsigned long sector, 
+static int do_cached_read (struct ubiblk_dev *ubiblk, unsigned long sector,
 			   int len, char *buf)
 {
 	struct ubi_volume_desc *uv = ubiblk->uv;
-	int ppb = uv->vol->ubi->leb_size / uv->vol->ubi->min_io_size;
-	unsigned short sectors_per_page =  uv->vol->ubi->min_io_size >> 9;
-	unsigned short page_shift =  ffs(uv->vol->ubi->min_io_size) - 1;
-	unsigned short virt_block, page, page_offset; 	
-	unsigned long virt_page; 
-		
-	virt_page = sector / sectors_per_page;
-	page_offset = sector % sectors_per_page;
-	virt_block = virt_page / ppb; 
-	page = virt_page % ppb;
-
-	if(ubiblk->vbw == virt_block){		
-		mutex_lock(&ubiblk->cache_mutex);
-		ubiblk_flush_writecache(ubiblk);
-		mutex_unlock(&ubiblk->cache_mutex);
+	int sects = ubiblk_sects_per_leb(ubiblk);
+	int virt_block = sector / sects;
+	int offs = sector % sects;
+	struct ubiblk_cache *c;
+	int err = 0;
+
+	mutex_lock(&ubiblk->cache_mutex);
+	ubiblk->stats.read_sectors++;
+
+	c = ubiblk_find_cache(ubiblk, virt_block);
+	if (c && test_bit(offs, c->dirty)) {
+		memcpy(buf, c->buf + (offs << UBIBLK_SECTOR_SHIFT), len);
+		goto out;
 	}
 
 	if ( ubi_is_mapped( uv, virt_block) == UBIBLK_UNMAPPED){
@@ -135,19 +234,23 @@ static int do_cached_read (struct ubiblk_dev *ubiblk, unsigned long sector,
 		  * All data returned should be set to 0xFF when accessing this logical 
 		  * block.
 		  */	
-		  
-		//printk("address translate fail\n");
-		memset(buf, 0xFF, UBIBLK_SECTOR_SIZE);
+		memset(buf, 0xFF, len);
 	} else {
 
 		if( ubiblk->vbr != virt_block ||ubiblk->read_cache_state == STATE_UNUSED ){
+			ubiblk->read_cache_state = STATE_UNUSED;
+			err = ubi_leb_read(uv, virt_block, ubiblk->read_cache, 0, uv->vol->usable_leb_size, 0);
+			if (err && err != -EBADMSG)
+				goto out;
+			err = 0;
 			ubiblk->vbr = virt_block;
-			ubi_leb_read(uv, virt_block, ubiblk->read_cache, 0, uv->vol->usable_leb_size, 0);				
 			ubiblk->read_cache_state = STATE_USED;
 		}
-		memcpy(buf, &ubiblk->read_cache[(page<<page_shift)+(page_offset<<9)], len);
+		memcpy(buf, &ubiblk->read_cache[offs << UBIBLK_SECTOR_SHIFT], len);
 	}
-	return 0;
+out:
+	mutex_unlock(&ubiblk->cache_mutex);
+	return err;
 }
 
 static int ubiblk_readsect(struct ubi_blktrans_dev *dev,
@@ -164,40 +267,100 @@ static int ubiblk_writesect(struct ubi_blktrans_dev *dev,
 	return do_cached_write(ubiblk, block, UBIBLK_SECTOR_SIZE, buf);
 }
 
+/*
+ * Background writeback. Dirty LEBs are written back once they are older
+ * than writeback_secs, so that bursts of writes to the same LEBs (e.g. the
+ * FAT and a data cluster) are merged into one LEB change each.
+ */
+static int ubiblk_thread(void *arg)
+{
+	struct ubiblk_dev *ubiblk = arg;
+
+	set_freezable();
+	while (!kthread_should_stop()) {
+		unsigned long age = writeback_secs * HZ;
+
+		schedule_timeout_interruptible(age / 2 ? age / 2 : HZ);
+		try_to_freeze();
+
+		mutex_lock(&ubiblk->cache_mutex);
+		ubiblk_flush_cache(ubiblk, age ? age : 1);
+		mutex_unlock(&ubiblk->cache_mutex);
+	}
+	return 0;
+}
+
+static void ubiblk_free_vol(struct ubiblk_dev *ubiblk)
+{
+	int i;
+
+	if (ubiblk->cache) {
+		for (i = 0; i < ubiblk->cache_size; i++) {
+			vfree(ubiblk->cache[i].buf);
+			kfree(ubiblk->cache[i].dirty);
+		}
+		kfree(ubiblk->cache);
+	}
+	vfree(ubiblk->merge_buf);
+	vfree(ubiblk->read_cache);
+	kfree(ubiblk);
+}
+
 static int ubiblk_init_vol(int dev, struct ubi_volume_desc *uv)
 {
 	struct ubiblk_dev *ubiblk;
-	struct ubi_device *ubi = uv->vol->ubi;
-	int ppb = ubi->leb_size / ubi->min_io_size;
-	unsigned short spp = ubi->min_io_size >> subpage_shift;
-			
-	ubiblk = kmalloc(sizeof(struct ubiblk_dev), GFP_KERNEL);
+	int leb_size = uv->vol->usable_leb_size;
+	int sects = leb_size >> UBIBLK_SECTOR_SHIFT;
+	int i;
+
+	ubiblk = kzalloc(sizeof(struct ubiblk_dev), GFP_KERNEL);
 	if (!ubiblk)
 		return -ENOMEM;
 
-	memset(ubiblk, 0, sizeof(*ubiblk));
-
 	ubiblk->count = 1;
 	ubiblk->uv = uv;
 	mutex_init (&ubiblk->cache_mutex);
+	INIT_LIST_HEAD(&ubiblk->lru);
+
+	ubiblk->cache_size = clamp(cache_lebs, 1, UBIBLK_MAX_CACHE);
+	ubiblk->cache = kcalloc(ubiblk->cache_size, sizeof(struct ubiblk_cache),
+				GFP_KERNEL);
+	ubiblk->merge_buf = vmalloc(leb_size);
+	ubiblk->read_cache = vmalloc(leb_size);
+	if (!ubiblk->cache || !ubiblk->merge_buf || !ubiblk->read_cache)
+		goto out_free;
+
+	for (i = 0; i < ubiblk->cache_size; i++) {
+		struct ubiblk_cache *c = &ubiblk->cache[i];
+
+		c->lnum = -1;
+		c->buf = vmalloc(leb_size);
+		c->dirty = kzalloc(BITS_TO_LONGS(sects) * sizeof(long),
+				   GFP_KERNEL);
+		if (!c->buf || !c->dirty)
+			goto out_free;
+		list_add_tail(&c->lru, &ubiblk->lru);
+	}
 
-	ubiblk->write_cache = vmalloc(ubiblk->uv->vol->usable_leb_size); 
-	ubiblk->read_cache = vmalloc(ubiblk->uv->vol->usable_leb_size);
-	ubiblk->page_sts = vmalloc(ppb);
-	ubiblk->subpage_sts = vmalloc(ppb*spp);
-	
-	if(!ubiblk->write_cache || 
-		!ubiblk->read_cache ||
-		!ubiblk->page_sts ||
-		!ubiblk->subpage_sts)
-		return -ENOMEM;
-
-	ubiblk->write_cache_state = STATE_UNUSED;
 	ubiblk->read_cache_state = STATE_UNUSED;
 
+	ubiblk->thread = kthread_run(ubiblk_thread, ubiblk, "ubiblk%d", dev);
+	if (IS_ERR(ubiblk->thread)) {
+		int err = PTR_ERR(ubiblk->thread);
+
+		ubiblk_free_vol(ubiblk);
+		return err;
+	}
+
+	mutex_lock(&ubiblks_mutex);
 	ubiblks[dev] = ubiblk;
+	mutex_unlock(&ubiblks_mutex);
 	DEBUG(MTD_DEBUG_LEVEL1, "ok\n");
 	return 0;
+
+out_free:
+	ubiblk_free_vol(ubiblk);
+	return -ENOMEM;
 }
 
 static int ubiblk_open(struct inode *i, struct file *f )
@@ -229,7 +392,6 @@ static int ubiblk_open(struct inode *i, struct file *f )
 	desc->vol->bdev_mode = mode;
 	dev->uv = desc; 
 
-	subpage_shift = ffs(UBIBLK_SECTOR_SIZE)-1; 
 	ret = ubiblk_init_vol(dev->devnum, desc);
 	return ret;
 }
@@ -239,24 +401,26 @@ static int ubiblk_release(struct ubi_blktrans_dev *ubd)
 	int dev = ubd->devnum;
 	struct ubiblk_dev *ubiblk = ubiblks[dev];
 	struct ubi_device *ubi = ubiblk->uv->vol->ubi;
-	
+	struct ubi_volume_desc *uv = ubiblk->uv;
+
 	mutex_lock(&ubiblk->cache_mutex);
-	ubiblk_flush_writecache(ubiblk);
+	ubiblk_flush_cache(ubiblk, 0);
 	mutex_unlock(&ubiblk->cache_mutex);
 
 	ubiblk->count --;
 	if (!ubiblk->count) {
 		/* It was the last usage. Free the device */
+		kthread_stop(ubiblk->thread);
+
+		mutex_lock(&ubiblks_mutex);
 		ubiblks[dev] = NULL;
+		mutex_unlock(&ubiblks_mutex);
 
 		if (ubi->mtd->sync)
 			ubi->mtd->sync(ubi->mtd);
 
-		vfree(ubiblk->write_cache);
-		vfree(ubiblk->read_cache);
-		kfree(ubiblk);
-		
-		ubi_close_volume(ubiblk->uv);
+		ubiblk_free_vol(ubiblk);
+		ubi_close_volume(uv);
 		return 0;
 	}
 	else{
@@ -270,14 +434,15 @@ static int ubiblk_flush(struct ubi_blktrans_dev *dev)
 {
 	struct ubiblk_dev *ubiblk = ubiblks[dev->devnum];
 	struct ubi_device *ubi = ubiblk->uv->vol->ubi;
-	
+	int err;
+
 	mutex_lock(&ubiblk->cache_mutex);
-	ubiblk_flush_writecache(ubiblk);
+	err = ubiblk_flush_cache(ubiblk, 0);
 	mutex_unlock(&ubiblk->cache_mutex);
 
 	if (ubi->mtd->sync)
 		ubi->mtd->sync(ubi->mtd);
-	return 0;
+	return err;
 }
 
 void ubiblk_add_vol_dev(struct ubi_blktrans_ops *tr, struct ubi_volume *vol)
@@ -329,13 +494,80 @@ static struct ubi_blktrans_ops ubiblk_tr = {
 	.owner		         = THIS_MODULE,
 };
 
+/* Support for /proc/ubiblk */
+
+static struct proc_dir_entry *proc_ubiblk;
+
+static int ubiblk_proc_info(char *buf, int i)
+{
+	struct ubiblk_dev *ubiblk = ubiblks[i];
+	struct ubiblk_stats *st;
+	unsigned long long amp;
+
+	if (!ubiblk)
+		return 0;
+
+	/* Write amplification in percent: flash bytes per byte written */
+	st = &ubiblk->stats;
+	amp = 0;
+	if (st->write_sectors) {
+		amp = (st->flash_bytes * 100) >> UBIBLK_SECTOR_SHIFT;
+		do_div(amp, st->write_sectors);
+	}
+
+	return sprintf(buf, "ubiblk%d: %lu %lu %lu %lu %lu %llu %llu%%\n", i,
+		       st->read_sectors, st->write_sectors, st->write_hits,
+		       st->leb_changes, st->evictions, st->flash_bytes, amp);
+}
+
+static int ubiblk_read_proc(char *page, char **start, off_t off, int count,
+			    int *eof, void *data_unused)
+{
+	int len, l, i;
+	off_t begin = 0;
+
+	mutex_lock(&ubiblks_mutex);
+
+	len = sprintf(page, "dev:     read_sect write_sect write_hits "
+		      "leb_changes evictions flash_bytes write_amp\n");
+	for (i = 0; i < UBI_MAX_VOLUMES; i++) {
+		l = ubiblk_proc_info(page + len, i);
+		len += l;
+		if (len+begin > off+count)
+			goto done;
+		if (len+begin < off) {
+			begin += len;
+			len = 0;
+		}
+	}
+
+	*eof = 1;
+
+done:
+	mutex_unlock(&ubiblks_mutex);
+	if (off >= len+begin)
+		return 0;
+	*start = page + (off-begin);
+	return ((count < begin+len-off) ? count : begin+len-off);
+}
+
 static int __init init_ubiblock(void)
 {
-	return register_ubi_blktrans(&ubiblk_tr);
+	int err;
+
+	err = register_ubi_blktrans(&ubiblk_tr);
+	if (err)
+		return err;
+
+	if ((proc_ubiblk = create_proc_entry("ubiblk", 0, NULL)))
+		proc_ubiblk->read_proc = ubiblk_read_proc;
+	return 0;
 }
 
 static void __exit cleanup_ubiblock(void)
 {
+	if (proc_ubiblk)
+		remove_proc_entry("ubiblk", NULL);
 	deregister_ubi_blktrans(&ubiblk_tr);
 }
 
@@ -17,19 +17,42 @@ struct ubi_blktrans_ops;
 struct file;
 struct inode;
 
+/*
+ * One cached LEB. Only the sectors set in @dirty are valid in @buf, the rest
+ * of the LEB is read back from flash when the entry is written out.
+ */
+struct ubiblk_cache {
+	struct list_head lru;
+	int lnum;                     /* -1 if the entry is free */
+	unsigned long dirtied;        /* jiffies when the entry became dirty */
+	unsigned char *buf;
+	unsigned long *dirty;         /* one bit per sector */
+};
+
+struct ubiblk_stats {
+	unsigned long read_sectors;
+	unsigned long write_sectors;
+	unsigned long write_hits;     /* writes to an already cached LEB */
+	unsigned long evictions;      /* LEBs written out to make room */
+	unsigned long leb_changes;    /* LEBs written out in total */
+	unsigned long long flash_bytes; /* bytes passed to ubi_leb_change */
+};
+
 struct ubiblk_dev {
 	struct ubi_volume_desc *uv;
 	int count;
 	struct mutex cache_mutex;
-	unsigned short vbw;           //virt block number of write cache
 	unsigned short vbr;            //virt block number of read cache
 
-	unsigned char *write_cache;
-	unsigned char *page_sts;
-	unsigned char *subpage_sts;
-	
+	struct list_head lru;         /* write cache, most recently used first */
+	struct ubiblk_cache *cache;
+	int cache_size;
+	unsigned char *merge_buf;
+	struct task_struct *thread;   /* background writeback */
+	struct ubiblk_stats stats;
+
 	unsigned char *read_cache;
-	enum { STATE_UNUSED, STATE_USED } read_cache_state, write_cache_state;
+	enum { STATE_UNUSED, STATE_USED } read_cache_state;
 };
 
 struct ubi_blktrans_dev {
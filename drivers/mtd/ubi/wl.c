@@ -70,6 +70,12 @@
  * pick target PEB with an average EC if our PEB is not very "old". This is a
  * room for future re-works of the WL unit.
  *
+ * When the fastmap is valid, free physical eraseblocks are handed out only
+ * from a small pool which the fastmap asks to scan on attach (@ubi->fm_pool).
+ * This way the fastmap stays correct without being re-written on every
+ * eraseblock allocation. When the pool is exhausted, the fastmap is
+ * invalidated and the background thread writes a new one.
+ *
  * FIXME: looks too complex, should be simplified (later).
  */
 
@@ -431,6 +437,36 @@ static struct ubi_wl_entry *find_wl_entry(struct rb_root *root, int max)
 	return e;
 }
 
+/**
+ * pool_take - take a physical eraseblock from the fastmap pool.
+ * @ubi: UBI device description object
+ * @ec: erase counter the caller would like to have
+ *
+ * This function picks the physical eraseblock with the erase counter closest
+ * to @ec from the fastmap pool and removes it from the pool. The eraseblock
+ * stays in the @ubi->free tree. Has to be called with @ubi->wl_lock held and
+ * the pool has to be non-empty.
+ */
+static struct ubi_wl_entry *pool_take(struct ubi_device *ubi, int ec)
+{
+	int i, best = 0, diff = INT_MAX;
+
+	ubi_assert(ubi->fm_pool_count > 0);
+	for (i = 0; i < ubi->fm_pool_count; i++) {
+		int d = abs(ubi->lookuptbl[ubi->fm_pool[i]]->ec - ec);
+
+		if (d < diff) {
+			diff = d;
+			best = i;
+		}
+	}
+
+	i = ubi->fm_pool[best];
+	ubi->fm_pool_count -= 1;
+	ubi->fm_pool[best] = ubi->fm_pool[ubi->fm_pool_count];
+	return ubi->lookuptbl[i];
+}
+
 /**
  * ubi_wl_get_peb - get a physical eraseblock.
  * @ubi: UBI device description object
@@ -472,6 +508,21 @@ retry:
 		goto retry;
 	}
 
+	if (ubi->fm_valid && ubi->fm_pool_count == 0) {
+		/*
+		 * The fastmap pool is exhausted, so the fastmap cannot
+		 * describe any new allocation. Invalidate it and go on without
+		 * it until the background thread writes a new one.
+		 */
+		spin_unlock(&ubi->wl_lock);
+		err = ubi_fastmap_invalidate(ubi);
+		if (err) {
+			kfree(pe);
+			return err;
+		}
+		goto retry;
+	}
+
 	switch (dtype) {
 		case UBI_LONGTERM:
 			/*
@@ -521,6 +572,9 @@ retry:
 			BUG();
 	}
 
+	if (ubi->fm_valid)
+		e = pool_take(ubi, e->ec);
+
 	/*
 	 * Move the physical eraseblock to the protection trees where it will
 	 * be protected from being moved for some time.
@@ -586,18 +640,35 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e, int tortur
 {
 	int err;
 	struct ubi_ec_hdr *ec_hdr;
-	unsigned long long ec = e->ec;
-
-	dbg_wl("erase PEB %d, old EC %llu", e->pnum, ec);
-
-	err = paranoid_check_ec(ubi, e->pnum, e->ec);
-	if (err > 0)
-		return -EINVAL;
+	unsigned long long ec;
 
 	ec_hdr = kzalloc(ubi->ec_hdr_alsize, GFP_NOFS);
 	if (!ec_hdr)
 		return -ENOMEM;
 
+	if (ubi->fm_attached) {
+		/*
+		 * Erase counters which came from the fastmap may be behind the
+		 * ones on the media if the fastmap was not re-written after
+		 * the last erasures. The EC header is authoritative.
+		 */
+		err = ubi_io_read_ec_hdr(ubi, e->pnum, ec_hdr, 0);
+		if ((!err || err == UBI_IO_BITFLIPS) &&
+		    be64_to_cpu(ec_hdr->ec) > e->ec &&
+		    be64_to_cpu(ec_hdr->ec) <= UBI_MAX_ERASECOUNTER)
+			e->ec = be64_to_cpu(ec_hdr->ec);
+		memset(ec_hdr, 0, ubi->ec_hdr_alsize);
+	}
+
+	ec = e->ec;
+	dbg_wl("erase PEB %d, old EC %llu", e->pnum, ec);
+
+	err = paranoid_check_ec(ubi, e->pnum, e->ec);
+	if (err > 0) {
+		err = -EINVAL;
+		goto out_free;
+	}
+
 	err = ubi_io_sync_erase(ubi, e->pnum, torture);
 	if (err < 0)
 		goto out_free;
@@ -628,6 +699,10 @@ static int sync_erase(struct ubi_device *ubi, struct ubi_wl_entry *e, int tortur
 		ubi->max_ec = e->ec;
 	spin_unlock(&ubi->wl_lock);
 
+	/* The eraseblock has no mapping anymore, nothing to verify */
+	if (ubi->fm_checkmap)
+		clear_bit(e->pnum, ubi->fm_checkmap);
+
 out_free:
 	kfree(ec_hdr);
 	return err;
@@ -778,6 +853,17 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		goto out_cancel;
 	}
 
+	if (ubi->fm_valid && ubi->fm_pool_count == 0) {
+		/*
+		 * The target has to come from the fastmap pool, which is
+		 * empty. Ask the background thread to write a new fastmap,
+		 * the movement will be triggered again later.
+		 */
+		dbg_wl("cancel WL, the fastmap pool is empty");
+		ubi->fm_update = 1;
+		goto out_cancel;
+	}
+
 	if (!ubi->scrub.rb_node) {
 		/*
 		 * Now pick the least worn-out used physical eraseblock and a
@@ -806,6 +892,9 @@ static int wear_leveling_worker(struct ubi_device *ubi, struct ubi_work *wrk,
 		dbg_wl("scrub PEB %d to PEB %d", e1->pnum, e2->pnum);
 	}
 
+	if (ubi->fm_valid)
+		e2 = pool_take(ubi, e2->ec);
+
 	paranoid_check_in_wl_tree(e2, &ubi->free);
 	rb_erase(&e2->rb, &ubi->free);
 	ubi->move_from = e1;
@@ -1113,6 +1202,12 @@ static int erase_worker(struct ubi_device *ubi, struct ubi_work *wl_wrk,
 	}
 
 	spin_unlock(&ubi->volumes_lock);
+
+	/* The fastmap may list this eraseblock as a good one */
+	err = ubi_fastmap_invalidate(ubi);
+	if (err)
+		goto out_ro;
+
 	ubi_msg("mark PEB %d as bad", pnum);
 
 	err = ubi_io_mark_bad(ubi, pnum);
@@ -1351,6 +1446,21 @@ static void tree_destroy(struct rb_root *root)
 	}
 }
 
+/**
+ * fm_wl_destroy - free wear-leveling entries of the fastmap eraseblocks.
+ * @ubi: UBI device description object
+ */
+static void fm_wl_destroy(struct ubi_device *ubi)
+{
+	int i;
+
+	for (i = 0; i < ubi->fm_peb_count; i++) {
+		kmem_cache_free(ubi_wl_entry_slab, ubi->fm_wl[i]);
+		ubi->fm_wl[i] = NULL;
+	}
+	ubi->fm_peb_count = 0;
+}
+
 /**
  * ubi_thread - UBI background thread.
  * @u: the UBI device description object pointer
@@ -1374,13 +1484,23 @@ int ubi_thread(void *u)
 			continue;
 
 		spin_lock(&ubi->wl_lock);
-		if (list_empty(&ubi->works) || ubi->ro_mode ||
-			       !ubi->thread_enabled) {
+		if ((list_empty(&ubi->works) && !ubi->fm_update) ||
+		    ubi->ro_mode || !ubi->thread_enabled) {
 			set_current_state(TASK_INTERRUPTIBLE);
 			spin_unlock(&ubi->wl_lock);
 			schedule();
 			continue;
 		}
+
+		if (ubi->fm_update) {
+			spin_unlock(&ubi->wl_lock);
+			err = ubi_update_fastmap(ubi);
+			if (err)
+				ubi_err("%s: cannot write fastmap, error %d",
+					ubi->bgt_name, err);
+			cond_resched();
+			continue;
+		}
 		spin_unlock(&ubi->wl_lock);
 
 		err = do_work(ubi);
@@ -1504,6 +1624,20 @@ int ubi_wl_init_scan(struct ubi_device *ubi, struct ubi_scan_info *si)
 		}
 	}
 
+	/* Physical eraseblocks of the fastmap the device was attached by */
+	list_for_each_entry(seb, &si->fm, u.list) {
+		e = kmem_cache_alloc(ubi_wl_entry_slab, GFP_KERNEL);
+		if (!e)
+			goto out_free;
+
+		e->pnum = seb->pnum;
+		e->ec = seb->ec;
+		ubi->lookuptbl[e->pnum] = e;
+		ubi_assert(seb->lnum < UBI_FM_MAX_BLOCKS);
+		ubi->fm_wl[seb->lnum] = e;
+		ubi->fm_peb_count += 1;
+	}
+
 	ubi_rb_for_each_entry(rb1, sv, &si->volumes, rb) {
 		ubi_rb_for_each_entry(rb2, seb, &sv->root, u.rb) {
 			cond_resched();
@@ -1547,6 +1681,7 @@ out_free:
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	fm_wl_destroy(ubi);
 	kfree(ubi->lookuptbl);
 	return err;
 }
@@ -1596,9 +1731,180 @@ void ubi_wl_close(struct ubi_device *ubi)
 	tree_destroy(&ubi->used);
 	tree_destroy(&ubi->free);
 	tree_destroy(&ubi->scrub);
+	fm_wl_destroy(ubi);
 	kfree(ubi->lookuptbl);
 }
 
+#ifdef CONFIG_MTD_UBI_FASTMAP
+
+/**
+ * ubi_wl_fm_peb_states - get states of all physical eraseblocks.
+ * @ubi: UBI device description object
+ * @state: array of @ubi->peb_count states to fill
+ * @ec: array of @ubi->peb_count erase counters to fill
+ *
+ * This function is used by the fastmap unit to take a snapshot of the
+ * wear-leveling unit. Physical eraseblocks unknown to the WL unit (e.g., bad
+ * ones) get %UBI_FM_PEB_UNKNOWN state and %-1 erase counter. The caller has to
+ * hold @ubi->work_sem for writing, so no work is in progress.
+ */
+void ubi_wl_fm_peb_states(struct ubi_device *ubi, u8 *state, int *ec)
+{
+	int i;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+	struct ubi_wl_prot_entry *pe;
+	struct ubi_work *wrk;
+
+	spin_lock(&ubi->wl_lock);
+	for (i = 0; i < ubi->peb_count; i++) {
+		e = ubi->lookuptbl[i];
+		state[i] = UBI_FM_PEB_UNKNOWN;
+		ec[i] = e ? e->ec : -1;
+	}
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, rb)
+		state[e->pnum] = UBI_FM_PEB_FREE;
+	ubi_rb_for_each_entry(rb, e, &ubi->used, rb)
+		state[e->pnum] = UBI_FM_PEB_USED;
+	ubi_rb_for_each_entry(rb, e, &ubi->scrub, rb)
+		state[e->pnum] = UBI_FM_PEB_SCRUB;
+	ubi_rb_for_each_entry(rb, pe, &ubi->prot.pnum, rb_pnum)
+		state[pe->e->pnum] = UBI_FM_PEB_USED;
+	list_for_each_entry(wrk, &ubi->works, list)
+		if (wrk->func == &erase_worker)
+			state[wrk->e->pnum] = UBI_FM_PEB_ERASE;
+	for (i = 0; i < ubi->fm_peb_count; i++)
+		state[ubi->fm_wl[i]->pnum] = UBI_FM_PEB_FM;
+	spin_unlock(&ubi->wl_lock);
+}
+
+/**
+ * ubi_wl_get_fm_peb - get a physical eraseblock for the fastmap.
+ * @ubi: UBI device description object
+ * @anchor: if the eraseblock is going to be the fastmap anchor
+ *
+ * The anchor has to be one of the first %UBI_FM_MAX_START eraseblocks, the
+ * one with the lowest erase counter is picked. Other fastmap eraseblocks are
+ * taken from the pool if the current fastmap is valid, because only pool
+ * eraseblocks are scanned when it is used for attaching. The eraseblock is
+ * removed from the @ubi->free tree, and the caller owns the returned entry.
+ * Returns %NULL if there is no suitable eraseblock.
+ */
+struct ubi_wl_entry *ubi_wl_get_fm_peb(struct ubi_device *ubi, int anchor)
+{
+	int i;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e = NULL, *e1;
+
+	spin_lock(&ubi->wl_lock);
+	if (anchor) {
+		ubi_rb_for_each_entry(rb, e1, &ubi->free, rb)
+			if (e1->pnum < UBI_FM_MAX_START) {
+				e = e1;
+				break;
+			}
+	} else if (ubi->fm_valid) {
+		if (ubi->fm_pool_count)
+			e = pool_take(ubi, 0);
+	} else if (ubi->free.rb_node)
+		e = rb_entry(rb_first(&ubi->free), struct ubi_wl_entry, rb);
+
+	if (e) {
+		paranoid_check_in_wl_tree(e, &ubi->free);
+		rb_erase(&e->rb, &ubi->free);
+		for (i = 0; i < ubi->fm_pool_count; i++)
+			if (ubi->fm_pool[i] == e->pnum) {
+				ubi->fm_pool_count -= 1;
+				ubi->fm_pool[i] = ubi->fm_pool[ubi->fm_pool_count];
+				break;
+			}
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return e;
+}
+
+/**
+ * ubi_wl_put_fm_peb - return a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the eraseblock to return
+ * @torture: if this physical eraseblock has to be tortured
+ *
+ * This function schedules erasure of a physical eraseblock which was taken
+ * by 'ubi_wl_get_fm_peb()' or belonged to the fastmap the device was attached
+ * by. Returns zero in case of success and a negative error code in case of
+ * failure.
+ */
+int ubi_wl_put_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e,
+		      int torture)
+{
+	dbg_wl("PEB %d", e->pnum);
+	return schedule_erase(ubi, e, torture);
+}
+
+/**
+ * ubi_wl_fm_pool - select the pool for a new fastmap.
+ * @ubi: UBI device description object
+ * @pool: array to store the physical eraseblock numbers to
+ * @max: maximum size of the pool
+ *
+ * This function picks up to @max free physical eraseblocks evenly spread over
+ * the erase counter range of the @ubi->free tree. Returns the number of
+ * picked eraseblocks.
+ */
+int ubi_wl_fm_pool(struct ubi_device *ubi, int *pool, int max)
+{
+	int n = 0, i = 0, count = 0;
+	struct rb_node *rb;
+	struct ubi_wl_entry *e;
+
+	spin_lock(&ubi->wl_lock);
+	ubi_rb_for_each_entry(rb, e, &ubi->free, rb)
+		n += 1;
+
+	ubi_rb_for_each_entry(rb, e, &ubi->free, rb) {
+		if (count == max)
+			break;
+		/* Take the eraseblock if it starts a new 1/@max slice */
+		if ((long long)i * max >= (long long)count * n)
+			pool[count++] = e->pnum;
+		i += 1;
+	}
+	spin_unlock(&ubi->wl_lock);
+
+	return count;
+}
+
+/**
+ * ubi_wl_erase_fm_peb - synchronously erase a fastmap physical eraseblock.
+ * @ubi: UBI device description object
+ * @e: the eraseblock to erase
+ *
+ * This function is used to invalidate the fastmap anchor. The eraseblock
+ * stays owned by the fastmap unit. Returns zero in case of success and a
+ * negative error code in case of failure.
+ */
+int ubi_wl_erase_fm_peb(struct ubi_device *ubi, struct ubi_wl_entry *e)
+{
+	return sync_erase(ubi, e, 0);
+}
+
+/**
+ * ubi_wl_schedule_fm_update - ask the background thread to write fastmap.
+ * @ubi: UBI device description object
+ */
+void ubi_wl_schedule_fm_update(struct ubi_device *ubi)
+{
+	spin_lock(&ubi->wl_lock);
+	ubi->fm_update = 1;
+	if (ubi->thread_enabled)
+		wake_up_process(ubi->bgt_thread);
+	spin_unlock(&ubi->wl_lock);
+}
+
+#endif /* CONFIG_MTD_UBI_FASTMAP */
+
 #ifdef CONFIG_MTD_UBI_DEBUG_PARANOID
 
 /**
@@ -492,6 +492,14 @@ sync_sb_inodes(struct super_block *sb, struct writeback_control *wbc)
 		if (time_after(inode->dirtied_when, start))
 			break;
 
+		/* Let a partial write unit grow, a later pass will take it */
+		if (wbc->whole_units && bdi->write_unit &&
+		    mapping_dirty_pages(mapping, bdi->write_unit) <
+							bdi->write_unit) {
+			requeue_io(inode);
+			continue;
+		}
+
 		/* Is another pdflush already flushing this queue? */
 		if (current_is_pdflush() && !writeback_acquire(bdi))
 			break;
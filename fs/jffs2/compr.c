@@ -11,6 +11,9 @@
  *
  */
 
+#include <linux/ktime.h>
+#include <linux/proc_fs.h>
+#include <asm/div64.h>
 #include "compr.h"
 
 static DEFINE_SPINLOCK(jffs2_compressor_list_lock);
@@ -24,15 +27,50 @@ static int jffs2_compression_mode = JFFS2_COMPR_MODE_PRIORITY;
 /* Statistics for blocks stored without compression */
 static uint32_t none_stat_compr_blocks=0,none_stat_decompr_blocks=0,none_stat_compr_size=0;
 
+/* Statistics of the adaptive mode */
+static uint32_t adapt_stat_probes=0,none_stat_adapt_picks=0;
+
+static const char *jffs2_compr_mode_names[] = {
+	[JFFS2_COMPR_MODE_NONE]		= "none",
+	[JFFS2_COMPR_MODE_PRIORITY]	= "priority",
+	[JFFS2_COMPR_MODE_SIZE]		= "size",
+	[JFFS2_COMPR_MODE_FAVOURLZO]	= "favourlzo",
+	[JFFS2_COMPR_MODE_ADAPTIVE]	= "adaptive",
+};
+
+int jffs2_compr_mode_parse(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(jffs2_compr_mode_names); i++)
+		if (!strcmp(name, jffs2_compr_mode_names[i]))
+			return i;
+	return -EINVAL;
+}
+
+const char *jffs2_compr_mode_name(int mode)
+{
+	if (mode < 0 || mode >= ARRAY_SIZE(jffs2_compr_mode_names))
+		return "unknown";
+	return jffs2_compr_mode_names[mode];
+}
+
+static int jffs2_compr_mode(struct jffs2_sb_info *c)
+{
+	if (c->mount_opts.override_compr)
+		return c->mount_opts.compr;
+	return jffs2_compression_mode;
+}
 
 /*
  * Return 1 to use this compression
  */
-static int jffs2_is_best_compression(struct jffs2_compressor *this,
+static int jffs2_is_best_compression(int mode, struct jffs2_compressor *this,
 		struct jffs2_compressor *best, uint32_t size, uint32_t bestsize)
 {
-	switch (jffs2_compression_mode) {
+	switch (mode) {
 	case JFFS2_COMPR_MODE_SIZE:
+	case JFFS2_COMPR_MODE_ADAPTIVE:
 		if (bestsize > size)
 			return 1;
 		return 0;
@@ -52,6 +90,86 @@ static int jffs2_is_best_compression(struct jffs2_compressor *this,
 	return 0;
 }
 
+/*
+ * Adaptive mode: compress with the compressor which the last probe chose
+ * for this inode. Returns JFFS2_COMPR_NONE with *datalen and *cdatalen
+ * untouched if it is gone or did not manage to shrink the data.
+ */
+static uint16_t jffs2_compress_preferred(struct jffs2_inode_info *f,
+		unsigned char *data_in, unsigned char **output_buf,
+		uint32_t *datalen, uint32_t *cdatalen)
+{
+	struct jffs2_compressor *this;
+	uint32_t slen = *datalen, dlen = *cdatalen;
+	ktime_t start;
+	int compr_ret;
+
+	*output_buf = kmalloc(dlen, GFP_KERNEL);
+	if (!*output_buf)
+		return JFFS2_COMPR_NONE;
+
+	spin_lock(&jffs2_compressor_list_lock);
+	list_for_each_entry(this, &jffs2_compressor_list, list) {
+		if (this->compr != f->compr_pref)
+			continue;
+		if ((!this->compress)||(this->disabled))
+			break;
+
+		this->usecount++;
+		spin_unlock(&jffs2_compressor_list_lock);
+		start = ktime_get();
+		compr_ret = this->compress(data_in, *output_buf, datalen, cdatalen, NULL);
+		spin_lock(&jffs2_compressor_list_lock);
+		this->usecount--;
+		this->stat_compr_time += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (!compr_ret && *cdatalen < *datalen) {
+			this->stat_compr_blocks++;
+			this->stat_compr_orig_size += *datalen;
+			this->stat_compr_new_size  += *cdatalen;
+			spin_unlock(&jffs2_compressor_list_lock);
+			return this->compr;
+		}
+		break;
+	}
+	spin_unlock(&jffs2_compressor_list_lock);
+
+	kfree(*output_buf);
+	*output_buf = NULL;
+	*datalen = slen;
+	*cdatalen = dlen;
+	return JFFS2_COMPR_NONE;
+}
+
+/*
+ * Adaptive mode: after every compressor has been run on the node, pick
+ * the fastest one among those whose output is close to the smallest one
+ * (@best), and make it the inode's preference until the next probe.
+ * Called with jffs2_compressor_list_lock held.
+ */
+static struct jffs2_compressor *jffs2_adaptive_pick(struct jffs2_inode_info *f,
+		struct jffs2_compressor *best, uint32_t best_dlen)
+{
+	struct jffs2_compressor *this;
+	uint32_t limit = best_dlen + best_dlen * JFFS2_ADAPTIVE_SLACK_PERCENT / 100;
+
+	if (best) {
+		list_for_each_entry(this, &jffs2_compressor_list, list) {
+			if (!this->probe_dlen || !this->compr_buf)
+				continue;
+			if (this->probe_dlen <= limit && this->probe_time < best->probe_time)
+				best = this;
+		}
+		best->stat_adapt_picks++;
+		f->compr_pref = best->compr;
+	} else {
+		none_stat_adapt_picks++;
+		f->compr_pref = JFFS2_COMPR_NONE;
+	}
+	adapt_stat_probes++;
+	f->compr_probe = JFFS2_ADAPTIVE_PROBE_INTERVAL;
+	return best;
+}
+
 /* jffs2_compress:
  * @data: Pointer to uncompressed data
  * @cdata: Pointer to returned pointer to buffer for compressed data
@@ -69,19 +187,26 @@ static int jffs2_is_best_compression(struct jffs2_compressor *this,
  * If the cdata buffer isn't large enough to hold all the uncompressed data,
  * jffs2_compress should compress as much as will fit, and should set
  * *datalen accordingly to show the amount of data which were compressed.
+ *
+ * In adaptive mode all compressors are only run on every
+ * JFFS2_ADAPTIVE_PROBE_INTERVAL'th node of an inode; the nodes in between
+ * go to the compressor that probe chose, or are stored uncompressed if
+ * none of them could shrink the data. The caller holds f->sem.
  */
 uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			unsigned char *data_in, unsigned char **cpage_out,
 			uint32_t *datalen, uint32_t *cdatalen)
 {
 	int ret = JFFS2_COMPR_NONE;
+	int mode = jffs2_compr_mode(c);
 	int compr_ret;
 	struct jffs2_compressor *this, *best=NULL;
 	unsigned char *output_buf = NULL, *tmp_buf;
 	uint32_t orig_slen, orig_dlen;
 	uint32_t best_slen=0, best_dlen=0;
+	ktime_t start;
 
-	switch (jffs2_compression_mode) {
+	switch (mode) {
 	case JFFS2_COMPR_MODE_NONE:
 		break;
 	case JFFS2_COMPR_MODE_PRIORITY:
@@ -117,12 +242,26 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 		if (ret == JFFS2_COMPR_NONE)
 			kfree(output_buf);
 		break;
+	case JFFS2_COMPR_MODE_ADAPTIVE:
+		if (f->compr_probe) {
+			f->compr_probe--;
+			if (f->compr_pref == JFFS2_COMPR_NONE)
+				break;
+			ret = jffs2_compress_preferred(f, data_in, &output_buf,
+						       datalen, cdatalen);
+			if (ret != JFFS2_COMPR_NONE)
+				break;
+			/* The data no longer suits it, probe again now */
+			f->compr_probe = 0;
+		}
+		/* fall through */
 	case JFFS2_COMPR_MODE_SIZE:
 	case JFFS2_COMPR_MODE_FAVOURLZO:
 		orig_slen = *datalen;
 		orig_dlen = *cdatalen;
 		spin_lock(&jffs2_compressor_list_lock);
 		list_for_each_entry(this, &jffs2_compressor_list, list) {
+			this->probe_dlen = 0;
 			/* Skip decompress-only backwards-compatibility and disabled modules */
 			if ((!this->compress)||(this->disabled))
 				continue;
@@ -151,18 +290,31 @@ uint16_t jffs2_compress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			spin_unlock(&jffs2_compressor_list_lock);
 			*datalen  = orig_slen;
 			*cdatalen = orig_dlen;
+			start = ktime_get();
 			compr_ret = this->compress(data_in, this->compr_buf, datalen, cdatalen, NULL);
 			spin_lock(&jffs2_compressor_list_lock);
 			this->usecount--;
-			if (!compr_ret) {
-				if (((!best_dlen) || jffs2_is_best_compression(this, best, *cdatalen, best_dlen))
-						&& (*cdatalen < *datalen)) {
+			if (mode == JFFS2_COMPR_MODE_ADAPTIVE) {
+				this->probe_time = ktime_to_ns(ktime_sub(ktime_get(), start));
+				this->stat_compr_time += this->probe_time;
+			}
+			if (!compr_ret && (*cdatalen < *datalen)) {
+				this->probe_slen = *datalen;
+				this->probe_dlen = *cdatalen;
+				if ((!best_dlen) || jffs2_is_best_compression(mode, this, best, *cdatalen, best_dlen)) {
 					best_dlen = *cdatalen;
 					best_slen = *datalen;
 					best = this;
 				}
 			}
 		}
+		if (mode == JFFS2_COMPR_MODE_ADAPTIVE) {
+			best = jffs2_adaptive_pick(f, best, best_dlen);
+			if (best) {
+				best_dlen = best->probe_dlen;
+				best_slen = best->probe_slen;
+			}
+		}
 		if (best_dlen) {
 			*cdatalen = best_dlen;
 			*datalen  = best_slen;
@@ -254,6 +406,9 @@ int jffs2_register_compressor(struct jffs2_compressor *comp)
 	comp->stat_compr_new_size=0;
 	comp->stat_compr_blocks=0;
 	comp->stat_decompr_blocks=0;
+	comp->stat_compr_time=0;
+	comp->stat_adapt_picks=0;
+	comp->probe_dlen=0;
 	D1(printk(KERN_DEBUG "Registering JFFS2 compressor \"%s\"\n", comp->name));
 
 	spin_lock(&jffs2_compressor_list_lock);
@@ -303,6 +458,50 @@ void jffs2_free_comprbuf(unsigned char *comprbuf, unsigned char *orig)
 		kfree(comprbuf);
 }
 
+#ifdef CONFIG_PROC_FS
+static int jffs2_compr_read_proc(char *page, char **start, off_t off,
+				 int count, int *eof, void *data)
+{
+	struct jffs2_compressor *this;
+	unsigned long long usecs;
+	int len;
+
+	len = sprintf(page, "default mode: %s\n",
+		      jffs2_compr_mode_name(jffs2_compression_mode));
+	len += sprintf(page + len, "%-10s compr: %u blocks (%u) decompr: %u blocks"
+		       " adaptive: %u picks\n", "none", none_stat_compr_blocks,
+		       none_stat_compr_size, none_stat_decompr_blocks,
+		       none_stat_adapt_picks);
+
+	spin_lock(&jffs2_compressor_list_lock);
+	list_for_each_entry(this, &jffs2_compressor_list, list) {
+		usecs = this->stat_compr_time;
+		do_div(usecs, 1000);
+		len += sprintf(page + len, "%-10s compr: %u blocks (%u/%u) decompr: %u blocks"
+			       " adaptive: %u picks %llu us%s\n", this->name,
+			       this->stat_compr_blocks, this->stat_compr_new_size,
+			       this->stat_compr_orig_size, this->stat_decompr_blocks,
+			       this->stat_adapt_picks,
+			       usecs,
+			       this->disabled ? " (disabled)" : "");
+	}
+	spin_unlock(&jffs2_compressor_list_lock);
+	len += sprintf(page + len, "adaptive probes: %u\n", adapt_stat_probes);
+
+	if (off >= len) {
+		*eof = 1;
+		return 0;
+	}
+	*start = page + off;
+	len -= off;
+	if (len > count)
+		len = count;
+	else
+		*eof = 1;
+	return len;
+}
+#endif
+
 int __init jffs2_compressors_init(void)
 {
 /* Registering compressors */
@@ -331,16 +530,30 @@ int __init jffs2_compressors_init(void)
 #ifdef CONFIG_JFFS2_CMODE_FAVOURLZO
 	jffs2_compression_mode = JFFS2_COMPR_MODE_FAVOURLZO;
 	D1(printk(KERN_INFO "JFFS2: default compression mode: favourlzo\n");)
+#else
+#ifdef CONFIG_JFFS2_CMODE_ADAPTIVE
+	jffs2_compression_mode = JFFS2_COMPR_MODE_ADAPTIVE;
+	D1(printk(KERN_INFO "JFFS2: default compression mode: adaptive\n");)
 #else
 	D1(printk(KERN_INFO "JFFS2: default compression mode: priority\n");)
 #endif
 #endif
+#endif
+#endif
+#ifdef CONFIG_PROC_FS
+	if (proc_mkdir("fs/jffs2", NULL))
+		create_proc_read_entry("fs/jffs2/compr", 0, NULL,
+				       jffs2_compr_read_proc, NULL);
 #endif
 	return 0;
 }
 
 int jffs2_compressors_exit(void)
 {
+#ifdef CONFIG_PROC_FS
+	remove_proc_entry("fs/jffs2/compr", NULL);
+	remove_proc_entry("fs/jffs2", NULL);
+#endif
 /* Unregistering compressors */
 #ifdef CONFIG_JFFS2_LZO
 	jffs2_lzo_exit();
@@ -39,9 +39,17 @@
 #define JFFS2_COMPR_MODE_PRIORITY   1
 #define JFFS2_COMPR_MODE_SIZE       2
 #define JFFS2_COMPR_MODE_FAVOURLZO  3
+#define JFFS2_COMPR_MODE_ADAPTIVE   4
 
 #define FAVOUR_LZO_PERCENT 80
 
+/* Adaptive mode: nodes written with an inode's preferred compressor
+   before all of them are probed again */
+#define JFFS2_ADAPTIVE_PROBE_INTERVAL 32
+/* Adaptive mode: a compressor whose output is at most this many percent
+   larger than the smallest one is chosen if it was faster */
+#define JFFS2_ADAPTIVE_SLACK_PERCENT 10
+
 struct jffs2_compressor {
 	struct list_head list;
 	int priority;			/* used by prirority comr. mode */
@@ -59,6 +67,11 @@ struct jffs2_compressor {
 	uint32_t stat_compr_new_size;
 	uint32_t stat_compr_blocks;
 	uint32_t stat_decompr_blocks;
+	uint64_t stat_compr_time;	/* ns, measured in adaptive mode */
+	uint32_t stat_adapt_picks;	/* inodes which preferred it */
+	uint32_t probe_slen;		/* used by adaptive compr. mode */
+	uint32_t probe_dlen;
+	uint32_t probe_time;
 };
 
 int jffs2_register_compressor(struct jffs2_compressor *comp);
@@ -77,6 +90,9 @@ int jffs2_decompress(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 
 void jffs2_free_comprbuf(unsigned char *comprbuf, unsigned char *orig);
 
+int jffs2_compr_mode_parse(const char *name);
+const char *jffs2_compr_mode_name(int mode);
+
 /* Compressor modules */
 /* These functions will be called by jffs2_compressors_init/exit */
 
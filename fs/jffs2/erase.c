@@ -31,7 +31,7 @@ static void jffs2_erase_succeeded(struct jffs2_sb_info *c, struct jffs2_eraseblo
 static void jffs2_mark_erased_block(struct jffs2_sb_info *c, struct jffs2_eraseblock *jeb);
 
 static void jffs2_erase_block(struct jffs2_sb_info *c,
-			      struct jffs2_eraseblock *jeb)
+			      struct jffs2_eraseblock *jeb, int async)
 {
 	int ret;
 	uint32_t bad_offset;
@@ -73,7 +73,10 @@ static void jffs2_erase_block(struct jffs2_sb_info *c,
 	((struct erase_priv_struct *)instr->priv)->jeb = jeb;
 	((struct erase_priv_struct *)instr->priv)->c = c;
 
-	ret = c->mtd->erase(c->mtd, instr);
+	if (async)
+		ret = mtd_erase_async(c->mtd, instr);
+	else
+		ret = c->mtd->erase(c->mtd, instr);
 	if (!ret)
 		return;
 
@@ -103,14 +106,24 @@ static void jffs2_erase_block(struct jffs2_sb_info *c,
 	jffs2_erase_failed(c, jeb, bad_offset);
 }
 
+/*
+ * With a zero count we are called from the background (write_super) to
+ * get rid of everything pending, so the erases are queued and we don't
+ * wait for them: the erased blocks pile up on erase_complete_list, ready
+ * for the next writer. A non-zero count means somebody needs free blocks
+ * now; erase synchronously, and if everything is already being erased in
+ * the background, wait for that instead of making the caller spin.
+ */
 void jffs2_erase_pending_blocks(struct jffs2_sb_info *c, int count)
 {
 	struct jffs2_eraseblock *jeb;
+	int waited = 0;
 
 	mutex_lock(&c->erase_free_sem);
 
 	spin_lock(&c->erase_completion_lock);
 
+ again:
 	while (!list_empty(&c->erase_complete_list) ||
 	       !list_empty(&c->erase_pending_list)) {
 
@@ -141,7 +154,7 @@ void jffs2_erase_pending_blocks(struct jffs2_sb_info *c, int count)
 			spin_unlock(&c->erase_completion_lock);
 			mutex_unlock(&c->erase_free_sem);
 
-			jffs2_erase_block(c, jeb);
+			jffs2_erase_block(c, jeb, !count);
 
 		} else {
 			BUG();
@@ -153,6 +166,17 @@ void jffs2_erase_pending_blocks(struct jffs2_sb_info *c, int count)
 		spin_lock(&c->erase_completion_lock);
 	}
 
+	if (count && !waited && !list_empty(&c->erasing_list)) {
+		spin_unlock(&c->erase_completion_lock);
+		mutex_unlock(&c->erase_free_sem);
+		D1(printk(KERN_DEBUG "jffs2_erase_pending_blocks waiting for background erases\n"));
+		mtd_erase_flush(c->mtd);
+		waited = 1;
+		mutex_lock(&c->erase_free_sem);
+		spin_lock(&c->erase_completion_lock);
+		goto again;
+	}
+
 	spin_unlock(&c->erase_completion_lock);
 	mutex_unlock(&c->erase_free_sem);
  done:
@@ -155,6 +155,12 @@ static int jffs2_write_begin(struct file *filp, struct address_space *mapping,
 			goto out_page;
 
 		mutex_lock(&f->sem);
+		ret = jffs2_fragtree_ensure(c, f);
+		if (ret) {
+			jffs2_complete_reservation(c);
+			mutex_unlock(&f->sem);
+			goto out_page;
+		}
 		memset(&ri, 0, sizeof(ri));
 
 		ri.magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
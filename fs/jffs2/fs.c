@@ -24,6 +24,123 @@
 
 static int jffs2_flash_setup(struct jffs2_sb_info *c);
 
+/*
+ * The fragtree of a big file costs a frag and a full_dnode per node, which
+ * adds up to a lot of memory for files of many MiB. Regular files whose
+ * tree is in core are kept on jffs2_frag_lru, least recently used first,
+ * and the shrinker below drops their trees under memory pressure. The
+ * tree is rebuilt from the inode's node list by jffs2_fragtree_ensure()
+ * the next time it is needed.
+ */
+static LIST_HEAD(jffs2_frag_lru);
+static DEFINE_SPINLOCK(jffs2_frag_lru_lock);
+static int jffs2_frag_lru_nr;
+
+static void jffs2_frag_lru_add(struct jffs2_inode_info *f)
+{
+	spin_lock(&jffs2_frag_lru_lock);
+	if (list_empty(&f->frag_lru)) {
+		list_add_tail(&f->frag_lru, &jffs2_frag_lru);
+		jffs2_frag_lru_nr++;
+	}
+	spin_unlock(&jffs2_frag_lru_lock);
+}
+
+static void jffs2_frag_lru_del(struct jffs2_inode_info *f)
+{
+	spin_lock(&jffs2_frag_lru_lock);
+	if (!list_empty(&f->frag_lru)) {
+		list_del_init(&f->frag_lru);
+		jffs2_frag_lru_nr--;
+	}
+	spin_unlock(&jffs2_frag_lru_lock);
+}
+
+/* Make sure the fragtree is in core. Called with f->sem held. */
+int jffs2_fragtree_ensure(struct jffs2_sb_info *c, struct jffs2_inode_info *f)
+{
+	int ret;
+
+	if (unlikely(f->fragtree_dropped)) {
+		ret = jffs2_do_rebuild_fragtree(c, f, OFNI_EDONI_2SFFJ(f)->i_size);
+		if (ret)
+			return ret;
+		f->fragtree_dropped = 0;
+		jffs2_frag_lru_add(f);
+		return 0;
+	}
+
+	spin_lock(&jffs2_frag_lru_lock);
+	if (!list_empty(&f->frag_lru))
+		list_move_tail(&f->frag_lru, &jffs2_frag_lru);
+	spin_unlock(&jffs2_frag_lru_lock);
+	return 0;
+}
+
+static void jffs2_drop_fragtree(struct jffs2_inode_info *f)
+{
+	jffs2_kill_fragtree(&f->fragtree, NULL);
+	if (f->metadata) {
+		jffs2_free_full_dnode(f->metadata);
+		f->metadata = NULL;
+	}
+	f->fragtree_dropped = 1;
+	jffs2_frag_lru_del(f);
+}
+
+/*
+ * Only files which nobody is writing to are considered. Taking alloc_sem
+ * keeps the GC and write buffer recovery, which both look at the tree,
+ * away while it is dropped.
+ */
+static void jffs2_prune_fragtrees(int nr)
+{
+	struct jffs2_inode_info *f;
+	struct jffs2_sb_info *c;
+	struct inode *inode;
+
+	spin_lock(&jffs2_frag_lru_lock);
+	while (nr-- > 0 && !list_empty(&jffs2_frag_lru)) {
+		f = list_entry(jffs2_frag_lru.next, struct jffs2_inode_info,
+			       frag_lru);
+		list_move_tail(&f->frag_lru, &jffs2_frag_lru);
+		inode = igrab(OFNI_EDONI_2SFFJ(f));
+		if (!inode)
+			continue;
+		spin_unlock(&jffs2_frag_lru_lock);
+
+		c = JFFS2_SB_INFO(inode->i_sb);
+		if (inode->i_nlink && !atomic_read(&inode->i_writecount) &&
+		    mutex_trylock(&c->alloc_sem)) {
+			if (mutex_trylock(&f->sem)) {
+				if (!f->fragtree_dropped)
+					jffs2_drop_fragtree(f);
+				mutex_unlock(&f->sem);
+			}
+			mutex_unlock(&c->alloc_sem);
+		}
+		iput(inode);
+
+		spin_lock(&jffs2_frag_lru_lock);
+	}
+	spin_unlock(&jffs2_frag_lru_lock);
+}
+
+static int jffs2_shrink_fragtrees(int nr_to_scan, gfp_t gfp_mask)
+{
+	if (nr_to_scan) {
+		if (!(gfp_mask & __GFP_FS))
+			return -1;
+		jffs2_prune_fragtrees(nr_to_scan);
+	}
+	return jffs2_frag_lru_nr;
+}
+
+struct shrinker jffs2_fragtree_shrinker = {
+	.shrink = jffs2_shrink_fragtrees,
+	.seeks = DEFAULT_SEEKS,
+};
+
 int jffs2_do_setattr (struct inode *inode, struct iattr *iattr)
 {
 	struct jffs2_full_dnode *old_metadata, *new_metadata;
@@ -84,6 +201,15 @@ int jffs2_do_setattr (struct inode *inode, struct iattr *iattr)
 		return ret;
 	}
 	mutex_lock(&f->sem);
+	ret = jffs2_fragtree_ensure(c, f);
+	if (ret) {
+		mutex_unlock(&f->sem);
+		jffs2_complete_reservation(c);
+		jffs2_free_raw_inode(ri);
+		if (S_ISLNK(inode->i_mode))
+			kfree(mdata);
+		return ret;
+	}
 	ivalid = iattr->ia_valid;
 
 	ri->magic = cpu_to_je16(JFFS2_MAGIC_BITMASK);
@@ -231,6 +357,15 @@ void jffs2_clear_inode (struct inode *inode)
 	struct jffs2_inode_info *f = JFFS2_INODE_INFO(inode);
 
 	D1(printk(KERN_DEBUG "jffs2_clear_inode(): ino #%lu mode %o\n", inode->i_ino, inode->i_mode));
+	jffs2_frag_lru_del(f);
+
+	/* The nodes of a deleted file are obsoleted through its fragtree */
+	if (f->fragtree_dropped && f->inocache && !f->inocache->pino_nlink) {
+		mutex_lock(&f->sem);
+		jffs2_fragtree_ensure(c, f);
+		mutex_unlock(&f->sem);
+		jffs2_frag_lru_del(f);
+	}
 	jffs2_do_clear_inode(c, f);
 }
 
@@ -305,6 +440,7 @@ struct inode *jffs2_iget(struct super_block *sb, unsigned long ino)
 		inode->i_fop = &jffs2_file_operations;
 		inode->i_mapping->a_ops = &jffs2_file_address_operations;
 		inode->i_mapping->nrpages = 0;
+		jffs2_frag_lru_add(f);
 		break;
 
 	case S_IFBLK:
@@ -377,16 +513,22 @@ void jffs2_dirty_inode(struct inode *inode)
 int jffs2_remount_fs (struct super_block *sb, int *flags, char *data)
 {
 	struct jffs2_sb_info *c = JFFS2_SB_INFO(sb);
+	int ret;
 
 	if (c->flags & JFFS2_SB_FLAG_RO && !(sb->s_flags & MS_RDONLY))
 		return -EROFS;
 
+	ret = jffs2_parse_options(c, data);
+	if (ret)
+		return ret;
+
 	/* We stop if it was running, then restart if it needs to.
 	   This also catches the case where it was stopped and this
 	   is just a remount to restart it.
 	   Flush the writebuffer, if neccecary, else we loose it */
 	if (!(sb->s_flags & MS_RDONLY)) {
 		jffs2_stop_garbage_collect_thread(c);
+		mtd_erase_flush(c->mtd);
 		mutex_lock(&c->alloc_sem);
 		jffs2_flush_wbuf_pad(c);
 		mutex_unlock(&c->alloc_sem);
@@ -475,6 +617,9 @@ struct inode *jffs2_new_inode (struct inode *dir_i, int mode, struct jffs2_raw_i
 	inode->i_blocks = 0;
 	inode->i_size = 0;
 
+	if (S_ISREG(inode->i_mode))
+		jffs2_frag_lru_add(f);
+
 	insert_inode_hash(inode);
 
 	return inode;
@@ -453,6 +453,10 @@ static int jffs2_garbage_collect_live(struct jffs2_sb_info *c,  struct jffs2_era
 
 	mutex_lock(&f->sem);
 
+	ret = jffs2_fragtree_ensure(c, f);
+	if (ret)
+		goto upnout;
+
 	/* Now we have the lock for this inode. Check that it's still the one at the head
 	   of the list. */
 
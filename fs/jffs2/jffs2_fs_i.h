@@ -14,6 +14,7 @@
 
 #include <linux/version.h>
 #include <linux/rbtree.h>
+#include <linux/list.h>
 #include <linux/posix_acl.h>
 #include <linux/mutex.h>
 
@@ -50,6 +51,18 @@ struct jffs2_inode_info {
 
 	uint16_t flags;
 	uint8_t usercompr;
+
+	/* Adaptive compression mode: the compressor the last probe chose
+	   and the number of nodes left before the next probe */
+	uint8_t compr_pref;
+	uint8_t compr_probe;
+
+	/* The fragtree of a regular file may be dropped under memory
+	   pressure and is rebuilt on the next access. frag_lru links the
+	   files whose tree is in core; see jffs2_fragtree_ensure() */
+	uint8_t fragtree_dropped;
+	struct list_head frag_lru;
+
 	struct inode vfs_inode;
 #ifdef CONFIG_JFFS2_FS_POSIX_ACL
 	struct posix_acl *i_acl_access;
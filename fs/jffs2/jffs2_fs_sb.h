@@ -32,6 +32,13 @@ struct jffs2_inodirty;
    jffs2_sb_info structs are named `c' in the source code.
    Nee jffs_control
 */
+struct jffs2_mount_opts {
+	/* Compression mode given by the compr= mount option, overriding
+	   the default one */
+	unsigned int override_compr:1;
+	unsigned int compr;
+};
+
 struct jffs2_sb_info {
 	struct mtd_info *mtd;
 
@@ -40,6 +47,8 @@ struct jffs2_sb_info {
 
 	unsigned int flags;
 
+	struct jffs2_mount_opts mount_opts;
+
 	struct task_struct *gc_task;	/* GC task struct */
 	struct completion gc_thread_start; /* GC thread start completion */
 	struct completion gc_thread_exit; /* GC thread exit completion port */
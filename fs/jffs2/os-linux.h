@@ -56,6 +56,10 @@ static inline void jffs2_init_inode_info(struct jffs2_inode_info *f)
 	f->target = NULL;
 	f->flags = 0;
 	f->usercompr = 0;
+	f->compr_pref = 0;
+	f->compr_probe = 0;
+	f->fragtree_dropped = 0;
+	INIT_LIST_HEAD(&f->frag_lru);
 #ifdef CONFIG_JFFS2_FS_POSIX_ACL
 	f->i_acl_access = JFFS2_ACL_NOT_CACHED;
 	f->i_acl_default = JFFS2_ACL_NOT_CACHED;
@@ -177,6 +181,8 @@ int jffs2_setattr (struct dentry *, struct iattr *);
 int jffs2_do_setattr (struct inode *, struct iattr *);
 struct inode *jffs2_iget(struct super_block *, unsigned long);
 void jffs2_clear_inode (struct inode *);
+int jffs2_fragtree_ensure(struct jffs2_sb_info *c, struct jffs2_inode_info *f);
+extern struct shrinker jffs2_fragtree_shrinker;
 void jffs2_dirty_inode(struct inode *inode);
 struct inode *jffs2_new_inode (struct inode *dir_i, int mode,
 			       struct jffs2_raw_inode *ri);
@@ -184,6 +190,7 @@ int jffs2_statfs (struct dentry *, struct kstatfs *);
 void jffs2_write_super (struct super_block *);
 int jffs2_remount_fs (struct super_block *, int *, char *);
 int jffs2_do_fill_super(struct super_block *sb, void *data, int silent);
+int jffs2_parse_options(struct jffs2_sb_info *c, char *data);
 void jffs2_gc_release_inode(struct jffs2_sb_info *c,
 			    struct jffs2_inode_info *f);
 struct jffs2_inode_info *jffs2_gc_fetch_inode(struct jffs2_sb_info *c,
@@ -160,6 +160,10 @@ int jffs2_read_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	D1(printk(KERN_DEBUG "jffs2_read_inode_range: ino #%u, range 0x%08x-0x%08x\n",
 		  f->inocache->ino, offset, offset+len));
 
+	ret = jffs2_fragtree_ensure(c, f);
+	if (ret)
+		return ret;
+
 	frag = jffs2_lookup_node_frag(&f->fragtree, offset);
 
 	/* XXX FIXME: Where a single physical node actually shows up in two
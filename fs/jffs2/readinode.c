@@ -1373,6 +1373,70 @@ int jffs2_do_read_inode(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 	return jffs2_do_read_inode_internal(c, f, latest_node);
 }
 
+/*
+ * Rebuild the fragtree of a regular file after it was dropped to save
+ * memory. Unlike jffs2_do_read_inode_internal() the inode itself is
+ * already known, so the latest node is not read again and the tree is
+ * simply truncated to the in-core size. Called with f->sem held.
+ */
+int jffs2_do_rebuild_fragtree(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
+			      uint32_t isize)
+{
+	struct jffs2_readinode_info rii;
+	uint32_t highest_version = f->highest_version;
+	int ret;
+
+	dbg_readinode("rebuilding fragtree of ino #%u\n", f->inocache->ino);
+
+	/* Anything which was added while the tree was dropped is on the
+	   flash as well, so just start from scratch */
+	jffs2_kill_fragtree(&f->fragtree, NULL);
+	if (f->metadata) {
+		jffs2_free_full_dnode(f->metadata);
+		f->metadata = NULL;
+	}
+
+	memset(&rii, 0, sizeof(rii));
+
+	ret = jffs2_get_inode_nodes(c, f, &rii);
+	if (ret) {
+		JFFS2_ERROR("cannot read nodes for ino %u, returned error is %d\n", f->inocache->ino, ret);
+		return ret;
+	}
+
+	/* Versions already handed out must never be reused */
+	if (f->highest_version < highest_version)
+		f->highest_version = highest_version;
+
+	ret = jffs2_build_inode_fragtree(c, f, &rii);
+	if (ret) {
+		JFFS2_ERROR("Failed to rebuild fragtree for inode #%u: error %d\n",
+			    f->inocache->ino, ret);
+		jffs2_free_tmp_dnode_info_list(&rii.tn_root);
+		if (rii.mdata_tn) {
+			jffs2_free_full_dnode(rii.mdata_tn->fn);
+			jffs2_free_tmp_dnode_info(rii.mdata_tn);
+		}
+		jffs2_free_full_dirent_list(rii.fds);
+		return ret;
+	}
+
+	if (rii.mdata_tn) {
+		if (rii.mdata_tn->fn->raw == rii.latest_ref) {
+			f->metadata = rii.mdata_tn->fn;
+			jffs2_free_tmp_dnode_info(rii.mdata_tn);
+		} else {
+			jffs2_kill_tn(c, rii.mdata_tn);
+		}
+	}
+	/* Regular files have no dirents, but don't leak them if they do */
+	jffs2_free_full_dirent_list(rii.fds);
+
+	jffs2_truncate_fragtree(c, &f->fragtree, isize);
+	jffs2_dbg_fragtree_paranoia_check_nolock(f);
+	return 0;
+}
+
 int jffs2_do_crccheck_inode(struct jffs2_sb_info *c, struct jffs2_inode_cache *ic)
 {
 	struct jffs2_raw_inode n;
@@ -449,26 +449,15 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 	D1(printk(KERN_DEBUG "jffs2_scan_eraseblock(): Scanning block at 0x%x\n", ofs));
 
 #ifdef CONFIG_JFFS2_FS_WRITEBUFFER
-	if (jffs2_cleanmarker_oob(c)) {
-		int ret;
-
-		if (c->mtd->block_isbad(c->mtd, jeb->offset))
-			return BLK_STATE_BADBLOCK;
-
-		ret = jffs2_check_nand_cleanmarker(c, jeb);
-		D2(printk(KERN_NOTICE "jffs_check_nand_cleanmarker returned %d\n",ret));
-
-		/* Even if it's not found, we still scan to see
-		   if the block is empty. We use this information
-		   to decide whether to erase it or not. */
-		switch (ret) {
-		case 0:		cleanmarkerfound = 1; break;
-		case 1: 	break;
-		default: 	return ret;
-		}
-	}
+	if (jffs2_cleanmarker_oob(c) &&
+	    c->mtd->block_isbad(c->mtd, jeb->offset))
+		return BLK_STATE_BADBLOCK;
 #endif
 
+	/* Look for the summary before the OOB cleanmarker: a block with a
+	   good summary is classified without it, which saves a NAND read
+	   per block at mount time. NAND summaries never record a
+	   cleanmarker, since it lives in the OOB area. */
 	if (jffs2_sum_active()) {
 		struct jffs2_sum_marker *sm;
 		void *sumptr = NULL;
@@ -534,6 +523,24 @@ static int jffs2_scan_eraseblock (struct jffs2_sb_info *c, struct jffs2_eraseblo
 		}
 	}
 
+#ifdef CONFIG_JFFS2_FS_WRITEBUFFER
+	if (jffs2_cleanmarker_oob(c)) {
+		int ret;
+
+		ret = jffs2_check_nand_cleanmarker(c, jeb);
+		D2(printk(KERN_NOTICE "jffs_check_nand_cleanmarker returned %d\n",ret));
+
+		/* Even if it's not found, we still scan to see
+		   if the block is empty. We use this information
+		   to decide whether to erase it or not. */
+		switch (ret) {
+		case 0:		cleanmarkerfound = 1; break;
+		case 1: 	break;
+		default: 	return ret;
+		}
+	}
+#endif
+
 	buf_ofs = jeb->offset;
 
 	if (!buf_size) {
@@ -22,6 +22,8 @@
 #include <linux/mtd/super.h>
 #include <linux/ctype.h>
 #include <linux/namei.h>
+#include <linux/parser.h>
+#include <linux/seq_file.h>
 #include "compr.h"
 #include "nodelist.h"
 
@@ -62,6 +64,63 @@ static int jffs2_sync_fs(struct super_block *sb, int wait)
 	return 0;
 }
 
+static int jffs2_show_options(struct seq_file *s, struct vfsmount *mnt)
+{
+	struct jffs2_sb_info *c = JFFS2_SB_INFO(mnt->mnt_sb);
+
+	if (c->mount_opts.override_compr)
+		seq_printf(s, ",compr=%s",
+			   jffs2_compr_mode_name(c->mount_opts.compr));
+	return 0;
+}
+
+enum {
+	Opt_compr,
+	Opt_err,
+};
+
+static match_table_t tokens = {
+	{Opt_compr, "compr=%s"},
+	{Opt_err, NULL},
+};
+
+int jffs2_parse_options(struct jffs2_sb_info *c, char *data)
+{
+	substring_t args[MAX_OPT_ARGS];
+	char *p, *name;
+	int mode;
+
+	if (!data)
+		return 0;
+
+	while ((p = strsep(&data, ","))) {
+		if (!*p)
+			continue;
+
+		switch (match_token(p, tokens, args)) {
+		case Opt_compr:
+			name = match_strdup(&args[0]);
+			if (!name)
+				return -ENOMEM;
+			mode = jffs2_compr_mode_parse(name);
+			kfree(name);
+			if (mode < 0) {
+				printk(KERN_ERR "JFFS2: unknown compression mode \"%s\"\n",
+				       args[0].from);
+				return -EINVAL;
+			}
+			c->mount_opts.compr = mode;
+			c->mount_opts.override_compr = 1;
+			break;
+		default:
+			printk(KERN_WARNING "JFFS2: ignoring unrecognized mount option \"%s\"\n",
+			       p);
+			break;
+		}
+	}
+	return 0;
+}
+
 static const struct super_operations jffs2_super_operations =
 {
 	.alloc_inode =	jffs2_alloc_inode,
@@ -73,6 +132,7 @@ static const struct super_operations jffs2_super_operations =
 	.clear_inode =	jffs2_clear_inode,
 	.dirty_inode =	jffs2_dirty_inode,
 	.sync_fs =	jffs2_sync_fs,
+	.show_options =	jffs2_show_options,
 };
 
 /*
@@ -81,6 +141,7 @@ static const struct super_operations jffs2_super_operations =
 static int jffs2_fill_super(struct super_block *sb, void *data, int silent)
 {
 	struct jffs2_sb_info *c;
+	int ret;
 
 	D1(printk(KERN_DEBUG "jffs2_get_sb_mtd():"
 		  " New superblock for device %d (\"%s\")\n",
@@ -103,6 +164,11 @@ static int jffs2_fill_super(struct super_block *sb, void *data, int silent)
 	spin_lock_init(&c->erase_completion_lock);
 	spin_lock_init(&c->inocache_lock);
 
+	/* On failure, jffs2_kill_sb() frees c */
+	ret = jffs2_parse_options(c, data);
+	if (ret)
+		return ret;
+
 	sb->s_op = &jffs2_super_operations;
 	sb->s_flags = sb->s_flags | MS_NOATIME;
 	sb->s_xattr = jffs2_xattr_handlers;
@@ -126,6 +192,9 @@ static void jffs2_put_super (struct super_block *sb)
 
 	D2(printk(KERN_DEBUG "jffs2: jffs2_put_super()\n"));
 
+	/* Erase callbacks still refer to c->blocks */
+	mtd_erase_flush(c->mtd);
+
 	mutex_lock(&c->alloc_sem);
 	jffs2_flush_wbuf_pad(c);
 	mutex_unlock(&c->alloc_sem);
@@ -212,6 +281,7 @@ static int __init init_jffs2_fs(void)
 		printk(KERN_ERR "JFFS2 error: Failed to register filesystem\n");
 		goto out_slab;
 	}
+	register_shrinker(&jffs2_fragtree_shrinker);
 	return 0;
 
  out_slab:
@@ -225,6 +295,7 @@ static int __init init_jffs2_fs(void)
 
 static void __exit exit_jffs2_fs(void)
 {
+	unregister_shrinker(&jffs2_fragtree_shrinker);
 	unregister_filesystem(&jffs2_fs_type);
 	jffs2_destroy_slab_caches();
 	jffs2_compressors_exit();
@@ -355,6 +355,12 @@ int jffs2_write_inode_range(struct jffs2_sb_info *c, struct jffs2_inode_info *f,
 			break;
 		}
 		mutex_lock(&f->sem);
+		ret = jffs2_fragtree_ensure(c, f);
+		if (ret) {
+			mutex_unlock(&f->sem);
+			jffs2_complete_reservation(c);
+			break;
+		}
 		datalen = min_t(uint32_t, writelen, PAGE_CACHE_SIZE - (offset & (PAGE_CACHE_SIZE-1)));
 		cdatalen = min_t(uint32_t, alloclen - sizeof(*ri), datalen);
 
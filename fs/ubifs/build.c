@@ -461,6 +461,33 @@ static int check_volume_empty(struct ubifs_info *c)
 	return 0;
 }
 
+/**
+ * ubifs_bu_init - initialize bulk-read information.
+ * @c: UBIFS file-system description object
+ *
+ * This function allocates the bulk-read buffer. If that fails, bulk-read is
+ * switched off.
+ */
+void ubifs_bu_init(struct ubifs_info *c)
+{
+	ubifs_assert(c->bulk_read == 1);
+
+	if (c->bu.buf)
+		return; /* Already initialized */
+
+	c->max_bu_buf_len = UBIFS_MAX_BULK_READ * UBIFS_MAX_DATA_NODE_SZ;
+	if (c->max_bu_buf_len > c->leb_size)
+		c->max_bu_buf_len = c->leb_size;
+
+	c->bu.buf = vmalloc(c->max_bu_buf_len);
+	if (!c->bu.buf) {
+		ubifs_warn("cannot allocate %d bytes of memory for bulk-read, "
+			   "disabling it", c->max_bu_buf_len);
+		c->mount_opts.bulk_read = 1;
+		c->bulk_read = 0;
+	}
+}
+
 /**
  * mount_ubifs - mount UBIFS file-system.
  * @c: UBIFS file-system description object
@@ -552,6 +579,9 @@ static int mount_ubifs(struct ubifs_info *c)
 	if (!c->cbuf)
 		return -ENOMEM;
 
+	if (c->bulk_read == 1)
+		ubifs_bu_init(c);
+
 	if (!mounted_read_only) {
 		err = alloc_wbufs(c);
 		if (err)
@@ -679,6 +709,7 @@ static int mount_ubifs(struct ubifs_info *c)
 
 	dbg_msg("compiled on:            " __DATE__ " at " __TIME__);
 	dbg_msg("fast unmount:           %d", c->fast_unmount);
+	dbg_msg("bulk read:              %d", c->bulk_read);
 	dbg_msg("big_lpt                 %d", c->big_lpt);
 	dbg_msg("log LEBs:               %d (%d - %d)",
 		c->log_lebs, UBIFS_LOG_LNUM, c->log_last);
@@ -761,6 +792,7 @@ void ubifs_umount(struct ubifs_info *c)
 	kfree(c->rcvrd_mst_node);
 	kfree(c->mst_node);
 	vfree(c->sbuf);
+	vfree(c->bu.buf);
 	kfree(c->bottom_up_buf);
 	UBIFS_DBG(vfree(c->dbg_buf));
 	vfree(c->ileb_buf);
@@ -1053,17 +1085,23 @@ static int sb_set(struct super_block *sb, void *data)
  *
  * Opt_fast_unmount: do not run a journal commit before un-mounting
  * Opt_norm_unmount: run a journal commit before un-mounting
+ * Opt_bulk_read: enable bulk-reads
+ * Opt_no_bulk_read: disable bulk-reads
  * Opt_err: just end of array marker
  */
 enum {
 	Opt_fast_unmount,
 	Opt_norm_unmount,
+	Opt_bulk_read,
+	Opt_no_bulk_read,
 	Opt_err,
 };
 
 static match_table_t tokens = {
 	{Opt_fast_unmount, "fast_unmount"},
 	{Opt_norm_unmount, "norm_unmount"},
+	{Opt_bulk_read, "bulk_read"},
+	{Opt_no_bulk_read, "no_bulk_read"},
 	{Opt_err, NULL},
 };
 
@@ -1100,6 +1138,14 @@ int ubifs_parse_options(struct ubifs_info *c, char *options, int is_remount)
 			c->mount_opts.unmount_mode = 1;
 			c->fast_unmount = 0;
 			break;
+		case Opt_bulk_read:
+			c->mount_opts.bulk_read = 2;
+			c->bulk_read = 1;
+			break;
+		case Opt_no_bulk_read:
+			c->mount_opts.bulk_read = 1;
+			c->bulk_read = 0;
+			break;
 		default:
 			ubifs_err("unrecognized mount option \"%s\" "
 				  "or missing value", p);
@@ -1135,6 +1181,7 @@ static int ubifs_get_sb(struct file_system_type *fs_type, int flags,
 	mutex_init(&c->log_mutex);
 	mutex_init(&c->mst_mutex);
 	mutex_init(&c->umount_mutex);
+	mutex_init(&c->bu_mutex);
 	init_waitqueue_head(&c->cmt_wq);
 	c->buds = RB_ROOT;
 	c->old_idx = RB_ROOT;
@@ -1213,6 +1260,9 @@ static int ubifs_get_sb(struct file_system_type *fs_type, int flags,
 		goto out_umount;
 	}
 
+	/* Have writeback hand us dirty data a LEB at a time */
+	bdi_set_write_unit(&ubifs_backing_dev_info, c->leb_size);
+
 	/* Read the root inode */
 	root = ubifs_iget(sb, UBIFS_ROOT_INO);
 	if (IS_ERR(root)) {
@@ -41,12 +41,66 @@
  * latency blips. Note that in any case, the commit does not prevent lookups
  * (as permitted by the TNC mutex), or access to VFS data structures e.g. page
  * cache.
+ *
+ * During commit end the index and the LPT are written to different LEBs and
+ * neither write-out depends on the other one, so the LPT is written by a
+ * short-lived helper thread while the committer writes the index.
  */
 
 #include <linux/freezer.h>
 #include <linux/kthread.h>
 #include "ubifs.h"
 
+/**
+ * lpt_end_commit_thread - LPT commit end helper thread function.
+ * @data: UBIFS file-system description object
+ */
+static int lpt_end_commit_thread(void *data)
+{
+	struct ubifs_info *c = data;
+
+	c->lpt_cmt_err = ubifs_lpt_end_commit(c);
+	complete_and_exit(&c->lpt_cmt_done, 0);
+}
+
+/**
+ * start_lpt_end_commit - start writing out the LPT.
+ * @c: UBIFS file-system description object
+ *
+ * This function starts 'ubifs_lpt_end_commit()' in a helper thread if there
+ * is an index to write out concurrently, otherwise, or if the thread cannot
+ * be created, it is done synchronously. The result has to be collected with
+ * 'wait_lpt_end_commit()'.
+ */
+static void start_lpt_end_commit(struct ubifs_info *c)
+{
+	struct task_struct *tsk;
+
+	init_completion(&c->lpt_cmt_done);
+	if (c->cnext && c->lpt_cnext) {
+		tsk = kthread_run(lpt_end_commit_thread, c, "%s_lpt",
+				  c->bgt_name);
+		if (!IS_ERR(tsk))
+			return;
+		dbg_cmt("cannot spawn LPT commit thread, error %ld",
+			PTR_ERR(tsk));
+	}
+	c->lpt_cmt_err = ubifs_lpt_end_commit(c);
+	complete(&c->lpt_cmt_done);
+}
+
+/**
+ * wait_lpt_end_commit - wait for the LPT to be written out.
+ * @c: UBIFS file-system description object
+ *
+ * This function returns the result of 'ubifs_lpt_end_commit()'.
+ */
+static int wait_lpt_end_commit(struct ubifs_info *c)
+{
+	wait_for_completion(&c->lpt_cmt_done);
+	return c->lpt_cmt_err;
+}
+
 /**
  * do_commit - commit the journal.
  * @c: UBIFS file-system description object
@@ -57,7 +111,7 @@
  */
 static int do_commit(struct ubifs_info *c)
 {
-	int err, new_ltail_lnum, old_ltail_lnum, i;
+	int err, lpt_err, new_ltail_lnum, old_ltail_lnum, i;
 	struct ubifs_zbranch zroot;
 	struct ubifs_lp_stats lst;
 
@@ -101,10 +155,12 @@ static int do_commit(struct ubifs_info *c)
 
 	up_write(&c->commit_sem);
 
+	start_lpt_end_commit(c);
 	err = ubifs_tnc_end_commit(c);
+	lpt_err = wait_lpt_end_commit(c);
 	if (err)
 		goto out;
-	err = ubifs_lpt_end_commit(c);
+	err = lpt_err;
 	if (err)
 		goto out;
 	err = ubifs_orphan_end_commit(c);
@@ -349,8 +349,228 @@ out:
 
 #endif /* UBIFS_COMPAT_USE_OLD_PREPARE_WRITE */
 
+/**
+ * populate_page - copy data nodes into a page for bulk-read.
+ * @c: UBIFS file-system description object
+ * @page: page
+ * @bu: bulk-read information
+ * @n: next zbranch slot
+ *
+ * This function returns %0 on success and a negative error code on failure.
+ */
+static int populate_page(struct ubifs_info *c, struct page *page,
+			 struct bu_info *bu, int *n)
+{
+	int nn = *n, offs = bu->zbranch[0].offs, hole = 0, len, out_len, err;
+	struct inode *inode = page->mapping->host;
+	loff_t i_size = i_size_read(inode);
+	struct ubifs_data_node *dn;
+	unsigned int dlen;
+	void *addr;
+
+	dbg_gen("ino %lu, pg %lu, i_size %lld, flags %#lx",
+		inode->i_ino, page->index, i_size, page->flags);
+
+	addr = kmap(page);
+
+	if (((loff_t)page->index << PAGE_CACHE_SHIFT) >= i_size) {
+		/* Reading beyond inode */
+		hole = 1;
+		memset(addr, 0, PAGE_CACHE_SIZE);
+		goto out;
+	}
+
+	/* Skip the nodes of the pages which were up-to-date already */
+	while (nn < bu->cnt && key_block(c, &bu->zbranch[nn].key) < page->index)
+		nn += 1;
+
+	if (nn >= bu->cnt ||
+	    key_block(c, &bu->zbranch[nn].key) != page->index) {
+		hole = 1;
+		memset(addr, 0, PAGE_CACHE_SIZE);
+		goto out;
+	}
+
+	dn = bu->buf + (bu->zbranch[nn].offs - offs);
+	ubifs_assert(dn->ch.sqnum > ubifs_inode(inode)->creat_sqnum);
+
+	len = le32_to_cpu(dn->size);
+	if (len <= 0 || len > PAGE_CACHE_SIZE)
+		goto out_err;
+
+	dlen = le32_to_cpu(dn->ch.len) - UBIFS_DATA_NODE_SZ;
+	out_len = PAGE_CACHE_SIZE;
+	err = ubifs_decompress(&dn->data, dlen, addr, &out_len,
+			       le16_to_cpu(dn->compr_type));
+	if (err || len != out_len)
+		goto out_err;
+
+	if (len < PAGE_CACHE_SIZE)
+		memset(addr + len, 0, PAGE_CACHE_SIZE - len);
+	nn += 1;
+
+out:
+	if (hole) {
+		SetPageChecked(page);
+		dbg_gen("hole");
+	}
+	SetPageUptodate(page);
+	ClearPageError(page);
+	flush_dcache_page(page);
+	kunmap(page);
+	*n = nn;
+	return 0;
+
+out_err:
+	ClearPageUptodate(page);
+	SetPageError(page);
+	flush_dcache_page(page);
+	kunmap(page);
+	ubifs_err("bad data node (page %lu, inode %lu)",
+		  page->index, inode->i_ino);
+	return -EINVAL;
+}
+
+/**
+ * ubifs_do_bulk_read - do bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read information
+ * @page1: first page to read
+ *
+ * This function reads the data nodes of @page1 and of the pages following it
+ * with a single flash read and puts them to the page cache. Pages which are
+ * locked or up-to-date already are skipped. Returns %1 if @page1 has been
+ * read and unlocked, and %0 if the caller has to read it.
+ */
+static int ubifs_do_bulk_read(struct ubifs_info *c, struct bu_info *bu,
+			      struct page *page1)
+{
+	pgoff_t offset = page1->index, end_index;
+	struct address_space *mapping = page1->mapping;
+	struct inode *inode = mapping->host;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	int err, page_idx, n = 0;
+	loff_t isize;
+
+	err = ubifs_tnc_get_bu(c, bu);
+	if (err)
+		goto out_warn;
+
+	if (bu->eof) {
+		/* Turn off bulk-read at the end of the file */
+		ui->read_in_a_row = 1;
+		ui->bulk_read = 0;
+	}
+
+	if (!bu->blk_cnt)
+		return 0;
+
+	if (bu->cnt) {
+		err = ubifs_tnc_bulk_read(c, bu);
+		if (err)
+			goto out_warn;
+	}
+
+	err = populate_page(c, page1, bu, &n);
+	if (err)
+		goto out_warn;
+
+	unlock_page(page1);
+
+	isize = i_size_read(inode);
+	if (isize == 0)
+		return 1;
+	end_index = ((isize - 1) >> PAGE_CACHE_SHIFT);
+
+	for (page_idx = 1; page_idx < bu->blk_cnt; page_idx++) {
+		pgoff_t page_offset = offset + page_idx;
+		struct page *page;
+
+		if (page_offset > end_index)
+			break;
+		/*
+		 * Do not wait for locked pages: the page may be under
+		 * readahead I/O or write-back, and @page1 lock order does
+		 * not allow that anyway.
+		 */
+		page = grab_cache_page_nowait(mapping, page_offset);
+		if (!page)
+			break;
+		if (!PageUptodate(page))
+			err = populate_page(c, page, bu, &n);
+		unlock_page(page);
+		page_cache_release(page);
+		if (err)
+			break;
+	}
+
+	ui->last_page_read = offset + page_idx - 1;
+	return 1;
+
+out_warn:
+	ubifs_warn("ignoring error %d and skipping bulk-read", err);
+	return 0;
+}
+
+/**
+ * ubifs_bulk_read - determine whether to bulk-read and, if so, do it.
+ * @page: page from which to start bulk-read.
+ *
+ * Some flash media are capable of reading sequentially at faster rates. UBIFS
+ * bulk-read facility is designed to take advantage of that, by reading in one
+ * go consecutive data nodes that are also located consecutively in the same
+ * LEB. It is switched on for an inode once 'readpage()' has been called on
+ * %UBIFS_BULK_READ_IN_A_ROW consecutive pages of it, which is what the
+ * generic read-ahead code does for sequential reads. This function returns %1
+ * if a bulk-read is done and @page has been unlocked, otherwise %0.
+ */
+static int ubifs_bulk_read(struct page *page)
+{
+	struct inode *inode = page->mapping->host;
+	struct ubifs_info *c = inode->i_sb->s_fs_info;
+	struct ubifs_inode *ui = ubifs_inode(inode);
+	pgoff_t index = page->index, last_page_read = ui->last_page_read;
+	int ret = 0;
+
+	ui->last_page_read = index;
+	if (!c->bulk_read)
+		return 0;
+
+	if (index != last_page_read + 1) {
+		/* Turn off bulk-read if we stop reading sequentially */
+		ui->read_in_a_row = 1;
+		ui->bulk_read = 0;
+		return 0;
+	}
+
+	if (!ui->bulk_read) {
+		ui->read_in_a_row += 1;
+		if (ui->read_in_a_row < UBIFS_BULK_READ_IN_A_ROW)
+			return 0;
+		ui->bulk_read = 1;
+	}
+
+	/*
+	 * Bulk-read is an optimization, so do not wait for another bulk-read
+	 * to release the buffer.
+	 */
+	if (!mutex_trylock(&c->bu_mutex))
+		return 0;
+
+	if (c->bu.buf) {
+		c->bu.buf_len = c->max_bu_buf_len;
+		data_key_init(c, &c->bu.key, inode->i_ino, index);
+		ret = ubifs_do_bulk_read(c, &c->bu, page);
+	}
+
+	mutex_unlock(&c->bu_mutex);
+	return ret;
+}
+
 static int ubifs_readpage(struct file *file, struct page *page)
 {
+	if (ubifs_bulk_read(page))
+		return 0;
 	do_readpage(page);
 	unlock_page(page);
 	return 0;
@@ -114,6 +114,7 @@ struct inode *ubifs_iget(struct super_block *sb, unsigned long inum)
 		goto out_ino;
 
 	inode->i_flags |= (S_NOCMTIME | S_NOATIME);
+	inode->i_mapping->backing_dev_info = &ubifs_backing_dev_info;
 	inode->i_nlink = le32_to_cpu(ino->nlink);
 	inode->i_uid   = le32_to_cpu(ino->uid);
 	inode->i_gid   = le32_to_cpu(ino->gid);
@@ -483,6 +484,16 @@ static int ubifs_remount_fs(struct super_block *sb, int *flags, char *data)
 		ubifs_err("invalid or unknown remount parameter");
 		return err;
 	}
+
+	mutex_lock(&c->bu_mutex);
+	if (c->bulk_read == 1)
+		ubifs_bu_init(c);
+	else {
+		dbg_gen("disable bulk-read");
+		vfree(c->bu.buf);
+		c->bu.buf = NULL;
+	}
+	mutex_unlock(&c->bu_mutex);
 	if ((sb->s_flags & MS_RDONLY) && !(*flags & MS_RDONLY)) {
 		err = ubifs_remount_rw(c);
 		if (err)
@@ -502,6 +513,11 @@ static int ubifs_show_options(struct seq_file *s, struct vfsmount *mnt)
 	else if (c->mount_opts.unmount_mode == 1)
 		seq_printf(s, ",norm_unmount");
 
+	if (c->mount_opts.bulk_read == 2)
+		seq_printf(s, ",bulk_read");
+	else if (c->mount_opts.bulk_read == 1)
+		seq_printf(s, ",no_bulk_read");
+
 	return 0;
 }
 
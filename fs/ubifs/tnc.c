@@ -1718,6 +1718,260 @@ out:
 	return err;
 }
 
+/**
+ * ubifs_tnc_get_bu - lookup a number of data nodes to bulk-read.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read parameters and results
+ *
+ * Lookup consecutive data node keys for the same inode that reside
+ * consecutively in the same LEB, starting from the key in @bu->key, in one
+ * walk of the TNC. The nodes have to fit in @bu->buf_len bytes and at most
+ * %UBIFS_MAX_BULK_READ blocks (including holes) are looked up. @bu->cnt,
+ * @bu->blk_cnt and @bu->eof are set accordingly. Note, if the data node for
+ * the first key does not exist, the first block is a hole.
+ *
+ * This function returns %0 in case of success and a negative error code in
+ * case of failure.
+ */
+int ubifs_tnc_get_bu(struct ubifs_info *c, struct bu_info *bu)
+{
+	int n, err, lnum = -1, uninitialized_var(offs), uninitialized_var(len);
+	unsigned int first = key_block(c, &bu->key), block = first;
+	struct ubifs_znode *znode;
+	struct ubifs_zbranch *zbr;
+
+	bu->cnt = 0;
+	bu->blk_cnt = 0;
+	bu->eof = 0;
+
+	mutex_lock(&c->tnc_mutex);
+	err = lookup_level0(c, &bu->key, &znode, &n);
+	if (err < 0)
+		goto out;
+	if (err) {
+		/* The first key has been found */
+		zbr = &znode->zbranch[n];
+		if (zbr->len > bu->buf_len) {
+			err = -EINVAL;
+			goto out;
+		}
+		bu->zbranch[bu->cnt++] = *zbr;
+		lnum = zbr->lnum;
+		offs = ALIGN(zbr->offs + zbr->len, 8);
+		len = zbr->len;
+	}
+	err = 0;
+
+	while (1) {
+		union ubifs_key *key;
+
+		if (bu->cnt == UBIFS_MAX_BULK_READ) {
+			bu->blk_cnt = block - first + 1;
+			break;
+		}
+
+		err = tnc_next(c, &znode, &n);
+		if (err)
+			goto out;
+		zbr = &znode->zbranch[n];
+		key = &zbr->key;
+
+		/* See if there is another data key for this file */
+		if (key_ino(c, key) != key_ino(c, &bu->key) ||
+		    key_type(c, key) != UBIFS_DATA_KEY) {
+			err = -ENOENT;
+			goto out;
+		}
+
+		/*
+		 * Whatever stops the walk here, all blocks before this one
+		 * are either in @bu or are holes.
+		 */
+		block = key_block(c, key);
+		bu->blk_cnt = min_t(unsigned int, block - first,
+				    UBIFS_MAX_BULK_READ);
+		if (block - first >= UBIFS_MAX_BULK_READ)
+			break;
+
+		if (lnum < 0) {
+			/* The first data node after a hole */
+			if (zbr->len > bu->buf_len)
+				break;
+			lnum = zbr->lnum;
+			offs = ALIGN(zbr->offs + zbr->len, 8);
+			len = zbr->len;
+		} else {
+			/*
+			 * The data nodes must be in consecutive positions in
+			 * the same LEB and must fit into the buffer.
+			 */
+			if (zbr->lnum != lnum || zbr->offs != offs)
+				break;
+			if (ALIGN(len, 8) + zbr->len > bu->buf_len)
+				break;
+			offs += ALIGN(zbr->len, 8);
+			len = ALIGN(len, 8) + zbr->len;
+		}
+
+		bu->zbranch[bu->cnt++] = *zbr;
+	}
+
+out:
+	mutex_unlock(&c->tnc_mutex);
+	if (err == -ENOENT) {
+		/* There are only holes from here up to the end of the file */
+		bu->eof = 1;
+		bu->blk_cnt = UBIFS_MAX_BULK_READ;
+		err = 0;
+	}
+	return err;
+}
+
+/**
+ * read_wbuf - bulk-read from a LEB with a wbuf.
+ * @wbuf: wbuf that may overlap the read
+ * @buf: buffer into which to read
+ * @len: read length
+ * @lnum: LEB number from which to read
+ * @offs: offset from which to read
+ *
+ * This functions returns %0 on success or a negative error code on failure.
+ */
+static int read_wbuf(struct ubifs_wbuf *wbuf, void *buf, int len, int lnum,
+		     int offs)
+{
+	const struct ubifs_info *c = wbuf->c;
+	int rlen, overlap;
+
+	dbg_io("LEB %d:%d, length %d", lnum, offs, len);
+	ubifs_assert(wbuf && lnum >= 0 && lnum < c->leb_cnt && offs >= 0);
+	ubifs_assert(!(offs & 7) && offs < c->leb_size);
+	ubifs_assert(offs + len <= c->leb_size);
+
+	spin_lock(&wbuf->lock);
+	overlap = (lnum == wbuf->lnum && offs + len > wbuf->offs);
+	if (!overlap) {
+		/* We may safely unlock the write-buffer and read the data */
+		spin_unlock(&wbuf->lock);
+		return ubi_read(c->ubi, lnum, buf, offs, len);
+	}
+
+	/* Don't read under wbuf */
+	rlen = wbuf->offs - offs;
+	if (rlen < 0)
+		rlen = 0;
+
+	/* Copy the rest from the write-buffer */
+	memcpy(buf + rlen, wbuf->buf + offs + rlen - wbuf->offs, len - rlen);
+	spin_unlock(&wbuf->lock);
+
+	if (rlen > 0)
+		/* Read everything that goes before write-buffer */
+		return ubi_read(c->ubi, lnum, buf, offs, rlen);
+
+	return 0;
+}
+
+/**
+ * validate_data_node - validate data nodes for bulk-read.
+ * @c: UBIFS file-system description object
+ * @buf: buffer containing data node to validate
+ * @zbr: zbranch of data node to validate
+ *
+ * This functions returns %0 on success or a negative error code on failure.
+ */
+static int validate_data_node(struct ubifs_info *c, void *buf,
+			      struct ubifs_zbranch *zbr)
+{
+	union ubifs_key key1;
+	struct ubifs_ch *ch = buf;
+	int err, len;
+
+	if (ch->node_type != UBIFS_DATA_NODE) {
+		ubifs_err("bad node type (%d but expected %d)",
+			  ch->node_type, UBIFS_DATA_NODE);
+		goto out_err;
+	}
+
+	err = ubifs_check_node(c, buf, zbr->lnum, zbr->offs, 0);
+	if (err) {
+		ubifs_err("expected node type %d", UBIFS_DATA_NODE);
+		goto out;
+	}
+
+	len = le32_to_cpu(ch->len);
+	if (len != zbr->len) {
+		ubifs_err("bad node length %d, expected %d", len, zbr->len);
+		goto out_err;
+	}
+
+	/* Make sure the key of the read node is correct */
+	key_write(c, &zbr->key, &key1);
+	if (memcmp(buf + UBIFS_KEY_OFFSET, &key1, c->key_len)) {
+		ubifs_err("bad key in node at LEB %d:%d",
+			  zbr->lnum, zbr->offs);
+		dbg_tnc_key(c, &zbr->key, "looked for key");
+		goto out_err;
+	}
+
+	return 0;
+
+out_err:
+	err = -EINVAL;
+out:
+	ubifs_err("bad node at LEB %d:%d", zbr->lnum, zbr->offs);
+	dbg_dump_node(c, buf);
+	dbg_dump_stack();
+	return err;
+}
+
+/**
+ * ubifs_tnc_bulk_read - read a number of data nodes in one go.
+ * @c: UBIFS file-system description object
+ * @bu: bulk-read parameters and results
+ *
+ * This functions reads the data nodes looked up by 'ubifs_tnc_get_bu()' with
+ * a single read into @bu->buf and validates them. Returns %0 on success or a
+ * negative error code on failure.
+ */
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu)
+{
+	int lnum = bu->zbranch[0].lnum, offs = bu->zbranch[0].offs, len, err, i;
+	struct ubifs_wbuf *wbuf;
+	void *buf;
+
+	len = bu->zbranch[bu->cnt - 1].offs;
+	len += bu->zbranch[bu->cnt - 1].len - offs;
+	if (len > bu->buf_len) {
+		ubifs_err("buffer too small %d vs %d", bu->buf_len, len);
+		return -EINVAL;
+	}
+
+	wbuf = ubifs_get_wbuf(c, lnum);
+	if (wbuf)
+		err = read_wbuf(wbuf, bu->buf, len, lnum, offs);
+	else
+		err = ubi_read(c->ubi, lnum, bu->buf, offs, len);
+	if (err && err != -EBADMSG) {
+		ubifs_err("failed to read from LEB %d:%d, error %d",
+			  lnum, offs, err);
+		dbg_dump_stack();
+		dbg_tnc_key(c, &bu->key, "first key");
+		return err;
+	}
+
+	/* Validate the nodes read */
+	buf = bu->buf;
+	for (i = 0; i < bu->cnt; i++) {
+		err = validate_data_node(c, buf, &bu->zbranch[i]);
+		if (err)
+			return err;
+		buf = buf + ALIGN(bu->zbranch[i].len, 8);
+	}
+
+	return 0;
+}
+
 /**
  * do_lookup_nm- look up a "hashed" node.
  * directory entry file-system node.
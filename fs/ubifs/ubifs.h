@@ -33,6 +33,7 @@
 #include <linux/vmalloc.h>
 #include <linux/spinlock.h>
 #include <linux/mutex.h>
+#include <linux/completion.h>
 #include <linux/rwsem.h>
 #include <linux/mtd/ubi.h>
 #include <linux/pagemap.h>
@@ -124,6 +125,15 @@
 /* Maximum expected tree height for use by bottom_up_buf */
 #define BOTTOM_UP_HEIGHT 64
 
+/* Maximum number of data nodes to bulk-read */
+#define UBIFS_MAX_BULK_READ 32
+
+/*
+ * Number of sequential 'readpage()' calls on an inode before bulk-read is
+ * switched on for it
+ */
+#define UBIFS_BULK_READ_IN_A_ROW 3
+
 /*
  * Znode flags (actually, bit numbers which store the flags).
  *
@@ -294,6 +304,12 @@ struct ubifs_gced_idx_leb {
  * @compr_type: default compression type used for this inode
  * @data_len: length of the data attached to the inode
  * @data: inode's data
+ * @bulk_read: non-zero if bulk-read should be used
+ * @read_in_a_row: number of consecutive pages read in a row (for bulk read)
+ * @last_page_read: page number of last page read (for bulk read)
+ *
+ * @bulk_read, @read_in_a_row and @last_page_read are only hints and are not
+ * protected by any lock.
  *
  * UBIFS has its own inode mutex, besides the VFS 'i_mutex'. The reason for
  * this is budgeting - UBIFS has to budget each operation. So, if an operation
@@ -325,6 +341,9 @@ struct ubifs_inode {
 	int compr_type;
 	int data_len;
 	void *data;
+	unsigned int bulk_read:1;
+	int read_in_a_row;
+	pgoff_t last_page_read;
 };
 
 /**
@@ -779,12 +798,34 @@ struct ubifs_orphan {
 	int new;
 };
 
+/**
+ * struct bu_info - bulk-read information.
+ * @key: first data node key
+ * @zbranch: zbranches of data nodes to bulk read
+ * @buf: buffer to read into
+ * @buf_len: buffer length
+ * @cnt: number of data nodes for bulk read
+ * @blk_cnt: number of data blocks including holes
+ * @eof: end of file reached
+ */
+struct bu_info {
+	union ubifs_key key;
+	struct ubifs_zbranch zbranch[UBIFS_MAX_BULK_READ];
+	void *buf;
+	int buf_len;
+	int cnt;
+	int blk_cnt;
+	int eof;
+};
+
 /**
  * struct ubifs_mount_opts - UBIFS-specific mount options information.
  * @unmount_mode: selected unmount mode (%0 default, %1 normal, %2 fast)
+ * @bulk_read: enable bulk-reads (%0 default, %1 disable, %2 enable)
  */
 struct ubifs_mount_opts {
 	unsigned int unmount_mode:2;
+	unsigned int bulk_read:2;
 };
 
 /**
@@ -824,6 +865,7 @@ struct ubifs_mount_opts {
  * @cmt_wq: wait queue to sleep on if the log is full and a commit is running
  * @fast_unmount: do not run journal commit before unmounting
  * @big_lpt: flag that LPT is too big to write whole during commit
+ * @bulk_read: enable bulk-reads
  *
  * @tnc_mutex: protects the Tree Node Cache (TNC), @zroot, @cnext, @enext, and
  *             @calc_idx_sz
@@ -974,6 +1016,8 @@ struct ubifs_mount_opts {
  * @lpt_buf: buffer of LEB size used by LPT
  * @nroot: address in memory of the root nnode of the LPT
  * @lpt_cnext: next LPT node to commit
+ * @lpt_cmt_done: completed when the LPT has been written out by commit end
+ * @lpt_cmt_err: error code of the LPT commit end
  * @lpt_heap: array of heaps of categorized lprops
  * @dirty_idx: a (reverse sorted) copy of the LPROPS_DIRTY_IDX heap as at
  * previous commit start
@@ -1013,6 +1057,10 @@ struct ubifs_mount_opts {
  * @remounting_rw: set while remounting from ro to rw (sb flags have MS_RDONLY)
  * @mount_opts: UBIFS-specific mount options
  *
+ * @bu_mutex: protects the pre-allocated bulk-read buffer and @bu
+ * @bu: pre-allocated bulk-read information
+ * @max_bu_buf_len: maximum bulk-read buffer length
+ *
  * @dbg_buf: a buffer of LEB size used for debugging purposes
  * @old_zroot: old index root - used by 'dbg_check_old_index()'
  * @old_zroot_level: old index root level - used by 'dbg_check_old_index()'
@@ -1052,6 +1100,7 @@ struct ubifs_info {
 	wait_queue_head_t cmt_wq;
 	unsigned int fast_unmount:1;
 	unsigned int big_lpt:1;
+	unsigned int bulk_read:1;
 
 	struct mutex tnc_mutex;
 	struct ubifs_zbranch zroot;
@@ -1197,6 +1246,8 @@ struct ubifs_info {
 	void *lpt_buf;
 	struct ubifs_nnode *nroot;
 	struct ubifs_cnode *lpt_cnext;
+	struct completion lpt_cmt_done;
+	int lpt_cmt_err;
 	struct ubifs_lpt_heap lpt_heap[LPROPS_HEAP_CNT];
 	struct ubifs_lpt_heap dirty_idx;
 	struct list_head uncat_list;
@@ -1236,6 +1287,10 @@ struct ubifs_info {
 	int remounting_rw;
 	struct ubifs_mount_opts mount_opts;
 
+	struct mutex bu_mutex;
+	struct bu_info bu;
+	int max_bu_buf_len;
+
 #ifdef CONFIG_UBIFS_FS_DEBUG
 	void *dbg_buf;
 	struct ubifs_zbranch old_zroot;
@@ -1361,6 +1416,8 @@ int ubifs_tnc_lookup(struct ubifs_info *c, const union ubifs_key *key,
 		     void *node);
 int ubifs_tnc_locate(struct ubifs_info *c, const union ubifs_key *key,
 		     void *node, int *lnum, int *offs);
+int ubifs_tnc_get_bu(struct ubifs_info *c, struct bu_info *bu);
+int ubifs_tnc_bulk_read(struct ubifs_info *c, struct bu_info *bu);
 int ubifs_tnc_lookup_nm(struct ubifs_info *c, const union ubifs_key *key,
 			void *node, const struct qstr *nm);
 int ubifs_tnc_add(struct ubifs_info *c, const union ubifs_key *key, int lnum,
@@ -1421,6 +1478,7 @@ void ubifs_wait_for_commit(struct ubifs_info *c);
 void ubifs_umount(struct ubifs_info *c);
 int ubifs_remount_rw(struct ubifs_info *c);
 void ubifs_remount_ro(struct ubifs_info *c);
+void ubifs_bu_init(struct ubifs_info *c);
 int ubifs_parse_options(struct ubifs_info *c, char *options, int is_remount);
 
 /* master.c */
@@ -52,6 +52,9 @@ extern const char *yaffs_guts_c_version;
 #include <linux/interrupt.h>
 #include <linux/string.h>
 #include <linux/ctype.h>
+#include <linux/kthread.h>
+#include <linux/mutex.h>
+#include <linux/moduleparam.h>
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,5,0))
 
@@ -90,6 +93,23 @@ unsigned yaffs_traceMask = YAFFS_TRACE_ALWAYS |
 #include "yaffs_mtdif.h"
 #include "yaffs_mtdif2.h"
 
+/* Background garbage collection tunables.
+ * The collector runs once the device has not been changed for
+ * yaffs_gc_interval milliseconds (0 disables it). It then collects blocks
+ * with at least yaffs_gc_dirty percent discarded chunks until there are
+ * yaffs_gc_blocks erased blocks above the reserve.
+ */
+static unsigned yaffs_gc_interval = 1000;
+static unsigned yaffs_gc_blocks = 8;
+static unsigned yaffs_gc_dirty = 25;
+
+module_param(yaffs_gc_interval, uint, 0644);
+MODULE_PARM_DESC(yaffs_gc_interval, "Idle time in ms before background gc");
+module_param(yaffs_gc_blocks, uint, 0644);
+MODULE_PARM_DESC(yaffs_gc_blocks, "Erased blocks to keep above the reserve");
+module_param(yaffs_gc_dirty, uint, 0644);
+MODULE_PARM_DESC(yaffs_gc_dirty, "Minimum dirty percentage of a gc'd block");
+
 /*#define T(x) printk x */
 
 #if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,18))
@@ -259,18 +279,36 @@ static struct super_operations yaffs_super_ops = {
 	.write_super = yaffs_write_super,
 };
 
+/* The gross lock is held exclusive by anything that changes the file
+ * system, and shared by lookups and reads, which can then go ahead in
+ * parallel. The state those touch inside the guts has its own locks.
+ */
 static void yaffs_GrossLock(yaffs_Device * dev)
 {
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs locking\n"));
 
-	down(&dev->grossLock);
+	down_write(&dev->grossLock);
 }
 
 static void yaffs_GrossUnlock(yaffs_Device * dev)
 {
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs unlocking\n"));
-	up(&dev->grossLock);
+	dev->lastActivity = jiffies;
+	up_write(&dev->grossLock);
+
+}
+
+static void yaffs_SharedLock(yaffs_Device * dev)
+{
+	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs locking shared\n"));
+
+	down_read(&dev->grossLock);
+}
 
+static void yaffs_SharedUnlock(yaffs_Device * dev)
+{
+	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs unlocking shared\n"));
+	up_read(&dev->grossLock);
 }
 
 static int yaffs_readlink(struct dentry *dentry, char __user * buffer,
@@ -281,11 +319,11 @@ static int yaffs_readlink(struct dentry *dentry, char __user * buffer,
 
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 
 	if (!alias)
 		return -ENOMEM;
@@ -305,11 +343,11 @@ static int yaffs_follow_link(struct dentry *dentry, struct nameidata *nd)
 	int ret;
 	yaffs_Device *dev = yaffs_DentryToObject(dentry)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	alias = yaffs_GetSymlinkAlias(yaffs_DentryToObject(dentry));
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 
 	if (!alias)
         {
@@ -346,7 +384,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 
 	yaffs_Device *dev = yaffs_InodeToObject(dir)->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	T(YAFFS_TRACE_OS,
 	  (KERN_DEBUG "yaffs_lookup for %d:%s\n",
@@ -359,7 +397,7 @@ static struct dentry *yaffs_lookup(struct inode *dir, struct dentry *dentry)
 	obj = yaffs_GetEquivalentObject(obj);	/* in case it was a hardlink */
 	
 	/* Can't hold gross lock when calling yaffs_get_inode() */
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 
 	if (obj) {
 		T(YAFFS_TRACE_OS,
@@ -414,6 +452,7 @@ static int yaffs_dump_dev1(yaffs_Device * dev)
 	printk("garbageCollections. %d\n", dev->garbageCollections);
 	
 	printk("passiveGCs......... %d\n", dev->passiveGarbageCollections);
+	printk("backgroundGCs...... %d\n", dev->backgroundGarbageCollections);
 	printk("nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	printk("nRetireBlocks...... %d\n", dev->nRetiredBlocks);
 	printk("eccFixed........... %d\n", dev->eccFixed);
@@ -555,13 +594,13 @@ static int yaffs_readpage_nolock(struct file *f, struct page *pg)
 	pg_buf = kmap(pg);
 	/* FIXME: Can kmap fail? */
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	ret =
 	    yaffs_ReadDataFromFile(obj, pg_buf, pg->index << PAGE_CACHE_SHIFT,
 				   PAGE_CACHE_SIZE);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 
 	if (ret >= 0)
 		ret = 0;
@@ -926,7 +965,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
 	obj = yaffs_DentryToObject(f->f_dentry);
 	dev = obj->myDev;
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	offset = f->f_pos;
 
@@ -996,7 +1035,7 @@ static int yaffs_readdir(struct file *f, void *dirent, filldir_t filldir)
       up_and_out:
       out:
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 
 	return 0;
 }
@@ -1347,7 +1386,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs_statfs\n"));
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 
 	buf->f_type = YAFFS_MAGIC;
 	buf->f_bsize = sb->s_blocksize;
@@ -1375,7 +1414,7 @@ static int yaffs_statfs(struct super_block *sb, struct statfs *buf)
 	buf->f_ffree = 0;
 	buf->f_bavail = buf->f_bfree;
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 	return 0;
 }
 
@@ -1442,16 +1481,85 @@ static void yaffs_read_inode(struct inode *inode)
 	T(YAFFS_TRACE_OS,
 	  (KERN_DEBUG "yaffs_read_inode for %d\n", (int)inode->i_ino));
 
-	yaffs_GrossLock(dev);
+	yaffs_SharedLock(dev);
 	
 	obj = yaffs_FindObjectByNumber(dev, inode->i_ino);
 
 	yaffs_FillInodeFromObject(inode, obj);
 
-	yaffs_GrossUnlock(dev);
+	yaffs_SharedUnlock(dev);
 }
 
 static LIST_HEAD(yaffs_dev_list);
+static DEFINE_SPINLOCK(yaffs_dev_lock);
+
+/* Slab caches for tnodes and objects.
+ * The tnode size depends on the tnode width of each device, so there is a
+ * cache per size, made the first time a device needs it.
+ */
+#define YAFFS_TNODE_CACHES	((32 - 16) / 2 + 1)
+
+static struct kmem_cache *yaffs_object_cache;
+static struct kmem_cache *yaffs_tnode_cache[YAFFS_TNODE_CACHES];
+static char yaffs_tnode_cache_name[YAFFS_TNODE_CACHES][16];
+static DEFINE_MUTEX(yaffs_cache_lock);
+
+struct kmem_cache *yaffs_TnodeCache(int tnodeSize)
+{
+	/* tnodes are 16 entries of 16 to 32 bits, in steps of two bits */
+	int i = (tnodeSize - 32) / 4;
+
+	if (i < 0 || i >= YAFFS_TNODE_CACHES)
+		return NULL;
+
+	mutex_lock(&yaffs_cache_lock);
+	if (!yaffs_tnode_cache[i]) {
+		sprintf(yaffs_tnode_cache_name[i], "yaffs_tnode%d", tnodeSize);
+		yaffs_tnode_cache[i] =
+		    kmem_cache_create(yaffs_tnode_cache_name[i], tnodeSize,
+				      0, 0, NULL);
+	}
+	mutex_unlock(&yaffs_cache_lock);
+
+	return yaffs_tnode_cache[i];
+}
+
+struct kmem_cache *yaffs_ObjectCache(void)
+{
+	return yaffs_object_cache;
+}
+
+/* Give the spare tnodes and objects of idle devices back under memory
+ * pressure. Devices that are busy are skipped rather than waited on, we
+ * may well be reclaiming on behalf of one of them.
+ */
+static int yaffs_shrink(int nr_to_scan, gfp_t gfp_mask)
+{
+	struct list_head *item;
+	yaffs_Device *dev;
+	int nFree = 0;
+
+	if (nr_to_scan && !(gfp_mask & __GFP_FS))
+		return -1;
+
+	spin_lock(&yaffs_dev_lock);
+	list_for_each(item, &yaffs_dev_list) {
+		dev = list_entry(item, yaffs_Device, devList);
+		if (nr_to_scan > 0 && down_write_trylock(&dev->grossLock)) {
+			nr_to_scan -= yaffs_ShrinkFreeLists(dev, nr_to_scan);
+			up_write(&dev->grossLock);
+		}
+		nFree += dev->nFreeTnodes + dev->nFreeObjects;
+	}
+	spin_unlock(&yaffs_dev_lock);
+
+	return nFree;
+}
+
+static struct shrinker yaffs_shrinker = {
+	.shrink = yaffs_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
 
 static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 {
@@ -1482,12 +1590,52 @@ static int yaffs_remount_fs(struct super_block *sb, int *flags, char *data)
 	return 0;
 }
 
+/* Background garbage collector thread.
+ * Does nothing while the device is busy or read only, collects a block at a
+ * time while it is idle and short of erased blocks.
+ */
+static int yaffs_BackgroundGC(void *data)
+{
+	yaffs_Device *dev = (yaffs_Device *)data;
+	struct super_block *sb = (struct super_block *)dev->superBlock;
+	unsigned long idle;
+	int collected;
+
+	T(YAFFS_TRACE_GC, (KERN_DEBUG "yaffs: background gc for %s started\n",
+			   dev->name));
+
+	while (!kthread_should_stop()) {
+		collected = 0;
+		idle = msecs_to_jiffies(yaffs_gc_interval);
+
+		if (yaffs_gc_interval && !(sb->s_flags & MS_RDONLY) &&
+		    time_after(jiffies, dev->lastActivity + idle) &&
+		    down_write_trylock(&dev->grossLock)) {
+			collected = yaffs_BackgroundGarbageCollect(dev,
+					dev->nReservedBlocks + yaffs_gc_blocks,
+					dev->nChunksPerBlock * yaffs_gc_dirty / 100);
+			up_write(&dev->grossLock);
+		}
+
+		/* Carry on straight away if there may be more to do */
+		if (collected)
+			schedule_timeout_interruptible(1);
+		else
+			schedule_timeout_interruptible(idle ? idle : HZ);
+	}
+
+	return 0;
+}
+
 static void yaffs_put_super(struct super_block *sb)
 {
 	yaffs_Device *dev = yaffs_SuperToDevice(sb);
 
 	T(YAFFS_TRACE_OS, (KERN_DEBUG "yaffs_put_super\n"));
 
+	if (dev->gcThread)
+		kthread_stop(dev->gcThread);
+
 	yaffs_GrossLock(dev);
 	
 	yaffs_FlushEntireDeviceCache(dev);
@@ -1503,7 +1651,9 @@ static void yaffs_put_super(struct super_block *sb)
 	yaffs_GrossUnlock(dev);
 
 	/* we assume this is protected by lock_kernel() in mount/umount */
+	spin_lock(&yaffs_dev_lock);
 	list_del(&dev->devList);
+	spin_unlock(&yaffs_dev_lock);
 	
 	if(dev->spareBuffer){
 		YFREE(dev->spareBuffer);
@@ -1737,6 +1887,9 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		    nandmtd2_WriteChunkWithTagsToNAND;
 		dev->readChunkWithTagsFromNAND =
 		    nandmtd2_ReadChunkWithTagsFromNAND;
+		dev->writeChunksWithTagsToNAND =
+		    nandmtd2_WriteChunksWithTagsToNAND;
+		dev->readChunksFromNAND = nandmtd2_ReadChunksFromNAND;
 		dev->markNANDBlockBad = nandmtd2_MarkNANDBlockBad;
 		dev->queryNANDBlock = nandmtd2_QueryNANDBlock;
 		dev->spareBuffer = YMALLOC(mtd->oobsize);
@@ -1776,10 +1929,18 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 	dev->wideTnodesDisabled = 1;
 #endif
 
-	/* we assume this is protected by lock_kernel() in mount/umount */
-	list_add_tail(&dev->devList, &yaffs_dev_list);
+	init_rwsem(&dev->grossLock);
+	init_MUTEX(&dev->nandLock);
+	init_MUTEX(&dev->detailsLock);
+	spin_lock_init(&dev->bufferLock);
+	spin_lock_init(&dev->cacheLock);
 
-	init_MUTEX(&dev->grossLock);
+	/* we assume this is protected by lock_kernel() in mount/umount,
+	 * yaffs_dev_lock keeps the shrinker off it.
+	 */
+	spin_lock(&yaffs_dev_lock);
+	list_add_tail(&dev->devList, &yaffs_dev_list);
+	spin_unlock(&yaffs_dev_lock);
 
 	yaffs_GrossLock(dev);
 
@@ -1813,6 +1974,17 @@ static struct super_block *yaffs_internal_read_super(int yaffsVersion,
 		return NULL;
 	}
 	sb->s_root = root;
+
+	dev->lastActivity = jiffies;
+	dev->gcThread = kthread_run(yaffs_BackgroundGC, dev, "yaffs_gc_%s",
+				    sb->s_id);
+	if (IS_ERR(dev->gcThread)) {
+		T(YAFFS_TRACE_ALWAYS,
+		  ("yaffs: could not start background gc for %s\n",
+		   dev->name));
+		dev->gcThread = NULL;
+	}
+
 	T(YAFFS_TRACE_OS, ("yaffs_read_super: done\n"));
 	return sb;
 }
@@ -1935,6 +2107,9 @@ static char *yaffs_dump_dev(char *buf, yaffs_Device * dev)
 	buf +=
 	    sprintf(buf, "passiveGCs......... %d\n",
 		    dev->passiveGarbageCollections);
+	buf +=
+	    sprintf(buf, "backgroundGCs...... %d\n",
+		    dev->backgroundGarbageCollections);
 	buf += sprintf(buf, "nRetriedWrites..... %d\n", dev->nRetriedWrites);
 	buf += sprintf(buf, "nRetireBlocks...... %d\n", dev->nRetiredBlocks);
 	buf += sprintf(buf, "eccFixed........... %d\n", dev->eccFixed);
@@ -2132,6 +2307,12 @@ static int __init init_yaffs_fs(void)
 	T(YAFFS_TRACE_ALWAYS,
 	  ("yaffs " __DATE__ " " __TIME__ " Installing. \n"));
 
+	yaffs_object_cache = kmem_cache_create("yaffs_object",
+					       sizeof(yaffs_Object), 0, 0, NULL);
+	if (!yaffs_object_cache)
+		return -ENOMEM;
+
+
 	/* Install the proc_fs entry */
 	my_proc_entry = create_proc_entry("yaffs",
 					       S_IRUGO | S_IFREG,
@@ -2142,6 +2323,7 @@ static int __init init_yaffs_fs(void)
 		my_proc_entry->read_proc = yaffs_proc_read;
 		my_proc_entry->data = NULL;
 	} else {
+		kmem_cache_destroy(yaffs_object_cache);
 		return -ENOMEM;
 	}
 
@@ -2168,7 +2350,10 @@ static int __init init_yaffs_fs(void)
 			}
 			fsinst++;
 		}
-	}
+		remove_proc_entry("yaffs", &proc_root);
+		kmem_cache_destroy(yaffs_object_cache);
+	} else
+		register_shrinker(&yaffs_shrinker);
 
 	return error;
 }
@@ -2177,6 +2362,7 @@ static void __exit exit_yaffs_fs(void)
 {
 
 	struct file_system_to_install *fsinst;
+	int i;
 
 	T(YAFFS_TRACE_ALWAYS, ("yaffs " __DATE__ " " __TIME__
 			       " removing. \n"));
@@ -2193,6 +2379,13 @@ static void __exit exit_yaffs_fs(void)
 		fsinst++;
 	}
 
+	unregister_shrinker(&yaffs_shrinker);
+
+	for (i = 0; i < YAFFS_TNODE_CACHES; i++) {
+		if (yaffs_tnode_cache[i])
+			kmem_cache_destroy(yaffs_tnode_cache[i]);
+	}
+	kmem_cache_destroy(yaffs_object_cache);
 }
 
 module_init(init_yaffs_fs)
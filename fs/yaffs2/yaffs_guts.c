@@ -71,6 +71,7 @@ static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 static int yaffs_UpdateObjectHeader(yaffs_Object * in, const YCHAR * name,
 				    int force, int isShrink, int shadows);
 static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj);
+static void yaffs_DestroyDirectoryIndex(yaffs_Object * directory);
 static int yaffs_CheckStructures(void);
 static int yaffs_DeleteWorker(yaffs_Object * in, yaffs_Tnode * tn, __u32 level,
 			      int chunkOffset, int *limit);
@@ -105,6 +106,8 @@ static int yaffs_CheckFileSanity(yaffs_Object * in);
 
 static void yaffs_InvalidateWholeChunkCache(yaffs_Object * in);
 static void yaffs_InvalidateChunkCache(yaffs_Object * object, int chunkId);
+static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object * obj,
+					      int chunkId);
 
 static void yaffs_InvalidateCheckpoint(yaffs_Device *dev);
 
@@ -184,6 +187,8 @@ static __u32 ShiftDiv(__u32 x)
 static __u8 *yaffs_GetTempBuffer(yaffs_Device * dev, int lineNo)
 {
 	int i, j;
+
+	yaffs_LockBuffers(dev);
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->tempBuffer[i].line == 0) {
 			dev->tempBuffer[i].line = lineNo;
@@ -194,9 +199,12 @@ static __u8 *yaffs_GetTempBuffer(yaffs_Device * dev, int lineNo)
 					    dev->tempBuffer[j].line;
 			}
 
+			yaffs_UnlockBuffers(dev);
 			return dev->tempBuffer[i].buffer;
 		}
 	}
+	dev->unmanagedTempAllocations++;
+	yaffs_UnlockBuffers(dev);
 
 	T(YAFFS_TRACE_BUFFERS,
 	  (TSTR("Out of temp buffers at line %d, other held by lines:"),
@@ -211,7 +219,6 @@ static __u8 *yaffs_GetTempBuffer(yaffs_Device * dev, int lineNo)
 	 * This is not good.
 	 */
 
-	dev->unmanagedTempAllocations++;
 	return YMALLOC(dev->nDataBytesPerChunk);
 
 }
@@ -220,12 +227,18 @@ static void yaffs_ReleaseTempBuffer(yaffs_Device * dev, __u8 * buffer,
 				    int lineNo)
 {
 	int i;
+
+	yaffs_LockBuffers(dev);
 	for (i = 0; i < YAFFS_N_TEMP_BUFFERS; i++) {
 		if (dev->tempBuffer[i].buffer == buffer) {
 			dev->tempBuffer[i].line = 0;
+			yaffs_UnlockBuffers(dev);
 			return;
 		}
 	}
+	if (buffer)
+		dev->unmanagedTempDeallocations++;
+	yaffs_UnlockBuffers(dev);
 
 	if (buffer) {
 		/* assume it is an unmanaged one. */
@@ -233,7 +246,6 @@ static void yaffs_ReleaseTempBuffer(yaffs_Device * dev, __u8 * buffer,
 		  (TSTR("Releasing unmanaged temp buffer in line %d" TENDSTR),
 		   lineNo));
 		YFREE(buffer);
-		dev->unmanagedTempDeallocations++;
 	}
 
 }
@@ -565,9 +577,13 @@ static void yaffs_HandleWriteChunkError(yaffs_Device * dev, int chunkInNAND, int
 
 /*---------------- Name handling functions ------------*/ 
 
+/* The name sum is only ever kept in RAM, so it can be any hash of the name.
+ * It is used to index big directories, so it had better spread similar
+ * names well: this is a 32 bit FNV-1a hash folded to 16 bits.
+ */
 static __u16 yaffs_CalcNameSum(const YCHAR * name)
 {
-	__u16 sum = 0;
+	__u32 sum = 2166136261U;
 	__u16 i = 1;
 
 	YUCHAR *bname = (YUCHAR *) name;
@@ -575,15 +591,16 @@ static __u16 yaffs_CalcNameSum(const YCHAR * name)
 		while ((*bname) && (i <= YAFFS_MAX_NAME_LENGTH)) {
 
 #ifdef CONFIG_YAFFS_CASE_INSENSITIVE
-			sum += yaffs_toupper(*bname) * i;
+			sum ^= yaffs_toupper(*bname);
 #else
-			sum += (*bname) * i;
+			sum ^= (*bname);
 #endif
+			sum *= 16777619U;
 			i++;
 			bname++;
 		}
 	}
-	return sum;
+	return (__u16)((sum >> 16) ^ sum);
 }
 
 static void yaffs_SetObjectName(yaffs_Object * obj, const YCHAR * name)
@@ -610,6 +627,47 @@ static void yaffs_SetObjectName(yaffs_Object * obj, const YCHAR * name)
  * Don't use this function directly
  */
 
+#ifdef __KERNEL__
+
+/* Under Linux the tnodes come from a slab cache sized for this device's
+ * tnode width, so they are fetched one at a time and the free list is
+ * only a small reserve in front of the cache.
+ */
+#define YAFFS_TNODE_BATCH	1
+
+static int yaffs_CreateTnodes(yaffs_Device * dev, int nTnodes)
+{
+	yaffs_Tnode *tn;
+
+	while (nTnodes-- > 0) {
+		tn = kmem_cache_alloc(dev->tnodeCache, GFP_NOFS);
+		if (!tn) {
+			T(YAFFS_TRACE_ERROR,
+			  (TSTR("yaffs: Could not allocate Tnodes" TENDSTR)));
+			return YAFFS_FAIL;
+		}
+#ifdef CONFIG_YAFFS_TNODE_LIST_DEBUG
+		tn->internal[YAFFS_NTNODES_INTERNAL] = (void *)1;
+#endif
+		tn->internal[0] = dev->freeTnodes;
+		dev->freeTnodes = tn;
+		dev->nFreeTnodes++;
+		dev->nTnodesCreated++;
+	}
+
+	return YAFFS_OK;
+}
+
+static void yaffs_ReleaseTnode(yaffs_Device * dev, yaffs_Tnode * tn)
+{
+	kmem_cache_free(dev->tnodeCache, tn);
+	dev->nTnodesCreated--;
+}
+
+#else
+
+#define YAFFS_TNODE_BATCH	YAFFS_ALLOCATION_NTNODES
+
 static int yaffs_CreateTnodes(yaffs_Device * dev, int nTnodes)
 {
 	int i;
@@ -692,6 +750,8 @@ static int yaffs_CreateTnodes(yaffs_Device * dev, int nTnodes)
 	return YAFFS_OK;
 }
 
+#endif
+
 /* GetTnode gets us a clean tnode. Tries to make allocate more if we run out */
 
 static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device * dev)
@@ -700,7 +760,7 @@ static yaffs_Tnode *yaffs_GetTnodeRaw(yaffs_Device * dev)
 
 	/* If there are none left make more */
 	if (!dev->freeTnodes) {
-		yaffs_CreateTnodes(dev, YAFFS_ALLOCATION_NTNODES);
+		yaffs_CreateTnodes(dev, YAFFS_TNODE_BATCH);
 	}
 
 	if (dev->freeTnodes) {
@@ -740,6 +800,12 @@ static void yaffs_FreeTnode(yaffs_Device * dev, yaffs_Tnode * tn)
 			  (TSTR("yaffs: Tnode list bug 2" TENDSTR)));
 		}
 		tn->internal[YAFFS_NTNODES_INTERNAL] = (void *)1;
+#endif
+#ifdef __KERNEL__
+		if (dev->nFreeTnodes >= YAFFS_ALLOCATION_NTNODES) {
+			yaffs_ReleaseTnode(dev, tn);
+			return;
+		}
 #endif
 		tn->internal[0] = dev->freeTnodes;
 		dev->freeTnodes = tn;
@@ -747,6 +813,59 @@ static void yaffs_FreeTnode(yaffs_Device * dev, yaffs_Tnode * tn)
 	}
 }
 
+#ifdef __KERNEL__
+
+static void yaffs_ReleaseTnodeTree(yaffs_Device * dev, yaffs_Tnode * tn,
+				   int level)
+{
+	int i;
+
+	if (!tn)
+		return;
+
+	if (level > 0) {
+		for (i = 0; i < YAFFS_NTNODES_INTERNAL; i++)
+			yaffs_ReleaseTnodeTree(dev, tn->internal[i], level - 1);
+	}
+	yaffs_ReleaseTnode(dev, tn);
+}
+
+static void yaffs_DeinitialiseTnodes(yaffs_Device * dev)
+{
+	/* The tnodes in use hang off the files, so walk them back
+	 * to the cache along with the spare ones.
+	 */
+	struct list_head *i;
+	yaffs_Object *obj;
+	yaffs_Tnode *tn;
+	int bucket;
+
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->objectBucket[bucket].list) {
+			obj = list_entry(i, yaffs_Object, hashLink);
+			if (obj->variantType != YAFFS_OBJECT_TYPE_FILE)
+				continue;
+			yaffs_ReleaseTnodeTree(dev, obj->variant.fileVariant.top,
+					       obj->variant.fileVariant.topLevel);
+			obj->variant.fileVariant.top = NULL;
+		}
+	}
+
+	while (dev->freeTnodes) {
+		tn = dev->freeTnodes;
+		dev->freeTnodes = tn->internal[0];
+		yaffs_ReleaseTnode(dev, tn);
+	}
+	dev->nFreeTnodes = 0;
+
+	if (dev->nTnodesCreated)
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: %d tnodes leaked" TENDSTR),
+		   dev->nTnodesCreated));
+}
+
+#else
+
 static void yaffs_DeinitialiseTnodes(yaffs_Device * dev)
 {
 	/* Free the list of allocated tnodes */
@@ -765,6 +884,8 @@ static void yaffs_DeinitialiseTnodes(yaffs_Device * dev)
 	dev->nFreeTnodes = 0;
 }
 
+#endif
+
 static void yaffs_InitialiseTnodes(yaffs_Device * dev)
 {
 	dev->allocatedTnodeList = NULL;
@@ -1311,6 +1432,42 @@ static int yaffs_PruneFileStructure(yaffs_Device * dev,
 /* yaffs_CreateFreeObjects creates a bunch more objects and
  * adds them to the object free list.
  */
+#ifdef __KERNEL__
+
+/* As with the tnodes, objects come from a slab cache one at a time */
+#define YAFFS_OBJECT_BATCH	1
+
+static int yaffs_CreateFreeObjects(yaffs_Device * dev, int nObjects)
+{
+	yaffs_Object *obj;
+
+	while (nObjects-- > 0) {
+		obj = kmem_cache_alloc(dev->objectCache, GFP_NOFS);
+		if (!obj) {
+			T(YAFFS_TRACE_ALLOCATE,
+			  (TSTR("yaffs: Could not allocate more objects"
+				TENDSTR)));
+			return YAFFS_FAIL;
+		}
+		obj->siblings.next = (struct list_head *)dev->freeObjects;
+		dev->freeObjects = obj;
+		dev->nFreeObjects++;
+		dev->nObjectsCreated++;
+	}
+
+	return YAFFS_OK;
+}
+
+static void yaffs_ReleaseObject(yaffs_Device * dev, yaffs_Object * obj)
+{
+	kmem_cache_free(dev->objectCache, obj);
+	dev->nObjectsCreated--;
+}
+
+#else
+
+#define YAFFS_OBJECT_BATCH	YAFFS_ALLOCATION_NOBJECTS
+
 static int yaffs_CreateFreeObjects(yaffs_Device * dev, int nObjects)
 {
 	int i;
@@ -1355,6 +1512,8 @@ static int yaffs_CreateFreeObjects(yaffs_Device * dev, int nObjects)
 	return YAFFS_OK;
 }
 
+#endif
+
 
 /* AllocateEmptyObject gets us a clean Object. Tries to make allocate more if we run out */
 static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device * dev)
@@ -1363,7 +1522,7 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device * dev)
 
 	/* If there are none left make more */
 	if (!dev->freeObjects) {
-		yaffs_CreateFreeObjects(dev, YAFFS_ALLOCATION_NOBJECTS);
+		yaffs_CreateFreeObjects(dev, YAFFS_OBJECT_BATCH);
 	}
 
 	if (dev->freeObjects) {
@@ -1381,6 +1540,7 @@ static yaffs_Object *yaffs_AllocateEmptyObject(yaffs_Device * dev)
 		INIT_LIST_HEAD(&(tn->hardLinks));
 		INIT_LIST_HEAD(&(tn->hashLink));
 		INIT_LIST_HEAD(&tn->siblings);
+		INIT_LIST_HEAD(&tn->nameLink);
 
 		/* Add it to the lost and found directory.
 		 * NB Can't put root or lostNFound in lostNFound so
@@ -1447,6 +1607,16 @@ static void yaffs_FreeObject(yaffs_Object * tn)
 
 	yaffs_UnhashObject(tn);
 
+	if (tn->variantType == YAFFS_OBJECT_TYPE_DIRECTORY)
+		yaffs_DestroyDirectoryIndex(tn);
+
+#ifdef __KERNEL__
+	if (dev->nFreeObjects >= YAFFS_ALLOCATION_NOBJECTS) {
+		yaffs_ReleaseObject(dev, tn);
+		return;
+	}
+#endif
+
 	/* Link into the free list. */
 	tn->siblings.next = (struct list_head *)(dev->freeObjects);
 	dev->freeObjects = tn;
@@ -1468,8 +1638,46 @@ static void yaffs_DeinitialiseObjects(yaffs_Device * dev)
 {
 	/* Free the list of allocated Objects */
 
+#ifdef __KERNEL__
+	struct list_head *n;
+#else
 	yaffs_ObjectList *tmp;
+#endif
+	struct list_head *i;
+	yaffs_Object *obj;
+	int bucket;
+
+	/* Free the directory indexes first */
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each(i, &dev->objectBucket[bucket].list) {
+			obj = list_entry(i, yaffs_Object, hashLink);
+			if (obj->variantType == YAFFS_OBJECT_TYPE_DIRECTORY)
+				yaffs_DestroyDirectoryIndex(obj);
+		}
+	}
+
+#ifdef __KERNEL__
+	/* Everything still in use is in the hash table */
+	for (bucket = 0; bucket < YAFFS_NOBJECT_BUCKETS; bucket++) {
+		list_for_each_safe(i, n, &dev->objectBucket[bucket].list) {
+			obj = list_entry(i, yaffs_Object, hashLink);
+			list_del_init(&obj->hashLink);
+			yaffs_ReleaseObject(dev, obj);
+		}
+		dev->objectBucket[bucket].count = 0;
+	}
 
+	while (dev->freeObjects) {
+		obj = dev->freeObjects;
+		dev->freeObjects = (yaffs_Object *) (obj->siblings.next);
+		yaffs_ReleaseObject(dev, obj);
+	}
+
+	if (dev->nObjectsCreated)
+		T(YAFFS_TRACE_ERROR,
+		  (TSTR("yaffs: %d objects leaked" TENDSTR),
+		   dev->nObjectsCreated));
+#else
 	while (dev->allocatedObjectList) {
 		tmp = dev->allocatedObjectList->next;
 		YFREE(dev->allocatedObjectList->objects);
@@ -1477,11 +1685,44 @@ static void yaffs_DeinitialiseObjects(yaffs_Device * dev)
 
 		dev->allocatedObjectList = tmp;
 	}
+#endif
 
 	dev->freeObjects = NULL;
 	dev->nFreeObjects = 0;
 }
 
+#ifdef __KERNEL__
+
+/* Hand up to nToFree spare tnodes and objects back to the slab caches.
+ * Called by the shrinker with the gross lock held.
+ */
+int yaffs_ShrinkFreeLists(yaffs_Device * dev, int nToFree)
+{
+	yaffs_Tnode *tn;
+	yaffs_Object *obj;
+	int nFreed = 0;
+
+	while (nFreed < nToFree && dev->freeTnodes) {
+		tn = dev->freeTnodes;
+		dev->freeTnodes = tn->internal[0];
+		dev->nFreeTnodes--;
+		yaffs_ReleaseTnode(dev, tn);
+		nFreed++;
+	}
+
+	while (nFreed < nToFree && dev->freeObjects) {
+		obj = dev->freeObjects;
+		dev->freeObjects = (yaffs_Object *) (obj->siblings.next);
+		dev->nFreeObjects--;
+		yaffs_ReleaseObject(dev, obj);
+		nFreed++;
+	}
+
+	return nFreed;
+}
+
+#endif
+
 static void yaffs_InitialiseObjects(yaffs_Device * dev)
 {
 	int i;
@@ -2611,6 +2852,45 @@ static int yaffs_CheckGarbageCollection(yaffs_Device * dev)
 	return aggressive ? gcOk : YAFFS_OK;
 }
 
+/* Background garbage collection
+ * Collects one block if there are fewer than erasedTarget erased blocks and
+ * there is a block with at least minDirtyChunks discarded chunks (or one that
+ * is prioritised for gc). This is done while the device is idle, so that the
+ * write path rarely has to collect garbage itself.
+ * Nothing is done while a checkpoint is valid: the file system has not
+ * changed since and a gc would only discard the checkpoint.
+ * Returns 1 if a block was collected, 0 if there was nothing worth doing.
+ */
+int yaffs_BackgroundGarbageCollect(yaffs_Device * dev, int erasedTarget,
+				   int minDirtyChunks)
+{
+	int block;
+	int dirtyChunks;
+	yaffs_BlockInfo *bi;
+
+	if (dev->isDoingGC || dev->isCheckpointed ||
+	    dev->nErasedBlocks >= erasedTarget)
+		return 0;
+
+	block = yaffs_FindBlockForGarbageCollection(dev, 1);
+	if (block <= 0)
+		return 0;
+
+	bi = yaffs_GetBlockInfo(dev, block);
+	dirtyChunks = dev->nChunksPerBlock - (bi->pagesInUse - bi->softDeletions);
+	if (!bi->gcPrioritise && dirtyChunks < minDirtyChunks)
+		return 0;
+
+	dev->garbageCollections++;
+	dev->backgroundGarbageCollections++;
+
+	T(YAFFS_TRACE_GC,
+	  (TSTR("yaffs: background GC erasedBlocks %d block %d dirty %d"
+		TENDSTR), dev->nErasedBlocks, block, dirtyChunks));
+
+	return (yaffs_GarbageCollectBlock(dev, block) == YAFFS_OK) ? 1 : 0;
+}
+
 /*-------------------------  TAGS --------------------------------*/
 
 static int yaffs_TagsMatch(const yaffs_ExtendedTags * tags, int objectId,
@@ -2894,6 +3174,40 @@ static int yaffs_ReadChunkDataFromObject(yaffs_Object * in, int chunkInInode,
 
 }
 
+/* Read up to maxChunks whole chunks starting at chunkInInode, as one NAND
+ * request for as long as they sit in consecutive pages and aren't cached.
+ * Returns the number of chunks read.
+ */
+static int yaffs_ReadChunkRunFromObject(yaffs_Object * in, int chunkInInode,
+					__u8 * buffer, int maxChunks)
+{
+	yaffs_Device *dev = in->myDev;
+	int chunkInNAND;
+	int nChunks;
+
+	if (maxChunks > YAFFS_MAX_CHUNK_RUN)
+		maxChunks = YAFFS_MAX_CHUNK_RUN;
+
+	chunkInNAND = yaffs_FindChunkInFile(in, chunkInInode, NULL);
+
+	if (chunkInNAND < 0 || maxChunks < 2 || !dev->readChunksFromNAND) {
+		yaffs_ReadChunkDataFromObject(in, chunkInInode, buffer);
+		return 1;
+	}
+
+	for (nChunks = 1; nChunks < maxChunks; nChunks++) {
+		if (yaffs_FindChunkCache(in, chunkInInode + nChunks))
+			break;
+		if (yaffs_FindChunkInFile(in, chunkInInode + nChunks, NULL) !=
+		    chunkInNAND + nChunks)
+			break;
+	}
+
+	yaffs_ReadChunksFromNAND(dev, chunkInNAND, nChunks, buffer);
+
+	return nChunks;
+}
+
 void yaffs_DeleteChunk(yaffs_Device * dev, int chunkId, int markNAND, int lyn)
 {
 	int block;
@@ -3001,6 +3315,97 @@ static int yaffs_WriteChunkDataToObject(yaffs_Object * in, int chunkInInode,
 
 }
 
+/* Write a run of whole chunks to consecutive pages of the allocation
+ * block in one NAND request. Returns the number of chunks written, or 0 if
+ * the run can't be done that way and the chunks should be written one by
+ * one through yaffs_WriteChunkDataToObject, which copes with bad pages.
+ */
+static int yaffs_WriteChunkRunToObject(yaffs_Object * in, int chunkInInode,
+				       const __u8 * buffer, int nChunks)
+{
+	yaffs_Device *dev = in->myDev;
+	yaffs_ExtendedTags tags[YAFFS_MAX_CHUNK_RUN];
+	yaffs_ExtendedTags prevTags;
+	int prevChunkId[YAFFS_MAX_CHUNK_RUN];
+	yaffs_BlockInfo *bi;
+	int firstChunk;
+	int chunk;
+	int i;
+
+#ifdef CONFIG_YAFFS_ALWAYS_CHECK_CHUNK_ERASED
+	/* Every chunk has to be checked before it is written */
+	return 0;
+#endif
+
+	if (!dev->writeChunksWithTagsToNAND || nChunks < 2)
+		return 0;
+
+	if (nChunks > YAFFS_MAX_CHUNK_RUN)
+		nChunks = YAFFS_MAX_CHUNK_RUN;
+
+	yaffs_CheckGarbageCollection(dev);
+
+	/* Only runs that fit in a block already known to be good and erased.
+	 * Everything else goes the careful way.
+	 */
+	if (dev->allocationBlock < 0 ||
+	    dev->allocationPage + nChunks > dev->nChunksPerBlock)
+		return 0;
+
+	bi = yaffs_GetBlockInfo(dev, dev->allocationBlock);
+	if (bi->gcPrioritise || !bi->skipErasedCheck)
+		return 0;
+
+	yaffs_InvalidateCheckpoint(dev);
+
+	firstChunk = -1;
+	for (i = 0; i < nChunks; i++) {
+		chunk = yaffs_AllocateChunk(dev, 0, NULL);
+		if (chunk < 0) {
+			/* Ran into the reserve. Give back what we took. */
+			while (i-- > 0)
+				yaffs_DeleteChunk(dev, firstChunk + i, 0,
+						  __LINE__);
+			return 0;
+		}
+		if (i == 0)
+			firstChunk = chunk;
+
+		prevChunkId[i] = yaffs_FindChunkInFile(in, chunkInInode + i,
+						       &prevTags);
+
+		yaffs_InitialiseTags(&tags[i]);
+		tags[i].chunkId = chunkInInode + i;
+		tags[i].objectId = in->objectId;
+		tags[i].serialNumber =
+		    (prevChunkId[i] >= 0) ? prevTags.serialNumber + 1 : 1;
+		tags[i].byteCount = dev->nDataBytesPerChunk;
+	}
+
+	if (yaffs_WriteChunksWithTagsToNAND(dev, firstChunk, nChunks, buffer,
+					    tags) != YAFFS_OK) {
+		/* Don't know which page went bad, so retire the block and
+		 * let the caller rewrite the run a chunk at a time.
+		 */
+		yaffs_HandleWriteChunkError(dev, firstChunk, 1);
+		for (i = 1; i < nChunks; i++)
+			yaffs_DeleteChunk(dev, firstChunk + i, 1, __LINE__);
+		return 0;
+	}
+
+	for (i = 0; i < nChunks; i++) {
+		yaffs_HandleWriteChunkOk(dev, firstChunk + i, buffer, &tags[i]);
+		yaffs_PutChunkIntoFile(in, chunkInInode + i, firstChunk + i, 0);
+		if (prevChunkId[i] >= 0)
+			yaffs_DeleteChunk(dev, prevChunkId[i], 1, __LINE__);
+		buffer += dev->nDataBytesPerChunk;
+	}
+
+	yaffs_CheckFileSanity(in);
+
+	return nChunks;
+}
+
 /* UpdateObjectHeader updates the header on NAND for an object.
  * If name is not NULL, then that new name is used.
  */
@@ -3367,18 +3772,22 @@ static yaffs_ChunkCache *yaffs_FindChunkCache(const yaffs_Object * obj,
 					      int chunkId)
 {
 	yaffs_Device *dev = obj->myDev;
+	yaffs_ChunkCache *cache = NULL;
 	int i;
 	if (dev->nShortOpCaches > 0) {
+		yaffs_LockCache(dev);
 		for (i = 0; i < dev->nShortOpCaches; i++) {
 			if (dev->srCache[i].object == obj &&
 			    dev->srCache[i].chunkId == chunkId) {
 				dev->cacheHits++;
 
-				return &dev->srCache[i];
+				cache = &dev->srCache[i];
+				break;
 			}
 		}
+		yaffs_UnlockCache(dev);
 	}
-	return NULL;
+	return cache;
 }
 
 /* Mark the chunk for the least recently used algorithym */
@@ -3387,6 +3796,7 @@ static void yaffs_UseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache,
 {
 
 	if (dev->nShortOpCaches > 0) {
+		yaffs_LockCache(dev);
 		if (dev->srLastUse < 0 || dev->srLastUse > 100000000) {
 			/* Reset the cache usages */
 			int i;
@@ -3403,6 +3813,7 @@ static void yaffs_UseChunkCache(yaffs_Device * dev, yaffs_ChunkCache * cache,
 		if (isAWrite) {
 			cache->dirty = 1;
 		}
+		yaffs_UnlockCache(dev);
 	}
 }
 
@@ -3935,27 +4346,16 @@ int yaffs_ReadDataFromFile(yaffs_Object * in, __u8 * buffer, loff_t offset,
 
 		cache = yaffs_FindChunkCache(in, chunk);
 
-		/* If the chunk is already in the cache or it is less than a whole chunk
-		 * then use the cache (if there is caching)
+		/* If the chunk is already in the cache then use the cache,
+		 * if it is less than a whole chunk then use a local buffer,
 		 * else bypass the cache.
+		 *
+		 * Reads can run in parallel with each other, so a chunk that
+		 * is not cached is never loaded into the cache here: grabbing
+		 * a cache entry might mean flushing a dirty one.
 		 */
 		if (cache || nToCopy != dev->nDataBytesPerChunk) {
-			if (dev->nShortOpCaches > 0) {
-
-				/* If we can't find the data in the cache, then load it up. */
-
-				if (!cache) {
-					cache = yaffs_GrabChunkCache(in->myDev);
-					cache->object = in;
-					cache->chunkId = chunk;
-					cache->dirty = 0;
-					cache->locked = 0;
-					yaffs_ReadChunkDataFromObject(in, chunk,
-								      cache->
-								      data);
-					cache->nBytes = 0;
-				}
-
+			if (cache) {
 				yaffs_UseChunkCache(dev, cache, 0);
 
 				cache->locked = 1;
@@ -4008,8 +4408,12 @@ int yaffs_ReadDataFromFile(yaffs_Object * in, __u8 * buffer, loff_t offset,
 #endif
 
 #else
-			/* A full chunk. Read directly into the supplied buffer. */
-			yaffs_ReadChunkDataFromObject(in, chunk, buffer);
+			/* A full chunk. Read directly into the supplied buffer,
+			 * along with any whole chunks that follow it on NAND.
+			 */
+			nToCopy = dev->nDataBytesPerChunk *
+			    yaffs_ReadChunkRunFromObject(in, chunk, buffer,
+					n / dev->nDataBytesPerChunk);
 #endif
 		}
 
@@ -4036,6 +4440,9 @@ int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 	int startOfWrite = offset;
 	int chunkWritten = 0;
 	int nBytesRead;
+#ifndef CONFIG_YAFFS_WINCE
+	int nRun;
+#endif
 
 	yaffs_Device *dev;
 
@@ -4184,11 +4591,22 @@ int yaffs_WriteDataToFile(yaffs_Object * in, const __u8 * buffer, loff_t offset,
 							 0);
 			yaffs_ReleaseTempBuffer(dev, localBuffer, __LINE__);
 #else
-			/* A full chunk. Write directly from the supplied buffer. */
-			chunkWritten =
-			    yaffs_WriteChunkDataToObject(in, chunk, buffer,
-							 dev->nDataBytesPerChunk,
-							 0);
+			/* A full chunk. Write directly from the supplied buffer,
+			 * together with any whole chunks that follow it.
+			 */
+			nRun = yaffs_WriteChunkRunToObject(in, chunk, buffer,
+					n / dev->nDataBytesPerChunk);
+			if (nRun > 0) {
+				nToCopy = nRun * dev->nDataBytesPerChunk;
+				while (--nRun > 0)
+					yaffs_InvalidateChunkCache(in,
+								   chunk + nRun);
+			} else
+				chunkWritten =
+				    yaffs_WriteChunkDataToObject(in, chunk,
+							buffer,
+							dev->nDataBytesPerChunk,
+							0);
 #endif
 			/* Since we've overwritten the cached data, we better invalidate it. */
 			yaffs_InvalidateChunkCache(in, chunk);
@@ -5165,7 +5583,8 @@ static int yaffs_Scan(yaffs_Device * dev)
 	return YAFFS_OK;
 }
 
-static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
+/* Loads the details of a lazy loaded object. Called with detailsLock held. */
+static void yaffs_LoadObjectDetails(yaffs_Object *in)
 {
 	__u8 *chunkData;
 	yaffs_ObjectHeader *oh;
@@ -5180,7 +5599,6 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 #endif
 		
 	if(in->lazyLoaded){
-		in->lazyLoaded = 0;
 		chunkData = yaffs_GetTempBuffer(dev, __LINE__);
 
 		result = yaffs_ReadChunkWithTagsFromNAND(dev,in->chunkId,chunkData,&tags);
@@ -5210,9 +5628,24 @@ static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
 						    yaffs_CloneString(oh->alias);
 						    
 		yaffs_ReleaseTempBuffer(dev,chunkData, __LINE__);
+		in->lazyLoaded = 0;
 	}
 }
 
+static void yaffs_CheckObjectDetailsLoaded(yaffs_Object *in)
+{
+	if(!in->lazyLoaded)
+		return;
+
+	/* Lookups may run in parallel, so only one of them loads the details
+	 * and the others wait for it. lazyLoaded is only cleared once the
+	 * details are all there.
+	 */
+	yaffs_LockDetails(in->myDev);
+	yaffs_LoadObjectDetails(in);
+	yaffs_UnlockDetails(in->myDev);
+}
+
 static int yaffs_ScanBackwards(yaffs_Device * dev)
 {
 	yaffs_ExtendedTags tags;
@@ -5867,12 +6300,122 @@ static int yaffs_ScanBackwards(yaffs_Device * dev)
 
 /*------------------------------  Directory Functions ----------------------------- */
 
+/* Big directories get a name index, a hash table of their children keyed by
+ * the name sum, so that looking a name up does not have to walk the whole
+ * list of children. The index is built by the first lookup in a directory
+ * with more than YAFFS_DIR_INDEX_MIN children, and then kept up to date as
+ * objects are added and removed. When it gets too crowded, or would have to
+ * take in an object whose name is not loaded yet, it is dropped and the next
+ * lookup builds a new one.
+ *
+ * Objects with made up names (lost+found and those with no object header)
+ * are kept on a separate list that every lookup checks.
+ */
+
+static int yaffs_HasMadeUpName(yaffs_Object * obj)
+{
+	return (obj->objectId == YAFFS_OBJECTID_LOSTNFOUND || obj->chunkId <= 0);
+}
+
+static void yaffs_IndexObject(yaffs_DirectoryIndex * index, yaffs_Object * obj)
+{
+	if (yaffs_HasMadeUpName(obj))
+		list_add(&obj->nameLink, &index->madeUp);
+	else
+		list_add(&obj->nameLink,
+			 &index->bucket[obj->sum & (index->nBuckets - 1)]);
+	index->nEntries++;
+}
+
+static void yaffs_DestroyDirectoryIndex(yaffs_Object * directory)
+{
+	yaffs_DirectoryIndex *index = directory->variant.directoryVariant.index;
+	struct list_head *i;
+	yaffs_Object *l;
+
+	if (!index)
+		return;
+
+	list_for_each(i, &directory->variant.directoryVariant.children) {
+		l = list_entry(i, yaffs_Object, siblings);
+		list_del_init(&l->nameLink);
+	}
+
+	directory->variant.directoryVariant.index = NULL;
+	YFREE(index);
+}
+
+/* Builds the name index of a directory if it is big enough to need one.
+ * Lookups may run in parallel, so this is done with detailsLock held, and the
+ * index is only published once it is complete.
+ */
+static yaffs_DirectoryIndex *yaffs_GetDirectoryIndex(yaffs_Object * directory)
+{
+	yaffs_DirectoryStructure *dir = &directory->variant.directoryVariant;
+	yaffs_DirectoryIndex *index;
+	struct list_head *i;
+	yaffs_Object *l;
+	int nChildren = 0;
+	int nBuckets;
+	int b;
+
+	if (dir->index)
+		return dir->index;
+
+	list_for_each(i, &dir->children) {
+		nChildren++;
+	}
+
+	if (nChildren <= YAFFS_DIR_INDEX_MIN)
+		return NULL;
+
+	yaffs_LockDetails(directory->myDev);
+
+	index = dir->index;
+	if (index)
+		goto out;
+
+	for (nBuckets = YAFFS_DIR_INDEX_MIN; nBuckets < nChildren; nBuckets <<= 1) {
+	}
+
+	index = YMALLOC(sizeof(yaffs_DirectoryIndex) +
+			(nBuckets - 1) * sizeof(struct list_head));
+	if (!index)
+		goto out;
+
+	index->nBuckets = nBuckets;
+	index->nEntries = 0;
+	INIT_LIST_HEAD(&index->madeUp);
+	for (b = 0; b < nBuckets; b++)
+		INIT_LIST_HEAD(&index->bucket[b]);
+
+	list_for_each(i, &dir->children) {
+		l = list_entry(i, yaffs_Object, siblings);
+		yaffs_LoadObjectDetails(l);
+		yaffs_IndexObject(index, l);
+	}
+
+	T(YAFFS_TRACE_OS,
+	  (TSTR("yaffs: indexed directory %d, %d entries in %d buckets" TENDSTR),
+	   directory->objectId, nChildren, nBuckets));
+
+	dir->index = index;
+out:
+	yaffs_UnlockDetails(directory->myDev);
+	return index;
+}
+
 static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj)
 {
 	yaffs_Device *dev = obj->myDev;
 	
 	if(dev && dev->removeObjectCallback)
 		dev->removeObjectCallback(obj);
+
+	if (!list_empty(&obj->nameLink)) {
+		list_del_init(&obj->nameLink);
+		obj->parent->variant.directoryVariant.index->nEntries--;
+	}
 	   
 	list_del_init(&obj->siblings);
 	obj->parent = NULL;
@@ -5882,6 +6425,7 @@ static void yaffs_RemoveObjectFromDirectory(yaffs_Object * obj)
 static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 				       yaffs_Object * obj)
 {
+	yaffs_DirectoryIndex *index;
 
 	if (!directory) {
 		T(YAFFS_TRACE_ALWAYS,
@@ -5910,6 +6454,14 @@ static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 	list_add(&obj->siblings, &directory->variant.directoryVariant.children);
 	obj->parent = directory;
 
+	index = directory->variant.directoryVariant.index;
+	if (index) {
+		if (obj->lazyLoaded || index->nEntries >= 2 * index->nBuckets)
+			yaffs_DestroyDirectoryIndex(directory);
+		else
+			yaffs_IndexObject(index, obj);
+	}
+
 	if (directory == obj->myDev->unlinkedDir
 	    || directory == obj->myDev->deletedDir) {
 		obj->unlinked = 1;
@@ -5918,6 +6470,26 @@ static void yaffs_AddObjectToDirectory(yaffs_Object * directory,
 	}
 }
 
+/* Checks if an object of a directory has the given name and name sum */
+static int yaffs_ObjectNameMatches(yaffs_Object * l, const YCHAR * name,
+				   int sum, YCHAR * buffer)
+{
+	yaffs_CheckObjectDetailsLoaded(l);
+
+	/* Special case for lost-n-found */
+	if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND) {
+		return yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0;
+	} else if (yaffs_SumCompare(l->sum, sum) || l->chunkId <= 0) {
+		/* LostnFound cunk called Objxxx
+		 * Do a real check
+		 */
+		yaffs_GetObjectName(l, buffer, YAFFS_MAX_NAME_LENGTH);
+		return yaffs_strcmp(name, buffer) == 0;
+	}
+
+	return 0;
+}
+
 yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
 				     const YCHAR * name)
 {
@@ -5927,6 +6499,7 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
 	YCHAR buffer[YAFFS_MAX_NAME_LENGTH + 1];
 
 	yaffs_Object *l;
+	yaffs_DirectoryIndex *index;
 
 	if (!name) {
 		return NULL;
@@ -5948,29 +6521,28 @@ yaffs_Object *yaffs_FindObjectByName(yaffs_Object * directory,
 
 	sum = yaffs_CalcNameSum(name);
 
+	index = yaffs_GetDirectoryIndex(directory);
+	if (index) {
+		list_for_each(i, &index->bucket[sum & (index->nBuckets - 1)]) {
+			l = list_entry(i, yaffs_Object, nameLink);
+			if (yaffs_ObjectNameMatches(l, name, sum, buffer))
+				return l;
+		}
+
+		list_for_each(i, &index->madeUp) {
+			l = list_entry(i, yaffs_Object, nameLink);
+			if (yaffs_ObjectNameMatches(l, name, sum, buffer))
+				return l;
+		}
+
+		return NULL;
+	}
+
 	list_for_each(i, &directory->variant.directoryVariant.children) {
 		if (i) {
 			l = list_entry(i, yaffs_Object, siblings);
-			
-			yaffs_CheckObjectDetailsLoaded(l);
-
-			/* Special case for lost-n-found */
-			if (l->objectId == YAFFS_OBJECTID_LOSTNFOUND) {
-				if (yaffs_strcmp(name, YAFFS_LOSTNFOUND_NAME) == 0) {
-					return l;
-				}
-			} else if (yaffs_SumCompare(l->sum, sum) || l->chunkId <= 0)	
-			{
-				/* LostnFound cunk called Objxxx
-				 * Do a real check
-				 */
-				yaffs_GetObjectName(l, buffer,
-						    YAFFS_MAX_NAME_LENGTH);
-				if (yaffs_strcmp(name, buffer) == 0) {
-					return l;
-				}
-
-			}
+			if (yaffs_ObjectNameMatches(l, name, sum, buffer))
+				return l;
 		}
 	}
 
@@ -6432,11 +7004,24 @@ int yaffs_GutsInitialise(yaffs_Device * dev)
 		return YAFFS_FAIL;
 	}
 
+#ifdef __KERNEL__
+	dev->tnodeCache =
+	    yaffs_TnodeCache((dev->tnodeWidth * YAFFS_NTNODES_LEVEL0) / 8);
+	dev->objectCache = yaffs_ObjectCache();
+	if (!dev->tnodeCache || !dev->objectCache) {
+		T(YAFFS_TRACE_ALWAYS,
+		  (TSTR("yaffs: no slab caches for tnodes/objects\n" TENDSTR)));
+
+		return YAFFS_FAIL;
+	}
+#endif
+
 	/* OK, we've finished verifying the device, lets continue with initialisation */
 
 	/* More device initialisation */
 	dev->garbageCollections = 0;
 	dev->passiveGarbageCollections = 0;
+	dev->backgroundGarbageCollections = 0;
 	dev->currentDirtyChecker = 0;
 	dev->bufferedBlock = -1;
 	dev->doingBufferedBlockRewrite = 0;
@@ -60,6 +60,9 @@
 
 #define YAFFS_NOBJECT_BUCKETS		256
 
+/* Longest run of consecutive chunks handed to the NAND in one request */
+#define YAFFS_MAX_CHUNK_RUN		8
+
 
 #define YAFFS_OBJECT_SPACE		0x40000
 
@@ -77,6 +80,9 @@
 
 #define YAFFS_SHORT_NAME_LENGTH		15
 
+/* Directories with more children than this get a name index */
+#define YAFFS_DIR_INDEX_MIN		32
+
 /* Some special object ids for pseudo objects */
 #define YAFFS_OBJECTID_ROOT		1
 #define YAFFS_OBJECTID_LOSTNFOUND	2
@@ -371,8 +377,16 @@ typedef struct {
 	yaffs_Tnode *top;
 } yaffs_FileStructure;
 
+typedef struct {
+	int nBuckets;		/* power of 2 */
+	int nEntries;
+	struct list_head madeUp;	/* children with made up names */
+	struct list_head bucket[1];	/* children by name sum */
+} yaffs_DirectoryIndex;
+
 typedef struct {
 	struct list_head children;	/* list of child links */
+	yaffs_DirectoryIndex *index;	/* name index, NULL if none */
 } yaffs_DirectoryStructure;
 
 typedef struct {
@@ -423,6 +437,7 @@ struct yaffs_ObjectStruct {
 	/* also used for linking up the free list */
 	struct yaffs_ObjectStruct *parent; 
 	struct list_head siblings;
+	struct list_head nameLink;	/* link in the parent's name index */
 
 	/* Where's my object header in NAND? */
 	int chunkId;		
@@ -575,6 +590,13 @@ struct yaffs_DeviceStruct {
 	int (*readChunkWithTagsFromNAND) (struct yaffs_DeviceStruct * dev,
 					  int chunkInNAND, __u8 * data,
 					  yaffs_ExtendedTags * tags);
+	/* Optional. Transfer runs of consecutive chunks in one request */
+	int (*writeChunksWithTagsToNAND) (struct yaffs_DeviceStruct * dev,
+					  int chunkInNAND, int nChunks,
+					  const __u8 * data,
+					  const yaffs_ExtendedTags * tags);
+	int (*readChunksFromNAND) (struct yaffs_DeviceStruct * dev,
+				   int chunkInNAND, int nChunks, __u8 * data);
 	int (*markNANDBlockBad) (struct yaffs_DeviceStruct * dev, int blockNo);
 	int (*queryNANDBlock) (struct yaffs_DeviceStruct * dev, int blockNo,
 			       yaffs_BlockState * state, int *sequenceNumber);
@@ -619,11 +641,24 @@ struct yaffs_DeviceStruct {
 #ifdef __KERNEL__
 
 	struct semaphore sem;	/* Semaphore for waiting on erasure.*/
-	struct semaphore grossLock;	/* Gross locking semaphore */
+	struct rw_semaphore grossLock;	/* Gross locking semaphore. Held shared
+					 * for lookups and reads, exclusive for
+					 * anything that changes the fs.
+					 */
+	struct semaphore nandLock;	/* Serialises NAND access */
+	struct semaphore detailsLock;	/* Serialises lazy loading of objects
+					 * and building of directory indexes
+					 */
+	spinlock_t bufferLock;	/* Protects the temp buffers */
+	spinlock_t cacheLock;	/* Protects short op cache lookups */
 	__u8 *spareBuffer;	/* For mtdif2 use. Don't know the size of the buffer 
 				 * at compile time so we have to allocate it.
 				 */
 	void (*putSuperFunc) (struct super_block * sb);
+	struct task_struct *gcThread;	/* Background garbage collector */
+	unsigned long lastActivity;	/* jiffies when last changed */
+	struct kmem_cache *tnodeCache;	/* Slab caches the tnodes and */
+	struct kmem_cache *objectCache;	/* objects are allocated from */
 #endif
 
 	int isMounted;
@@ -695,6 +730,7 @@ struct yaffs_DeviceStruct {
 	int nGCCopies;
 	int garbageCollections;
 	int passiveGarbageCollections;
+	int backgroundGarbageCollections;
 	int nRetriedWrites;
 	int nRetiredBlocks;
 	int eccFixed;
@@ -745,6 +781,31 @@ struct yaffs_DeviceStruct {
 
 typedef struct yaffs_DeviceStruct yaffs_Device;
 
+/* Fine grained locks used by the guts. Under Linux several lookups and reads
+ * may run at the same time with grossLock held shared, so the state they
+ * touch needs its own locking. Everything else runs with grossLock held
+ * exclusive, which also covers chunk allocation and garbage collection.
+ */
+#ifdef __KERNEL__
+#define yaffs_LockNAND(dev)		down(&(dev)->nandLock)
+#define yaffs_UnlockNAND(dev)		up(&(dev)->nandLock)
+#define yaffs_LockDetails(dev)		down(&(dev)->detailsLock)
+#define yaffs_UnlockDetails(dev)	up(&(dev)->detailsLock)
+#define yaffs_LockBuffers(dev)		spin_lock(&(dev)->bufferLock)
+#define yaffs_UnlockBuffers(dev)	spin_unlock(&(dev)->bufferLock)
+#define yaffs_LockCache(dev)		spin_lock(&(dev)->cacheLock)
+#define yaffs_UnlockCache(dev)		spin_unlock(&(dev)->cacheLock)
+#else
+#define yaffs_LockNAND(dev)		do { } while (0)
+#define yaffs_UnlockNAND(dev)		do { } while (0)
+#define yaffs_LockDetails(dev)		do { } while (0)
+#define yaffs_UnlockDetails(dev)	do { } while (0)
+#define yaffs_LockBuffers(dev)		do { } while (0)
+#define yaffs_UnlockBuffers(dev)	do { } while (0)
+#define yaffs_LockCache(dev)		do { } while (0)
+#define yaffs_UnlockCache(dev)		do { } while (0)
+#endif
+
 /* The static layout of bllock usage etc is stored in the super block header */
 typedef struct {
         int StructType;
@@ -873,6 +934,13 @@ void yfsd_WinFileTimeNow(__u32 target[2]);
 #ifdef __KERNEL__
 
 void yaffs_HandleDeferedFree(yaffs_Object * obj);
+
+/* Slab caches, provided by yaffs_fs.c */
+struct kmem_cache *yaffs_TnodeCache(int tnodeSize);
+struct kmem_cache *yaffs_ObjectCache(void);
+
+/* Give spare tnodes and objects back to the slab caches */
+int yaffs_ShrinkFreeLists(yaffs_Device * dev, int nToFree);
 #endif
 
 /* Debug dump  */
@@ -886,4 +954,8 @@ void yaffs_DeleteChunk(yaffs_Device * dev, int chunkId, int markNAND, int lyn);
 int yaffs_CheckFF(__u8 * buffer, int nBytes);
 void yaffs_HandleChunkError(yaffs_Device *dev, yaffs_BlockInfo *bi);
 
+/* Garbage collection when the device is idle */
+int yaffs_BackgroundGarbageCollect(yaffs_Device * dev, int erasedTarget,
+				   int minDirtyChunks);
+
 #endif
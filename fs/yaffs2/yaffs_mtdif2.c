@@ -310,6 +310,90 @@ int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 		return YAFFS_FAIL;
 }
 
+/* Write a run of chunks with one MTD request so the NAND driver can keep
+ * the chip busy, using cache programming where the chip has it.
+ * MTD_OOB_AUTO takes ooblen bytes of tags per page.
+ */
+int nandmtd2_WriteChunksWithTagsToNAND(yaffs_Device * dev, int chunkInNAND,
+				       int nChunks, const __u8 * data,
+				       const yaffs_ExtendedTags * tags)
+{
+#if (LINUX_VERSION_CODE > KERNEL_VERSION(2,6,17))
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	struct mtd_oob_ops ops;
+	__u8 oob[YAFFS_MAX_CHUNK_RUN * sizeof(yaffs_PackedTags2)];
+	yaffs_PackedTags2 pt;
+	int retval;
+	int i;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->nDataBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR
+	   ("nandmtd2_WriteChunksWithTagsToNAND chunk %d count %d data %p"
+	    TENDSTR), chunkInNAND, nChunks, data));
+
+	if (nChunks > YAFFS_MAX_CHUNK_RUN)
+		BUG();
+
+	for (i = 0; i < nChunks; i++) {
+		yaffs_PackTags2(&pt, &tags[i]);
+		nandmtd2_pt2buf(dev, &pt, 0);
+		memcpy(&oob[i * sizeof(pt)], dev->spareBuffer, sizeof(pt));
+	}
+
+	ops.mode = MTD_OOB_AUTO;
+	ops.ooblen = sizeof(pt);
+	ops.len = nChunks * dev->nDataBytesPerChunk;
+	ops.ooboffs = 0;
+	ops.datbuf = (__u8 *)data;
+	ops.oobbuf = oob;
+	retval = mtd->write_oob(mtd, addr, &ops);
+
+	if (retval == 0)
+		return YAFFS_OK;
+	else
+		return YAFFS_FAIL;
+#else
+	int i;
+
+	for (i = 0; i < nChunks; i++) {
+		if (nandmtd2_WriteChunkWithTagsToNAND(dev, chunkInNAND + i,
+				data + i * dev->nDataBytesPerChunk,
+				&tags[i]) != YAFFS_OK)
+			return YAFFS_FAIL;
+	}
+
+	return YAFFS_OK;
+#endif
+}
+
+/* Read the data of a run of chunks with one MTD request.
+ * Anything but a clean read fails the run and yaffs_nand.c falls back to
+ * reading the chunks with their tags one by one.
+ */
+int nandmtd2_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+				int nChunks, __u8 * data)
+{
+	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
+	size_t dummy;
+	int retval;
+
+	loff_t addr = ((loff_t) chunkInNAND) * dev->nDataBytesPerChunk;
+
+	T(YAFFS_TRACE_MTD,
+	  (TSTR("nandmtd2_ReadChunksFromNAND chunk %d count %d data %p"
+		TENDSTR), chunkInNAND, nChunks, data));
+
+	retval = mtd->read(mtd, addr, nChunks * dev->nDataBytesPerChunk,
+			   &dummy, data);
+
+	if (retval == 0)
+		return YAFFS_OK;
+	else
+		return YAFFS_FAIL;
+}
+
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo)
 {
 	struct mtd_info *mtd = (struct mtd_info *)(dev->genericDevice);
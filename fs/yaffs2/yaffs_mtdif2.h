@@ -22,6 +22,11 @@ int nandmtd2_WriteChunkWithTagsToNAND(yaffs_Device * dev, int chunkInNAND,
 				      const yaffs_ExtendedTags * tags);
 int nandmtd2_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 				       __u8 * data, yaffs_ExtendedTags * tags);
+int nandmtd2_WriteChunksWithTagsToNAND(yaffs_Device * dev, int chunkInNAND,
+				       int nChunks, const __u8 * data,
+				       const yaffs_ExtendedTags * tags);
+int nandmtd2_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+				int nChunks, __u8 * data);
 int nandmtd2_MarkNANDBlockBad(struct yaffs_DeviceStruct *dev, int blockNo);
 int nandmtd2_QueryNANDBlock(struct yaffs_DeviceStruct *dev, int blockNo,
 			    yaffs_BlockState * state, int *sequenceNumber);
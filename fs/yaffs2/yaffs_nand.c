@@ -32,6 +32,7 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 	if(!tags)
 		tags = &localTags;
 
+	yaffs_LockNAND(dev);
 	if (dev->readChunkWithTagsFromNAND)
 		result = dev->readChunkWithTagsFromNAND(dev, realignedChunkInNAND, buffer,
 						      tags);
@@ -46,6 +47,7 @@ int yaffs_ReadChunkWithTagsFromNAND(yaffs_Device * dev, int chunkInNAND,
 		yaffs_BlockInfo *bi = yaffs_GetBlockInfo(dev, chunkInNAND/dev->nChunksPerBlock);
                 yaffs_HandleChunkError(dev,bi);
 	}
+	yaffs_UnlockNAND(dev);
 								
 	return result;
 }
@@ -55,6 +57,8 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device * dev,
 						   const __u8 * buffer,
 						   yaffs_ExtendedTags * tags)
 {
+	int result;
+
 	chunkInNAND -= dev->chunkOffset;
 
 	
@@ -74,25 +78,98 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device * dev,
 		YBUG();
 	}
 
+	yaffs_LockNAND(dev);
 	if (dev->writeChunkWithTagsToNAND)
-		return dev->writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
-						     tags);
+		result = dev->writeChunkWithTagsToNAND(dev, chunkInNAND, buffer,
+						       tags);
 	else
-		return yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
-								       chunkInNAND,
-								       buffer,
-								       tags);
+		result = yaffs_TagsCompatabilityWriteChunkWithTagsToNAND(dev,
+									 chunkInNAND,
+									 buffer,
+									 tags);
+	yaffs_UnlockNAND(dev);
+
+	return result;
+}
+
+/* Read a run of consecutive chunks, data only.
+ * If the driver can't do the run in one go, or anything in it needs ECC
+ * attention, the chunks are read one by one so that errors get pinned on
+ * the right block.
+ */
+int yaffs_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+			     int nChunks, __u8 * buffer)
+{
+	int result = YAFFS_FAIL;
+	int i;
+
+	if (dev->readChunksFromNAND && nChunks > 1) {
+		yaffs_LockNAND(dev);
+		result = dev->readChunksFromNAND(dev,
+						 chunkInNAND - dev->chunkOffset,
+						 nChunks, buffer);
+		yaffs_UnlockNAND(dev);
+	}
+
+	if (result == YAFFS_OK)
+		return result;
+
+	for (i = 0; i < nChunks; i++) {
+		result = yaffs_ReadChunkWithTagsFromNAND(dev, chunkInNAND + i,
+							 buffer, NULL);
+		buffer += dev->nDataBytesPerChunk;
+	}
+
+	return result;
+}
+
+/* Write a run of whole chunks to consecutive pages in one request.
+ * Only used when the driver provides writeChunksWithTagsToNAND.
+ */
+int yaffs_WriteChunksWithTagsToNAND(yaffs_Device * dev, int chunkInNAND,
+				    int nChunks, const __u8 * buffer,
+				    yaffs_ExtendedTags * tags)
+{
+	int result;
+	int i;
+
+	chunkInNAND -= dev->chunkOffset;
+
+	for (i = 0; i < nChunks; i++) {
+		tags[i].sequenceNumber = dev->sequenceNumber;
+		tags[i].chunkUsed = 1;
+		if (!yaffs_ValidateTags(&tags[i])) {
+			T(YAFFS_TRACE_ERROR,
+			  (TSTR("Writing uninitialised tags" TENDSTR)));
+			YBUG();
+		}
+		T(YAFFS_TRACE_WRITE,
+		  (TSTR("Writing chunk %d tags %d %d" TENDSTR),
+		   chunkInNAND + i, tags[i].objectId, tags[i].chunkId));
+	}
+
+	yaffs_LockNAND(dev);
+	result = dev->writeChunksWithTagsToNAND(dev, chunkInNAND, nChunks,
+						buffer, tags);
+	yaffs_UnlockNAND(dev);
+
+	return result;
 }
 
 int yaffs_MarkBlockBad(yaffs_Device * dev, int blockNo)
 {
+	int result;
+
 	blockNo -= dev->blockOffset;
 
-;
+	yaffs_LockNAND(dev);
 	if (dev->markNANDBlockBad)
-		return dev->markNANDBlockBad(dev, blockNo);
+		result = dev->markNANDBlockBad(dev, blockNo);
 	else
-		return yaffs_TagsCompatabilityMarkNANDBlockBad(dev, blockNo);
+		result = yaffs_TagsCompatabilityMarkNANDBlockBad(dev, blockNo);
+	yaffs_UnlockNAND(dev);
+
+	return result;
 }
 
 int yaffs_QueryInitialBlockState(yaffs_Device * dev,
@@ -100,14 +177,21 @@ int yaffs_QueryInitialBlockState(yaffs_Device * dev,
 						 yaffs_BlockState * state,
 						 unsigned *sequenceNumber)
 {
+	int result;
+
 	blockNo -= dev->blockOffset;
 
+	yaffs_LockNAND(dev);
 	if (dev->queryNANDBlock)
-		return dev->queryNANDBlock(dev, blockNo, state, sequenceNumber);
+		result = dev->queryNANDBlock(dev, blockNo, state,
+					     sequenceNumber);
 	else
-		return yaffs_TagsCompatabilityQueryNANDBlock(dev, blockNo,
-							     state,
-							     sequenceNumber);
+		result = yaffs_TagsCompatabilityQueryNANDBlock(dev, blockNo,
+							       state,
+							       sequenceNumber);
+	yaffs_UnlockNAND(dev);
+
+	return result;
 }
 
 
@@ -119,8 +203,10 @@ int yaffs_EraseBlockInNAND(struct yaffs_DeviceStruct *dev,
 	blockInNAND -= dev->blockOffset;
 
 
+	yaffs_LockNAND(dev);
 	dev->nBlockErasures++;
 	result = dev->eraseBlockInNAND(dev, blockInNAND);
+	yaffs_UnlockNAND(dev);
 
 	return result;
 }
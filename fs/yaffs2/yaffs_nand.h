@@ -28,6 +28,13 @@ int yaffs_WriteChunkWithTagsToNAND(yaffs_Device * dev,
 						   const __u8 * buffer,
 						   yaffs_ExtendedTags * tags);
 
+int yaffs_ReadChunksFromNAND(yaffs_Device * dev, int chunkInNAND,
+			     int nChunks, __u8 * buffer);
+
+int yaffs_WriteChunksWithTagsToNAND(yaffs_Device * dev, int chunkInNAND,
+				    int nChunks, const __u8 * buffer,
+				    yaffs_ExtendedTags * tags);
+
 int yaffs_MarkBlockBad(yaffs_Device * dev, int blockNo);
 
 int yaffs_QueryInitialBlockState(yaffs_Device * dev,
@@ -35,6 +35,9 @@
 #include <linux/string.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
+#include <linux/spinlock.h>
+#include <linux/rwsem.h>
+#include <asm/semaphore.h>
 
 #define YCHAR char
 #define YUCHAR unsigned char
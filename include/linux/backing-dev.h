@@ -39,8 +39,21 @@ enum bdi_stat_item {
 
 #define BDI_STAT_BATCH (8*(1+ilog2(nr_cpu_ids)))
 
+/*
+ * Readahead event counters, see mm/readahead.c
+ */
+enum bdi_ra_stat_item {
+	BDI_RA_SYNC,		/* readahead on a cache miss */
+	BDI_RA_ASYNC,		/* readahead on a PG_readahead page */
+	BDI_RA_CONTEXT,		/* interleaved stream found in the page cache */
+	BDI_RA_STALL,		/* reader had to wait on a readahead page */
+	BDI_RA_PAGES,		/* pages submitted for readahead */
+	NR_BDI_RA_STAT
+};
+
 struct backing_dev_info {
 	unsigned long ra_pages;	/* max readahead in PAGE_CACHE_SIZE units */
+	unsigned long write_unit; /* preferred writeback batch, in pages */
 	unsigned long state;	/* Always use atomic bitops on this */
 	unsigned int capabilities; /* Device capabilities */
 	congested_fn *congested_fn; /* Function pointer if device is md/dm */
@@ -53,6 +66,9 @@ struct backing_dev_info {
 	struct prop_local_percpu completions;
 	int dirty_exceeded;
 
+	unsigned long ra_latency;	/* average cache miss wait, usecs */
+	unsigned long ra_stat[NR_BDI_RA_STAT];	/* not exact, no locking */
+
 	unsigned int min_ratio;
 	unsigned int max_ratio, max_prop_frac;
 
@@ -149,6 +165,20 @@ static inline unsigned long bdi_stat_error(struct backing_dev_info *bdi)
 #endif
 }
 
+/*
+ * Flash filesystems call this with their eraseblock size, so that writeback
+ * hands them dirty data in batches which fill whole blocks. A bdi shared
+ * by several mounts keeps the largest unit.
+ */
+static inline void bdi_set_write_unit(struct backing_dev_info *bdi,
+				      unsigned long bytes)
+{
+	unsigned long pages = bytes >> PAGE_SHIFT;
+
+	if (pages > bdi->write_unit)
+		bdi->write_unit = pages;
+}
+
 int bdi_set_min_ratio(struct backing_dev_info *bdi, unsigned int min_ratio);
 int bdi_set_max_ratio(struct backing_dev_info *bdi, unsigned int max_ratio);
 
@@ -1147,6 +1147,8 @@ void page_cache_async_readahead(struct address_space *mapping,
 				unsigned long size);
 
 unsigned long max_sane_readahead(unsigned long nr);
+void readahead_account_wait(struct address_space *mapping, int sync,
+			    s64 usecs);
 
 /* Do stack extension */
 extern int expand_stack(struct vm_area_struct *vma, unsigned long address);
@@ -97,6 +97,8 @@ enum zone_stat_item {
 	NR_BOUNCE,
 	NR_VMSCAN_WRITE,
 	NR_WRITEBACK_TEMP,	/* Writeback using temporary buffers */
+	WORKINGSET_REFAULT,	/* evicted pages read back in */
+	WORKINGSET_ACTIVATE,	/* ... soon enough to be activated */
 #ifdef CONFIG_NUMA
 	NUMA_HIT,		/* allocated in intended node */
 	NUMA_MISS,		/* allocated in non intended node */
@@ -44,6 +44,14 @@ struct mtd_blktrans_ops {
 	int (*writesect)(struct mtd_blktrans_dev *dev,
 		     unsigned long block, char *buffer);
 
+	/* Optional: transfer nsect consecutive blocks in one call. If
+	   readsects is set, whole requests are passed to these instead
+	   of readsect/writesect */
+	int (*readsects)(struct mtd_blktrans_dev *dev, unsigned long block,
+			 unsigned long nsect, char *buffer);
+	int (*writesects)(struct mtd_blktrans_dev *dev, unsigned long block,
+			  unsigned long nsect, char *buffer);
+
 	/* Block layer ioctls */
 	int (*getgeo)(struct mtd_blktrans_dev *dev, struct hd_geometry *geo);
 	int (*flush)(struct mtd_blktrans_dev *dev);
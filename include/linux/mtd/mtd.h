@@ -232,6 +232,9 @@ extern struct mtd_info *get_mtd_device_nm(const char *name);
 
 extern void put_mtd_device(struct mtd_info *mtd);
 
+extern int mtd_erase_async(struct mtd_info *mtd, struct erase_info *instr);
+extern void mtd_erase_flush(struct mtd_info *mtd);
+
 
 struct mtd_notifier {
 	void (*add)(struct mtd_info *mtd);
@@ -477,6 +477,8 @@ extern struct nand_manufacturers nand_manuf_ids[];
  * @offs:	offset of the pattern in the oob area of the page
  * @veroffs:	offset of the bbt version counter in the oob are of the page
  * @version:	version read from the bbt page during scan
+ * @crcoffs:	offset of the little endian crc32 of the table in the oob area
+ *		of the page, used with option NAND_BBT_CRC
  * @len:	length of the pattern, if 0 no pattern check is performed
  * @maxblocks:	maximum number of blocks to search for a bbt. This number of
  *		blocks is reserved at the end of the device where the tables are
@@ -497,6 +499,7 @@ struct nand_bbt_descr {
 	int	offs;
 	int	veroffs;
 	uint8_t	version[NAND_MAX_CHIPS];
+	int	crcoffs;
 	int	len;
 	int	maxblocks;
 	int	reserved_block_code;
@@ -533,6 +536,8 @@ struct nand_bbt_descr {
 #define NAND_BBT_SAVECONTENT	0x00002000
 /* Search good / bad pattern on the first and the second page */
 #define NAND_BBT_SCAN2NDPAGE	0x00004000
+/* bbt has a crc32 of the table data at offset crcoffs */
+#define NAND_BBT_CRC		0x00008000
 
 /* The maximum number of blocks to scan for a bbt */
 #define NAND_BBT_SCAN_MAXBLOCKS	4
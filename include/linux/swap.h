@@ -120,6 +120,7 @@ enum {
 	SWP_USED	= (1 << 0),	/* is slot in swap_info[] used? */
 	SWP_WRITEOK	= (1 << 1),	/* ok to write to this swap?	*/
 	SWP_ACTIVE	= (SWP_USED | SWP_WRITEOK),
+	SWP_BLKDEV	= (1 << 2),	/* its a block device */
 					/* add others here before... */
 	SWP_SCANNING	= (1 << 8),	/* refcount in scan_swap_map */
 };
@@ -170,6 +171,11 @@ extern unsigned int nr_free_pagecache_pages(void);
 #define nr_free_pages() global_page_state(NR_FREE_PAGES)
 
 
+/* linux/mm/workingset.c */
+extern void workingset_eviction(struct address_space *mapping,
+				struct page *page);
+extern int workingset_refault(struct page *page);
+
 /* linux/mm/swap.c */
 extern void lru_cache_add(struct page *);
 extern void lru_cache_add_active(struct page *);
@@ -59,10 +59,13 @@ struct writeback_control {
 	unsigned nonblocking:1;		/* Don't get stuck on request queues */
 	unsigned encountered_congestion:1; /* An output: a queue is full */
 	unsigned for_kupdate:1;		/* A kupdate writeback */
+	unsigned for_background:1;	/* A background writeback */
 	unsigned for_reclaim:1;		/* Invoked from the page allocator */
 	unsigned for_writepages:1;	/* This is a writepages() call */
 	unsigned range_cyclic:1;	/* range_start is cyclic */
 	unsigned more_io:1;		/* more io to be dispatched */
+	unsigned whole_units:1;		/* skip inodes with less than a
+					   bdi->write_unit of dirty pages */
 };
 
 /*
@@ -73,6 +76,8 @@ int inode_wait(void *);
 void sync_inodes_sb(struct super_block *, int wait);
 void writeback_inodes_sb(struct super_block *sb, struct writeback_control *wbc);
 void sync_inodes(int wait);
+unsigned long mapping_dirty_pages(struct address_space *mapping,
+				  unsigned long max);
 
 /* writeback.h requires fs.h; it, too, is not included from here. */
 static inline void wait_on_inode(struct inode *inode)
@@ -29,7 +29,7 @@
 #include <linux/init.h>
 #include <asm/atomic.h>
 #include "crc32defs.h"
-#if CRC_LE_BITS == 8
+#if CRC_LE_BITS == 8 || CRC_LE_BITS == 64
 #define tole(x) __constant_cpu_to_le32(x)
 #define tobe(x) __constant_cpu_to_be32(x)
 #else
@@ -42,6 +42,67 @@ MODULE_AUTHOR("Matt Domsch <Matt_Domsch@dell.com>");
 MODULE_DESCRIPTION("Ethernet CRC32 calculations");
 MODULE_LICENSE("GPL");
 
+#if CRC_LE_BITS == 64 || CRC_BE_BITS == 64
+/*
+ * Slicing-by-8: once aligned, fold in eight bytes per step, with one
+ * lookup per byte into eight tables.  The lookups don't depend on each
+ * other, so the loads overlap instead of waiting for the previous crc.
+ * As with the 8 bit code, the tables are kept in the byte order of the
+ * crc (see tole/tobe), so the same body serves both bit orders.
+ */
+# ifdef __LITTLE_ENDIAN
+#  define DO_CRC1(x) crc = t0[(crc ^ (x)) & 255] ^ (crc >> 8)
+#  define DO_CRC4(q) (t3[(q) & 255] ^ t2[((q) >> 8) & 255] ^ \
+		      t1[((q) >> 16) & 255] ^ t0[((q) >> 24) & 255])
+#  define DO_CRC8(q) (t7[(q) & 255] ^ t6[((q) >> 8) & 255] ^ \
+		      t5[((q) >> 16) & 255] ^ t4[((q) >> 24) & 255])
+# else
+#  define DO_CRC1(x) crc = t0[((crc >> 24) ^ (x)) & 255] ^ (crc << 8)
+#  define DO_CRC4(q) (t0[(q) & 255] ^ t1[((q) >> 8) & 255] ^ \
+		      t2[((q) >> 16) & 255] ^ t3[((q) >> 24) & 255])
+#  define DO_CRC8(q) (t4[(q) & 255] ^ t5[((q) >> 8) & 255] ^ \
+		      t6[((q) >> 16) & 255] ^ t7[((q) >> 24) & 255])
+# endif
+
+static inline u32 crc32_slice8(u32 crc, unsigned char const *p, size_t len,
+			       const u32 (*tab)[256])
+{
+	const u32 *t0 = tab[0], *t1 = tab[1], *t2 = tab[2], *t3 = tab[3];
+	const u32 *t4 = tab[4], *t5 = tab[5], *t6 = tab[6], *t7 = tab[7];
+	const u32 *b;
+	size_t rem_len;
+	u32 q;
+
+	/* Align it */
+	if (unlikely(((long)p) & 3 && len)) {
+		do {
+			DO_CRC1(*p++);
+		} while ((--len) && ((long)p) & 3);
+	}
+
+	rem_len = len & 7;
+	len >>= 3;
+	b = (const u32 *)p;
+	while (len--) {
+		q = crc ^ *b++;
+		crc = DO_CRC8(q);
+		q = *b++;
+		crc ^= DO_CRC4(q);
+	}
+
+	/* And the last few bytes */
+	p = (unsigned char const *)b;
+	while (rem_len--)
+		DO_CRC1(*p++);
+
+	return crc;
+}
+
+# undef DO_CRC1
+# undef DO_CRC4
+# undef DO_CRC8
+#endif
+
 /**
  * crc32_le() - Calculate bitwise little-endian Ethernet AUTODIN II CRC32
  * @crc: seed value for computation.  ~0 for Ethernet, sometimes 0 for
@@ -71,7 +132,11 @@ u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 
 u32 __pure crc32_le(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_LE_BITS == 8
+# if CRC_LE_BITS == 64
+	crc = __cpu_to_le32(crc);
+	crc = crc32_slice8(crc, p, len, crc32table_le);
+	return __le32_to_cpu(crc);
+# elif CRC_LE_BITS == 8
 	const u32      *b =(u32 *)p;
 	const u32      *tab = crc32table_le;
 
@@ -169,7 +234,11 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 #else				/* Table-based approach */
 u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 {
-# if CRC_BE_BITS == 8
+# if CRC_BE_BITS == 64
+	crc = __cpu_to_be32(crc);
+	crc = crc32_slice8(crc, p, len, crc32table_be);
+	return __be32_to_cpu(crc);
+# elif CRC_BE_BITS == 8
 	const u32      *b =(u32 *)p;
 	const u32      *tab = crc32table_be;
 
@@ -238,6 +307,132 @@ u32 __pure crc32_be(u32 crc, unsigned char const *p, size_t len)
 EXPORT_SYMBOL(crc32_le);
 EXPORT_SYMBOL(crc32_be);
 
+#ifdef CONFIG_CRC32_SELFTEST
+
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
+
+#define CRC32_TEST_BUF		(64 * 1024)
+#define CRC32_BENCH_BYTES	(4 * 1024 * 1024)
+
+static u32 __init crc32_le_ref(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++;
+		for (i = 0; i < 8; i++)
+			crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
+	}
+	return crc;
+}
+
+static u32 __init crc32_be_ref(u32 crc, unsigned char const *p, size_t len)
+{
+	int i;
+
+	while (len--) {
+		crc ^= *p++ << 24;
+		for (i = 0; i < 8; i++)
+			crc = (crc << 1) ^
+			      ((crc & 0x80000000) ? CRCPOLY_BE : 0);
+	}
+	return crc;
+}
+
+/* Every alignment and short length, plus a few long odd ones */
+static int __init crc32_check(unsigned char *buf)
+{
+	static const size_t long_len[] __initdata = { 1023, 4096, 4101,
+						      CRC32_TEST_BUF - 8 };
+	static const unsigned char check[] __initdata = "123456789";
+	int errors = 0;
+	size_t off, len;
+	int i;
+
+	if ((crc32_le(~0, check, 9) ^ ~0) != 0xcbf43926 ||
+	    (crc32_be(~0, check, 9) ^ ~0) != 0xfc891918)
+		errors++;
+
+	for (off = 0; off < 8; off++) {
+		for (len = 0; len <= 64; len++) {
+			if (crc32_le(off, buf + off, len) !=
+			    crc32_le_ref(off, buf + off, len))
+				errors++;
+			if (crc32_be(off, buf + off, len) !=
+			    crc32_be_ref(off, buf + off, len))
+				errors++;
+		}
+		for (i = 0; i < ARRAY_SIZE(long_len); i++) {
+			len = long_len[i];
+			if (crc32_le(~0, buf + off, len) !=
+			    crc32_le_ref(~0, buf + off, len))
+				errors++;
+			if (crc32_be(~0, buf + off, len) !=
+			    crc32_be_ref(~0, buf + off, len))
+				errors++;
+		}
+	}
+	return errors;
+}
+
+/* Throughput in MB/s of crunching CRC32_BENCH_BYTES in len sized calls */
+static unsigned int __init crc32_bench(unsigned char *buf, size_t len, int be)
+{
+	unsigned int n = CRC32_BENCH_BYTES / len;
+	u32 crc = 0;
+	ktime_t start;
+	u64 bytes, ns;
+
+	start = ktime_get();
+	while (n--)
+		crc = be ? crc32_be(crc, buf, len) : crc32_le(crc, buf, len);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+	/* Keep the compiler from dropping the loop */
+	buf[0] ^= crc & 1;
+
+	if (!ns)
+		return 0;
+	bytes = (u64)CRC32_BENCH_BYTES * 1000;
+	return (unsigned int)div64_u64(bytes, ns);
+}
+
+static int __init crc32_selftest(void)
+{
+	unsigned char *buf;
+	size_t len;
+	int i, errors;
+
+	buf = vmalloc(CRC32_TEST_BUF);
+	if (!buf)
+		return -ENOMEM;
+	for (i = 0; i < CRC32_TEST_BUF; i++)
+		buf[i] = (i * 2654435761u) >> 24;
+
+	errors = crc32_check(buf);
+	if (errors)
+		printk(KERN_ERR "crc32: self-test failed, %d mismatches "
+		       "(CRC_LE_BITS %d, CRC_BE_BITS %d)\n", errors,
+		       CRC_LE_BITS, CRC_BE_BITS);
+	else
+		printk(KERN_INFO "crc32: self-test passed "
+		       "(CRC_LE_BITS %d, CRC_BE_BITS %d)\n",
+		       CRC_LE_BITS, CRC_BE_BITS);
+
+	for (len = 16; len <= CRC32_TEST_BUF; len <<= 2)
+		printk(KERN_INFO "crc32: %6zu byte buffers: "
+		       "le %u MB/s, be %u MB/s\n", len,
+		       crc32_bench(buf, len, 0), crc32_bench(buf, len, 1));
+
+	vfree(buf);
+	return errors ? -EINVAL : 0;
+}
+module_init(crc32_selftest);
+
+#endif /* CONFIG_CRC32_SELFTEST */
+
 /*
  * A brief CRC tutorial.
  *
@@ -8,6 +8,11 @@
 
 /* How many bits at a time to use.  Requires a table of 4<<CRC_xx_BITS bytes. */
 /* For less performance-sensitive, use 4 */
+/*
+ * 64 is the slicing-by-8 variant: eight 1KiB tables, eight bytes per step.
+ * lib/Makefile passes the value picked in Kconfig to both the table
+ * generator and crc32.c.
+ */
 #ifndef CRC_LE_BITS 
 # define CRC_LE_BITS 8
 #endif
@@ -19,14 +24,16 @@
  * Little-endian CRC computation.  Used with serial bit streams sent
  * lsbit-first.  Be sure to use cpu_to_le32() to append the computed CRC.
  */
-#if CRC_LE_BITS > 8 || CRC_LE_BITS < 1 || CRC_LE_BITS & CRC_LE_BITS-1
-# error CRC_LE_BITS must be a power of 2 between 1 and 8
+#if CRC_LE_BITS != 64 && \
+	(CRC_LE_BITS > 8 || CRC_LE_BITS < 1 || CRC_LE_BITS & CRC_LE_BITS-1)
+# error CRC_LE_BITS must be 64 or a power of 2 between 1 and 8
 #endif
 
 /*
  * Big-endian CRC computation.  Used with serial bit streams sent
  * msbit-first.  Be sure to use cpu_to_be32() to append the computed CRC.
  */
-#if CRC_BE_BITS > 8 || CRC_BE_BITS < 1 || CRC_BE_BITS & CRC_BE_BITS-1
-# error CRC_BE_BITS must be a power of 2 between 1 and 8
+#if CRC_BE_BITS != 64 && \
+	(CRC_BE_BITS > 8 || CRC_BE_BITS < 1 || CRC_BE_BITS & CRC_BE_BITS-1)
+# error CRC_BE_BITS must be 64 or a power of 2 between 1 and 8
 #endif
@@ -4,11 +4,23 @@
 
 #define ENTRIES_PER_LINE 4
 
-#define LE_TABLE_SIZE (1 << CRC_LE_BITS)
-#define BE_TABLE_SIZE (1 << CRC_BE_BITS)
+#if CRC_LE_BITS == 64
+# define LE_TABLE_ROWS 8
+# define LE_TABLE_SIZE 256
+#else
+# define LE_TABLE_ROWS 1
+# define LE_TABLE_SIZE (1 << CRC_LE_BITS)
+#endif
+#if CRC_BE_BITS == 64
+# define BE_TABLE_ROWS 8
+# define BE_TABLE_SIZE 256
+#else
+# define BE_TABLE_ROWS 1
+# define BE_TABLE_SIZE (1 << CRC_BE_BITS)
+#endif
 
-static uint32_t crc32table_le[LE_TABLE_SIZE];
-static uint32_t crc32table_be[BE_TABLE_SIZE];
+static uint32_t crc32table_le[LE_TABLE_ROWS][LE_TABLE_SIZE];
+static uint32_t crc32table_be[BE_TABLE_ROWS][BE_TABLE_SIZE];
 
 /**
  * crc32init_le() - allocate and initialize LE table data
@@ -16,18 +28,26 @@ static uint32_t crc32table_be[BE_TABLE_SIZE];
  * crc is the crc of the byte i; other entries are filled in based on the
  * fact that crctable[i^j] = crctable[i] ^ crctable[j].
  *
+ * For slicing, row j holds the crc of byte i followed by j zero bytes.
  */
 static void crc32init_le(void)
 {
 	unsigned i, j;
 	uint32_t crc = 1;
 
-	crc32table_le[0] = 0;
+	crc32table_le[0][0] = 0;
 
-	for (i = 1 << (CRC_LE_BITS - 1); i; i >>= 1) {
+	for (i = LE_TABLE_SIZE >> 1; i; i >>= 1) {
 		crc = (crc >> 1) ^ ((crc & 1) ? CRCPOLY_LE : 0);
 		for (j = 0; j < LE_TABLE_SIZE; j += 2 * i)
-			crc32table_le[i + j] = crc ^ crc32table_le[j];
+			crc32table_le[0][i + j] = crc ^ crc32table_le[0][j];
+	}
+	for (i = 0; i < LE_TABLE_SIZE; i++) {
+		crc = crc32table_le[0][i];
+		for (j = 1; j < LE_TABLE_ROWS; j++) {
+			crc = crc32table_le[0][crc & 0xff] ^ (crc >> 8);
+			crc32table_le[j][i] = crc;
+		}
 	}
 }
 
@@ -39,12 +59,19 @@ static void crc32init_be(void)
 	unsigned i, j;
 	uint32_t crc = 0x80000000;
 
-	crc32table_be[0] = 0;
+	crc32table_be[0][0] = 0;
 
 	for (i = 1; i < BE_TABLE_SIZE; i <<= 1) {
 		crc = (crc << 1) ^ ((crc & 0x80000000) ? CRCPOLY_BE : 0);
 		for (j = 0; j < i; j++)
-			crc32table_be[i + j] = crc ^ crc32table_be[j];
+			crc32table_be[0][i + j] = crc ^ crc32table_be[0][j];
+	}
+	for (i = 0; i < BE_TABLE_SIZE; i++) {
+		crc = crc32table_be[0][i];
+		for (j = 1; j < BE_TABLE_ROWS; j++) {
+			crc = crc32table_be[0][(crc >> 24) & 0xff] ^ (crc << 8);
+			crc32table_be[j][i] = crc;
+		}
 	}
 }
 
@@ -60,23 +87,50 @@ static void output_table(uint32_t table[], int len, char *trans)
 	printf("%s(0x%8.8xL)\n", trans, table[len - 1]);
 }
 
+#if LE_TABLE_ROWS > 1 || BE_TABLE_ROWS > 1
+static void output_tables(uint32_t table[][256], int rows, char *trans)
+{
+	int i;
+
+	for (i = 0; i < rows; i++) {
+		printf("{");
+		output_table(table[i], 256, trans);
+		printf("}%s\n", i < rows - 1 ? "," : "");
+	}
+}
+#endif
+
 int main(int argc, char** argv)
 {
 	printf("/* this file is generated - do not edit */\n\n");
 
+#if LE_TABLE_ROWS > 1
+	crc32init_le();
+	printf("static const u32 crc32table_le[%d][256] = {\n", LE_TABLE_ROWS);
+	output_tables(crc32table_le, LE_TABLE_ROWS, "tole");
+	printf("};\n");
+#else
 	if (CRC_LE_BITS > 1) {
 		crc32init_le();
 		printf("static const u32 crc32table_le[] = {");
-		output_table(crc32table_le, LE_TABLE_SIZE, "tole");
+		output_table(crc32table_le[0], LE_TABLE_SIZE, "tole");
 		printf("};\n");
 	}
+#endif
 
+#if BE_TABLE_ROWS > 1
+	crc32init_be();
+	printf("static const u32 crc32table_be[%d][256] = {\n", BE_TABLE_ROWS);
+	output_tables(crc32table_be, BE_TABLE_ROWS, "tobe");
+	printf("};\n");
+#else
 	if (CRC_BE_BITS > 1) {
 		crc32init_be();
 		printf("static const u32 crc32table_be[] = {");
-		output_table(crc32table_be, BE_TABLE_SIZE, "tobe");
+		output_table(crc32table_be[0], BE_TABLE_SIZE, "tobe");
 		printf("};\n");
 	}
+#endif
 
 	return 0;
 }
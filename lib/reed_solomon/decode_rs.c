@@ -26,14 +26,14 @@
 	int iprim = rs->iprim;
 	uint16_t *alpha_to = rs->alpha_to;
 	uint16_t *index_of = rs->index_of;
-	uint16_t u, q, tmp, num1, num2, den, discr_r, syn_error;
+	uint16_t u, q, q2, tmp, num1, num2, den, discr_r, syn_error;
 	/* Err+Eras Locator poly and syndrome poly The maximum value
 	 * of nroots is 8. So the necessary stack size will be about
 	 * 220 bytes max.
 	 */
 	uint16_t lambda[nroots + 1], syn[nroots];
 	uint16_t b[nroots + 1], t[nroots + 1], omega[nroots + 1];
-	uint16_t root[nroots], reg[nroots + 1], loc[nroots];
+	uint16_t root[nroots], reg[nroots + 1], loc[nroots], step[nroots];
 	int count = 0;
 	uint16_t msk = (uint16_t) rs->nn;
 
@@ -42,37 +42,69 @@
 	BUG_ON(pad < 0 || pad >= nn);
 
 	/* Does the caller provide the syndrome ? */
-	if (s != NULL)
-		goto decode;
+	if (s != NULL) {
+		/* A clean codeword has all syndromes zero (nn in index
+		 * form), so there is no need to run the decoder */
+		for (i = 0; i < nroots; i++)
+			if (s[i] != nn)
+				goto decode;
+		goto clean;
+	}
+
+	/* An all zero codeword (e.g. an erased flash page with
+	 * invmsk set) has a zero syndrome. Checking for it is much
+	 * cheaper than evaluating the syndromes. Aligned data is
+	 * checked a word, i.e. several symbols, at a time */
+	j = 0;
+	if (IS_ALIGNED((unsigned long)data, sizeof(long))) {
+		const unsigned long *w = (const unsigned long *)data;
+		unsigned long wmsk = 0, winv = 0;
+
+		for (i = 0; i < sizeof(long) / sizeof(data[0]); i++) {
+			wmsk = (wmsk << (8 * sizeof(data[0]))) | msk;
+			winv = (winv << (8 * sizeof(data[0]))) |
+				(invmsk & msk);
+		}
+		for (i = 0; i < len / (sizeof(long) / sizeof(data[0])); i++)
+			if ((w[i] ^ winv) & wmsk)
+				goto syndrome;
+		j = i * (sizeof(long) / sizeof(data[0]));
+	}
+	for (; j < len; j++)
+		if ((((uint16_t) data[j]) ^ invmsk) & msk)
+			goto syndrome;
+	for (j = 0; j < nroots; j++)
+		if (((uint16_t) par[j]) & msk)
+			goto syndrome;
+	goto clean;
 
+ syndrome:
 	/* form the syndromes; i.e., evaluate data(x) at roots of
 	 * g(x) */
-	for (i = 0; i < nroots; i++)
+	for (i = 0; i < nroots; i++) {
+		step[i] = rs_modnn(rs, (fcr + i) * prim);
 		syn[i] = (((uint16_t) data[0]) ^ invmsk) & msk;
+	}
 
 	for (j = 1; j < len; j++) {
+		u = (((uint16_t) data[j]) ^ invmsk) & msk;
 		for (i = 0; i < nroots; i++) {
-			if (syn[i] == 0) {
-				syn[i] = (((uint16_t) data[j]) ^
-					  invmsk) & msk;
-			} else {
-				syn[i] = ((((uint16_t) data[j]) ^
-					   invmsk) & msk) ^
-					alpha_to[rs_modnn(rs, index_of[syn[i]] +
-						       (fcr + i) * prim)];
-			}
+			if (syn[i] == 0)
+				syn[i] = u;
+			else
+				syn[i] = u ^ alpha_to[rs_modnn(rs,
+						index_of[syn[i]] + step[i])];
 		}
 	}
 
 	for (j = 0; j < nroots; j++) {
+		u = ((uint16_t) par[j]) & msk;
 		for (i = 0; i < nroots; i++) {
-			if (syn[i] == 0) {
-				syn[i] = ((uint16_t) par[j]) & msk;
-			} else {
-				syn[i] = (((uint16_t) par[j]) & msk) ^
-					alpha_to[rs_modnn(rs, index_of[syn[i]] +
-						       (fcr+i)*prim)];
-			}
+			if (syn[i] == 0)
+				syn[i] = u;
+			else
+				syn[i] = u ^ alpha_to[rs_modnn(rs,
+						index_of[syn[i]] + step[i])];
 		}
 	}
 	s = syn;
@@ -88,8 +120,7 @@
 		/* if syndrome is zero, data[] is a codeword and there are no
 		 * errors to correct. So return data[] unmodified
 		 */
-		count = 0;
-		goto finish;
+		goto clean;
 	}
 
  decode:
@@ -175,28 +206,52 @@
 		if (lambda[i] != nn)
 			deg_lambda = i;
 	}
-	/* Find roots of error+erasure locator polynomial by Chien search */
-	memcpy(&reg[1], &lambda[1], nroots * sizeof(reg[0]));
 	count = 0;		/* Number of roots of lambda(x) */
-	for (i = 1, k = iprim - 1; i <= nn; i++, k = rs_modnn(rs, k + iprim)) {
-		q = 1;		/* lambda[0] is always 0 */
+	if (deg_lambda == 1) {
+		/*
+		 * A single error: lambda(x) = 1 + lambda[1] * x has its
+		 * only root at alpha**(nn - lambda[1]), so the Chien
+		 * search below reduces to one step.
+		 */
+		root[0] = lambda[1] ? nn - lambda[1] : nn;
+		loc[0] = rs_modnn(rs, root[0] * iprim - 1 + nn);
+		count = 1;
+		goto found;
+	}
+	/* Find roots of error+erasure locator polynomial by Chien
+	 * search. Two roots, alpha**i and alpha**(i+1), are tried per
+	 * iteration, sharing the walk over the lambda coefficients */
+	memcpy(&reg[1], &lambda[1], nroots * sizeof(reg[0]));
+	for (i = 1, k = iprim - 1; i <= nn;
+	     i += 2, k = rs_modnn(rs, k + 2 * iprim)) {
+		q = q2 = 1;	/* lambda[0] is always 0 */
 		for (j = deg_lambda; j > 0; j--) {
 			if (reg[j] != nn) {
-				reg[j] = rs_modnn(rs, reg[j] + j);
-				q ^= alpha_to[reg[j]];
+				u = rs_modnn(rs, reg[j] + j);
+				reg[j] = rs_modnn(rs, u + j);
+				q ^= alpha_to[u];
+				q2 ^= alpha_to[reg[j]];
 			}
 		}
-		if (q != 0)
-			continue;	/* Not a root */
-		/* store root (index-form) and error location number */
-		root[count] = i;
-		loc[count] = k;
-		/* If we've already found max possible roots,
-		 * abort the search to save time
-		 */
-		if (++count == deg_lambda)
-			break;
+		if (q == 0) {
+			/* store root (index-form) and error location
+			 * number */
+			root[count] = i;
+			loc[count] = k;
+			/* If we've already found max possible roots,
+			 * abort the search to save time
+			 */
+			if (++count == deg_lambda)
+				break;
+		}
+		if (q2 == 0 && i < nn) {
+			root[count] = i + 1;
+			loc[count] = rs_modnn(rs, k + iprim);
+			if (++count == deg_lambda)
+				break;
+		}
 	}
+found:
 	if (deg_lambda != count) {
 		/*
 		 * deg(lambda) unequal to number of roots => uncorrectable
@@ -261,6 +316,16 @@
 		}
 	}
 
+	goto finish;
+
+ clean:
+	/* data[] is left unmodified. The erasures, if any, are
+	 * reported back as they were given, with nothing to correct,
+	 * just as the full decoder would */
+	count = no_eras;
+	for (i = 0; i < count; i++)
+		loc[i] = eras_pos[i] + pad;
+
 finish:
 	if (eras_pos != NULL) {
 		for (i = 0; i < count; i++)
@@ -320,6 +320,8 @@ EXPORT_SYMBOL_GPL(encode_rs8);
  *  symbol size > 8. The calling code must take care of decoding of the
  *  syndrome result and the received parity before calling this code.
  *  Returns the number of corrected bits or -EBADMSG for uncorrectable errors.
+ *  Erasures count as corrected symbols, even if their value was right, so
+ *  a codeword with a zero syndrome returns @no_eras.
  */
 int decode_rs8(struct rs_control *rs, uint8_t *data, uint16_t *par, int len,
 	       uint16_t *s, int no_eras, int *eras_pos, uint16_t invmsk,
@@ -364,6 +366,8 @@ EXPORT_SYMBOL_GPL(encode_rs16);
  *
  *  Each field in the data array contains up to symbol size bits of valid data.
  *  Returns the number of corrected bits or -EBADMSG for uncorrectable errors.
+ *  Erasures count as corrected symbols, even if their value was right, so
+ *  a codeword with a zero syndrome returns @no_eras.
  */
 int decode_rs16(struct rs_control *rs, uint16_t *data, uint16_t *par, int len,
 		uint16_t *s, int no_eras, int *eras_pos, uint16_t invmsk,
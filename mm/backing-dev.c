@@ -101,6 +101,23 @@ static ssize_t read_ahead_kb_store(struct device *dev,
 	return ret;
 }
 
+static ssize_t write_unit_kb_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct backing_dev_info *bdi = dev_get_drvdata(dev);
+	char *end;
+	unsigned long write_unit_kb;
+	ssize_t ret = -EINVAL;
+
+	write_unit_kb = simple_strtoul(buf, &end, 10);
+	if (*buf && (end[0] == '\0' || (end[0] == '\n' && end[1] == '\0'))) {
+		bdi->write_unit = write_unit_kb >> (PAGE_SHIFT - 10);
+		ret = count;
+	}
+	return ret;
+}
+
 #define K(pages) ((pages) << (PAGE_SHIFT - 10))
 
 #define BDI_SHOW(name, expr)						\
@@ -113,6 +130,7 @@ static ssize_t name##_show(struct device *dev,				\
 }
 
 BDI_SHOW(read_ahead_kb, K(bdi->ra_pages))
+BDI_SHOW(write_unit_kb, K(bdi->write_unit))
 
 static ssize_t min_ratio_store(struct device *dev,
 		struct device_attribute *attr, const char *buf, size_t count)
@@ -150,12 +168,26 @@ static ssize_t max_ratio_store(struct device *dev,
 }
 BDI_SHOW(max_ratio, bdi->max_ratio)
 
+BDI_SHOW(read_ahead_latency_us, bdi->ra_latency)
+BDI_SHOW(read_ahead_sync, bdi->ra_stat[BDI_RA_SYNC])
+BDI_SHOW(read_ahead_async, bdi->ra_stat[BDI_RA_ASYNC])
+BDI_SHOW(read_ahead_context, bdi->ra_stat[BDI_RA_CONTEXT])
+BDI_SHOW(read_ahead_stalls, bdi->ra_stat[BDI_RA_STALL])
+BDI_SHOW(read_ahead_pages, bdi->ra_stat[BDI_RA_PAGES])
+
 #define __ATTR_RW(attr) __ATTR(attr, 0644, attr##_show, attr##_store)
 
 static struct device_attribute bdi_dev_attrs[] = {
 	__ATTR_RW(read_ahead_kb),
 	__ATTR_RW(min_ratio),
 	__ATTR_RW(max_ratio),
+	__ATTR_RW(write_unit_kb),
+	__ATTR_RO(read_ahead_latency_us),
+	__ATTR_RO(read_ahead_sync),
+	__ATTR_RO(read_ahead_async),
+	__ATTR_RO(read_ahead_context),
+	__ATTR_RO(read_ahead_stalls),
+	__ATTR_RO(read_ahead_pages),
 	__ATTR_NULL,
 };
 
@@ -226,6 +258,10 @@ int bdi_init(struct backing_dev_info *bdi)
 	}
 
 	bdi->dirty_exceeded = 0;
+
+	bdi->ra_latency = 0;
+	memset(bdi->ra_stat, 0, sizeof(bdi->ra_stat));
+
 	err = prop_local_init_percpu(&bdi->completions);
 
 	if (err) {
@@ -33,6 +33,7 @@
 #include <linux/cpuset.h>
 #include <linux/hardirq.h> /* for BUG_ON(!in_atomic()) only */
 #include <linux/memcontrol.h>
+#include <linux/hrtimer.h>
 #include "internal.h"
 
 /*
@@ -491,8 +492,13 @@ int add_to_page_cache_lru(struct page *page, struct address_space *mapping,
 				pgoff_t offset, gfp_t gfp_mask)
 {
 	int ret = add_to_page_cache(page, mapping, offset, gfp_mask);
-	if (ret == 0)
-		lru_cache_add(page);
+	if (ret == 0) {
+		/* Recently evicted pages go back to the active list */
+		if (workingset_refault(page))
+			lru_cache_add_active(page);
+		else
+			lru_cache_add(page);
+	}
 	return ret;
 }
 
@@ -915,6 +921,8 @@ static void do_generic_file_read(struct file *filp, loff_t *ppos,
 		pgoff_t end_index;
 		loff_t isize;
 		unsigned long nr, ret;
+		int missed = 0;
+		ktime_t wait;
 
 		cond_resched();
 find_page:
@@ -926,6 +934,7 @@ find_page:
 			page = find_get_page(mapping, index);
 			if (unlikely(page == NULL))
 				goto no_cached_page;
+			missed = 1;
 		}
 		if (PageReadahead(page)) {
 			page_cache_async_readahead(mapping,
@@ -1000,6 +1009,7 @@ page_ok:
 
 page_not_up_to_date:
 		/* Get exclusive access to the page ... */
+		wait = ktime_get();
 		if (lock_page_killable(page))
 			goto readpage_eio;
 
@@ -1013,6 +1023,9 @@ page_not_up_to_date:
 		/* Did somebody else fill it already? */
 		if (PageUptodate(page)) {
 			unlock_page(page);
+			/* We waited for readahead I/O, let it know */
+			readahead_account_wait(mapping, missed,
+					ktime_us_delta(ktime_get(), wait));
 			goto page_ok;
 		}
 
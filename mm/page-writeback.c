@@ -620,6 +620,7 @@ static void background_writeout(unsigned long _min_pages)
 		.older_than_this = NULL,
 		.nr_to_write	= 0,
 		.nonblocking	= 1,
+		.for_background	= 1,
 		.range_cyclic	= 1,
 	};
 
@@ -636,7 +637,17 @@ static void background_writeout(unsigned long _min_pages)
 		wbc.encountered_congestion = 0;
 		wbc.nr_to_write = MAX_WRITEBACK_PAGES;
 		wbc.pages_skipped = 0;
+		/*
+		 * Flash filesystems prefer to get whole eraseblocks worth of
+		 * data at once. Write those first and only fall back to the
+		 * smaller inodes when there aren't enough of them.
+		 */
+		wbc.whole_units = 1;
 		writeback_inodes(&wbc);
+		if (wbc.nr_to_write > 0) {
+			wbc.whole_units = 0;
+			writeback_inodes(&wbc);
+		}
 		min_pages -= MAX_WRITEBACK_PAGES - wbc.nr_to_write;
 		if (wbc.nr_to_write > 0 || wbc.pages_skipped > 0) {
 			/* Wrote less than expected */
@@ -858,12 +869,19 @@ void __init page_writeback_init(void)
  * the call was made get new I/O started against them.  If wbc->sync_mode is
  * WB_SYNC_ALL then we were called for data integrity and we must wait for
  * existing IO to complete.
+ *
+ * For background and kupdate writeback against a bdi with a write_unit, at
+ * least that many pages are written even if it takes wbc->nr_to_write below
+ * zero, so that a flash filesystem is not handed a partial eraseblock. Dirty
+ * throttling and the other callers keep to wbc->nr_to_write.
  */
 int write_cache_pages(struct address_space *mapping,
 		      struct writeback_control *wbc, writepage_t writepage,
 		      void *data)
 {
 	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long unit = 0;
+	unsigned long written = 0;
 	int ret = 0;
 	int done = 0;
 	struct pagevec pvec;
@@ -878,6 +896,9 @@ int write_cache_pages(struct address_space *mapping,
 		return 0;
 	}
 
+	if (wbc->for_background || wbc->for_kupdate)
+		unit = bdi->write_unit;
+
 	pagevec_init(&pvec, 0);
 	if (wbc->range_cyclic) {
 		index = mapping->writeback_index; /* Start from prev offset */
@@ -935,7 +956,9 @@ retry:
 				unlock_page(page);
 				ret = 0;
 			}
-			if (ret || (--(wbc->nr_to_write) <= 0))
+			written++;
+			if (ret || (--(wbc->nr_to_write) <= 0 &&
+				    written >= unit))
 				done = 1;
 			if (wbc->nonblocking && bdi_write_congested(bdi)) {
 				wbc->encountered_congestion = 1;
@@ -960,6 +983,35 @@ retry:
 }
 EXPORT_SYMBOL(write_cache_pages);
 
+/**
+ * mapping_dirty_pages - count the dirty pages of an address space
+ * @mapping: address space structure to look at
+ * @max: stop counting at this many pages
+ */
+unsigned long mapping_dirty_pages(struct address_space *mapping,
+				  unsigned long max)
+{
+	void *pages[PAGEVEC_SIZE];
+	unsigned long count = 0;
+	pgoff_t index = 0;
+	unsigned int nr;
+
+	read_lock_irq(&mapping->tree_lock);
+	while (count < max) {
+		nr = radix_tree_gang_lookup_tag(&mapping->page_tree, pages,
+					index, PAGEVEC_SIZE, PAGECACHE_TAG_DIRTY);
+		if (!nr)
+			break;
+		count += nr;
+		index = ((struct page *)pages[nr - 1])->index + 1;
+		if (!index)
+			break;
+	}
+	read_unlock_irq(&mapping->tree_lock);
+
+	return count;
+}
+
 /*
  * Function used by generic_writepages to call the real writepage
  * function and set the mapping flags on error
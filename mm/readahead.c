@@ -255,10 +255,39 @@ static unsigned long ra_submit(struct file_ra_state *ra,
 
 	actual = __do_page_cache_readahead(mapping, filp,
 					ra->start, ra->size, ra->async_size);
+	ra->stamp = jiffies;
+	if (actual > 0)
+		mapping->backing_dev_info->ra_stat[BDI_RA_PAGES] += actual;
 
 	return actual;
 }
 
+/*
+ * Called by a reader which had to sleep for @usecs until a page it found
+ * in the page cache was read in. @sync is set when the page came from
+ * the readahead on its own cache miss, so the wait was the full device
+ * latency, which feeds the per-device average. Otherwise the async
+ * readahead was issued too late and we only count the stall.
+ */
+void readahead_account_wait(struct address_space *mapping, int sync,
+			    s64 usecs)
+{
+	struct backing_dev_info *bdi = mapping->backing_dev_info;
+	unsigned long lat;
+
+	if (!sync) {
+		bdi->ra_stat[BDI_RA_STALL]++;
+		return;
+	}
+
+	if (usecs <= 0)
+		return;
+	lat = min_t(s64, usecs, USEC_PER_SEC);
+	if (bdi->ra_latency)
+		lat = (bdi->ra_latency * 7 + lat) / 8;
+	bdi->ra_latency = lat;
+}
+
 /*
  * Set the initial window size, round to next power of 2 and square
  * for small size, x 4 for medium, and x 2 for large
@@ -297,6 +326,78 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
 	return min(newsize, max);
 }
 
+/*
+ * Limit the window of a sequential stream to what hides the device
+ * latency. The reader went through the last ra->size pages in the time
+ * since that window was submitted, so at this rate it needs about
+ * rate * latency pages in flight; keep twice that as a margin. Slow
+ * readers such as media players then stop short of ra_pages, fast ones
+ * and readers we cannot time at jiffies resolution still get @max.
+ */
+static unsigned long get_latency_ra_size(struct file_ra_state *ra,
+					 struct backing_dev_info *bdi,
+					 unsigned long max)
+{
+	unsigned long low = VM_MIN_READAHEAD * 1024 / PAGE_CACHE_SIZE;
+	unsigned long elapsed = jiffies_to_usecs(jiffies - ra->stamp);
+	unsigned long lat = bdi->ra_latency;
+	u64 need;
+
+	if (!lat || !elapsed || max <= low)
+		return max;
+
+	need = (u64)ra->size * lat * 2;
+	do_div(need, elapsed);
+
+	return clamp_t(u64, need, low, max);
+}
+
+/*
+ * Count the contiguously cached pages just before @offset, up to @max.
+ */
+static pgoff_t count_history_pages(struct address_space *mapping,
+				   pgoff_t offset, unsigned long max)
+{
+	pgoff_t head;
+
+	read_lock_irq(&mapping->tree_lock);
+	head = radix_tree_prev_hole(&mapping->page_tree, offset - 1, max);
+	read_unlock_irq(&mapping->tree_lock);
+
+	return offset - 1 - head;
+}
+
+/*
+ * Several streams reading one fd overwrite each other's prev_pos, so a
+ * miss that does not follow prev_pos may still continue a stream. The
+ * stream leaves its pages behind in the page cache: if the pages just
+ * before @offset are there, size the window after them.
+ */
+static int try_context_readahead(struct address_space *mapping,
+				 struct file_ra_state *ra, pgoff_t offset,
+				 unsigned long req_size, unsigned long max)
+{
+	pgoff_t size;
+
+	if (!offset)
+		return 0;
+
+	size = count_history_pages(mapping, offset, max);
+	if (!size)
+		return 0;
+
+	/* Read from the start of the file, likely a long run */
+	if (size >= offset)
+		size *= 2;
+
+	ra->start = offset;
+	ra->size = get_init_ra_size(size + req_size, max);
+	ra->async_size = ra->size;
+	mapping->backing_dev_info->ra_stat[BDI_RA_CONTEXT]++;
+
+	return 1;
+}
+
 /*
  * On-demand readahead design.
  *
@@ -333,7 +434,13 @@ static unsigned long get_next_ra_size(struct file_ra_state *ra,
  * based on I/O request size and the max_readahead.
  *
  * The code ramps up the readahead size aggressively at first, but slow down as
- * it approaches max_readhead.
+ * it approaches max_readhead. Once the backing device has a latency estimate,
+ * a sequential stream only ramps up as far as it needs to keep ahead of the
+ * reader (see get_latency_ra_size()), so slow readers don't fill the page
+ * cache with ra_pages worth of data they will only use much later.
+ *
+ * Interleaved streams which missed their readahead marker are picked up again
+ * from the pages they left in the page cache (see try_context_readahead()).
  */
 
 /*
@@ -355,8 +462,11 @@ ondemand_readahead(struct address_space *mapping,
 	 */
 	if (offset && (offset == (ra->start + ra->size - ra->async_size) ||
 			offset == (ra->start + ra->size))) {
+		unsigned long cap;
+
+		cap = get_latency_ra_size(ra, mapping->backing_dev_info, max);
 		ra->start += ra->size;
-		ra->size = get_next_ra_size(ra, max);
+		ra->size = get_next_ra_size(ra, cap);
 		ra->async_size = ra->size;
 		goto readit;
 	}
@@ -364,6 +474,13 @@ ondemand_readahead(struct address_space *mapping,
 	prev_offset = ra->prev_pos >> PAGE_CACHE_SHIFT;
 	sequential = offset - prev_offset <= 1UL || req_size > max;
 
+	/*
+	 * Not following our last read, but maybe another stream's.
+	 */
+	if (!hit_readahead_marker && !sequential &&
+	    try_context_readahead(mapping, ra, offset, req_size, max))
+		goto readit;
+
 	/*
 	 * Standalone, small read.
 	 * Read as is, and do not pollute the readahead state.
@@ -433,6 +550,8 @@ void page_cache_sync_readahead(struct address_space *mapping,
 	if (!ra->ra_pages)
 		return;
 
+	mapping->backing_dev_info->ra_stat[BDI_RA_SYNC]++;
+
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, false, offset, req_size);
 }
@@ -477,6 +596,8 @@ page_cache_async_readahead(struct address_space *mapping,
 	if (bdi_read_congested(mapping->backing_dev_info))
 		return;
 
+	mapping->backing_dev_info->ra_stat[BDI_RA_ASYNC]++;
+
 	/* do read-ahead */
 	ondemand_readahead(mapping, ra, filp, true, offset, req_size);
 }
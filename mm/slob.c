@@ -55,6 +55,14 @@
  * page flags. As a result, block allocations that can be satisfied from
  * the freelist will only be done so on pages residing on the same node,
  * in order to prevent random node placement.
+ *
+ * With CONFIG_SLOB_MAGAZINE, each CPU keeps a small magazine of recently
+ * freed blocks in front of the heap. Kernel code allocates and frees the
+ * same few sizes over and over (kmalloc(sizeof(struct foo)), every object
+ * of a cache), so an allocation looks for a block of exactly its size
+ * there first and skips the page walk and slob_lock. The magazine only
+ * holds exact sizes, so no rounding up is done, and it is bounded in
+ * both entries and bytes to keep SLOB's footprint.
  */
 
 #include <linux/kernel.h>
@@ -65,6 +73,9 @@
 #include <linux/module.h>
 #include <linux/rcupdate.h>
 #include <linux/list.h>
+#include <linux/percpu.h>
+#include <linux/cpu.h>
+#include <linux/notifier.h>
 #include <asm/atomic.h>
 
 /*
@@ -299,9 +310,9 @@ static void *slob_page_alloc(struct slob_page *sp, size_t size, int align)
 }
 
 /*
- * slob_alloc: entry point into the slob allocator.
+ * __slob_alloc: allocate from the slob heap.
  */
-static void *slob_alloc(size_t size, gfp_t gfp, int align, int node)
+static void *__slob_alloc(size_t size, gfp_t gfp, int align, int node)
 {
 	struct slob_page *sp;
 	struct list_head *prev;
@@ -371,9 +382,9 @@ static void *slob_alloc(size_t size, gfp_t gfp, int align, int node)
 }
 
 /*
- * slob_free: entry point into the slob allocator.
+ * __slob_free: return a block to the slob heap.
  */
-static void slob_free(void *block, int size)
+static void __slob_free(void *block, int size)
 {
 	struct slob_page *sp;
 	slob_t *prev, *next, *b = (slob_t *)block;
@@ -447,6 +458,155 @@ out:
 	spin_unlock_irqrestore(&slob_lock, flags);
 }
 
+static unsigned int slob_ready __read_mostly;
+
+#ifdef CONFIG_SLOB_MAGAZINE
+/*
+ * Per-cpu magazine of freed blocks, oldest first. Only touched by its
+ * own cpu with interrupts off, so it needs no lock.
+ */
+#define SLOB_MAG_SIZE		16
+#define SLOB_MAG_MAX_UNITS	SLOB_UNITS(SLOB_BREAK2)
+#define SLOB_MAG_UNITS		SLOB_UNITS(PAGE_SIZE)
+
+struct slob_magazine {
+	unsigned int nr;
+	unsigned int units;		/* total held, <= SLOB_MAG_UNITS */
+	struct {
+		void *block;
+		slobidx_t units;
+	} slot[SLOB_MAG_SIZE];
+};
+
+static DEFINE_PER_CPU(struct slob_magazine, slob_magazines);
+
+static void *slob_mag_alloc(slobidx_t units, int align)
+{
+	struct slob_magazine *m;
+	void *b = NULL;
+	unsigned long flags;
+	int i;
+
+	local_irq_save(flags);
+	m = &__get_cpu_var(slob_magazines);
+	for (i = m->nr - 1; i >= 0; i--) {
+		if (m->slot[i].units != units)
+			continue;
+		if (align && ((unsigned long)m->slot[i].block & (align - 1)))
+			continue;
+		b = m->slot[i].block;
+		m->nr--;
+		m->units -= units;
+		memmove(&m->slot[i], &m->slot[i + 1],
+			(m->nr - i) * sizeof(m->slot[0]));
+		break;
+	}
+	local_irq_restore(flags);
+
+	return b;
+}
+
+/* Push one block to the oldest slot of m back to the heap */
+static void slob_mag_evict(struct slob_magazine *m)
+{
+	void *b = m->slot[0].block;
+	slobidx_t units = m->slot[0].units;
+
+	m->nr--;
+	m->units -= units;
+	memmove(&m->slot[0], &m->slot[1], m->nr * sizeof(m->slot[0]));
+	__slob_free(b, units * SLOB_UNIT);
+}
+
+/* Returns 0 if the block was taken */
+static int slob_mag_free(void *block, slobidx_t units)
+{
+	struct slob_magazine *m;
+	unsigned long flags;
+
+	if (units > SLOB_MAG_MAX_UNITS)
+		return 1;
+
+	local_irq_save(flags);
+	m = &__get_cpu_var(slob_magazines);
+	while (m->nr == SLOB_MAG_SIZE || m->units + units > SLOB_MAG_UNITS)
+		slob_mag_evict(m);
+	m->slot[m->nr].block = block;
+	m->slot[m->nr].units = units;
+	m->nr++;
+	m->units += units;
+	local_irq_restore(flags);
+
+	return 0;
+}
+
+static int __cpuinit slob_cpu_callback(struct notifier_block *nfb,
+				       unsigned long action, void *hcpu)
+{
+	struct slob_magazine *m;
+	unsigned long flags;
+
+	switch (action) {
+	case CPU_DEAD:
+	case CPU_DEAD_FROZEN:
+		m = &per_cpu(slob_magazines, (long)hcpu);
+		local_irq_save(flags);
+		while (m->nr)
+			slob_mag_evict(m);
+		local_irq_restore(flags);
+		break;
+	}
+	return NOTIFY_OK;
+}
+
+static int __init slob_magazine_init(void)
+{
+	hotcpu_notifier(slob_cpu_callback, 0);
+	return 0;
+}
+__initcall(slob_magazine_init);
+#else
+static inline void *slob_mag_alloc(slobidx_t units, int align)
+{
+	return NULL;
+}
+
+static inline int slob_mag_free(void *block, slobidx_t units)
+{
+	return 1;
+}
+#endif
+
+/*
+ * slob_alloc: entry point into the slob allocator.
+ */
+static void *slob_alloc(size_t size, gfp_t gfp, int align, int node)
+{
+	void *b = NULL;
+
+	if (slob_ready && node == -1)
+		b = slob_mag_alloc(SLOB_UNITS(size), align);
+	if (!b)
+		return __slob_alloc(size, gfp, align, node);
+
+	if (unlikely(gfp & __GFP_ZERO))
+		memset(b, 0, size);
+	return b;
+}
+
+/*
+ * slob_free: entry point into the slob allocator.
+ */
+static void slob_free(void *block, int size)
+{
+	if (unlikely(ZERO_OR_NULL_PTR(block)))
+		return;
+	BUG_ON(!size);
+
+	if (!slob_ready || slob_mag_free(block, SLOB_UNITS(size)))
+		__slob_free(block, size);
+}
+
 /*
  * End of slob allocator proper. Begin kmem_cache_alloc and kmalloc frontend.
  */
@@ -634,8 +794,6 @@ int kmem_ptr_validate(struct kmem_cache *a, const void *b)
 	return 0;
 }
 
-static unsigned int slob_ready __read_mostly;
-
 int slab_is_available(void)
 {
 	return slob_ready;
@@ -285,6 +285,12 @@ static int swap_entry_free(struct swap_info_struct *p, unsigned long offset)
 				swap_list.next = p - swap_info;
 			nr_swap_pages++;
 			p->inuse_pages--;
+			if (p->flags & SWP_BLKDEV) {
+				struct gendisk *disk = p->bdev->bd_disk;
+				if (disk->fops->swap_slot_free_notify)
+					disk->fops->swap_slot_free_notify(
+							p->bdev, offset);
+			}
 		}
 	}
 	return count;
@@ -1673,6 +1679,8 @@ asmlinkage long sys_swapon(const char __user * specialfile, int swap_flags)
 	mutex_lock(&swapon_mutex);
 	spin_lock(&swap_lock);
 	p->flags = SWP_ACTIVE;
+	if (S_ISBLK(inode->i_mode))
+		p->flags |= SWP_BLKDEV;
 	nr_swap_pages += nr_good_pages;
 	total_swap_pages += nr_good_pages;
 
@@ -441,6 +441,7 @@ int remove_mapping(struct address_space *mapping, struct page *page)
 		return 1;
 	}
 
+	workingset_eviction(mapping, page);
 	__remove_from_page_cache(page);
 	write_unlock_irq(&mapping->tree_lock);
 	__put_page(page);
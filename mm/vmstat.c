@@ -615,6 +615,8 @@ static const char * const vmstat_text[] = {
 	"nr_bounce",
 	"nr_vmscan_write",
 	"nr_writeback_temp",
+	"workingset_refault",
+	"workingset_activate",
 
 #ifdef CONFIG_NUMA
 	"numa_hit",
@@ -0,0 +1,129 @@
+/*
+ * mm/workingset.c - refault detection for the page cache
+ *
+ * A single streaming read, say of a large media file, can push the whole
+ * inactive list out of memory. That includes pages which are used over and
+ * over, but not often enough to get on the active list, like the text of a
+ * program waiting for input. They then have to be read back from slow flash.
+ *
+ * To tell those pages apart, each page cache page evicted by reclaim leaves
+ * a shadow entry behind. The shadow records a clock which counts evictions.
+ * When the page is read back in, the clock minus its shadow is the number of
+ * pages evicted in between, the refault distance. Had the inactive list been
+ * that many pages longer, the page would have stayed in memory. The only
+ * place such pages could have come from is the active list. So if the
+ * distance is no more than the size of the active list, the page is part of
+ * the working set. It then goes straight onto the active list, where it
+ * competes with the other active pages instead of being flushed out again by
+ * the stream. Without refaults the active list is left to age as before.
+ *
+ * The shadow entries live in a direct-mapped table indexed by a hash of the
+ * mapping and index, not in the page cache radix trees, which would have to
+ * learn about non-page entries everywhere. A collision loses the older
+ * shadow. A stale shadow can at worst activate a page which didn't deserve
+ * it.
+ */
+
+#include <linux/mm.h>
+#include <linux/fs.h>
+#include <linux/swap.h>
+#include <linux/hash.h>
+#include <linux/init.h>
+#include <linux/bootmem.h>
+#include <linux/vmstat.h>
+#include <asm/atomic.h>
+
+/*
+ * A shadow entry keeps the low half of the eviction clock and a tag from
+ * the hash in the high half. The tag always has its lowest bit set, so an
+ * empty slot reads as 0.
+ */
+#define EVICTION_SHIFT		(BITS_PER_LONG / 2)
+#define EVICTION_MASK		((1UL << EVICTION_SHIFT) - 1)
+#define SHADOW_TAG_BITS		(BITS_PER_LONG - EVICTION_SHIFT)
+
+static unsigned long *shadow_table __read_mostly;
+static unsigned int shadow_shift __read_mostly;
+
+static atomic_long_t workingset_clock;
+
+static unsigned long *shadow_slot(struct address_space *mapping,
+				  pgoff_t index, unsigned long *tag)
+{
+	unsigned long hash;
+
+	hash = hash_long((unsigned long)mapping ^
+			 hash_long(index, BITS_PER_LONG), BITS_PER_LONG);
+	*tag = (hash >> (BITS_PER_LONG - shadow_shift - SHADOW_TAG_BITS)) | 1;
+	*tag &= (1UL << SHADOW_TAG_BITS) - 1;
+
+	return &shadow_table[hash >> (BITS_PER_LONG - shadow_shift)];
+}
+
+/**
+ * workingset_eviction - note a page cache page evicted by reclaim
+ * @mapping: address space the page is being removed from
+ * @page: the page
+ *
+ * Called with mapping->tree_lock held, before the page is removed.
+ */
+void workingset_eviction(struct address_space *mapping, struct page *page)
+{
+	unsigned long clock, tag, *slot;
+
+	if (!shadow_table)
+		return;
+
+	clock = atomic_long_inc_return(&workingset_clock);
+	slot = shadow_slot(mapping, page->index, &tag);
+	*slot = (tag << EVICTION_SHIFT) | (clock & EVICTION_MASK);
+}
+
+/**
+ * workingset_refault - check a page just added to the page cache
+ * @page: the page, locked and in the page cache
+ *
+ * Returns 1 if @page was evicted recently enough to belong on the active
+ * list, 0 otherwise.
+ */
+int workingset_refault(struct page *page)
+{
+	unsigned long entry, distance, tag, *slot;
+
+	if (!shadow_table)
+		return 0;
+
+	slot = shadow_slot(page->mapping, page->index, &tag);
+	entry = *slot;
+	if (entry >> EVICTION_SHIFT != tag)
+		return 0;
+	*slot = 0;
+
+	distance = (atomic_long_read(&workingset_clock) - entry) &
+							EVICTION_MASK;
+	inc_zone_page_state(page, WORKINGSET_REFAULT);
+	if (distance > global_page_state(NR_ACTIVE))
+		return 0;
+
+	inc_zone_page_state(page, WORKINGSET_ACTIVATE);
+	return 1;
+}
+
+/*
+ * One shadow per two pages of memory covers evictions of up to half of
+ * memory, which is as long as the active list can usefully get.
+ */
+static int __init workingset_init(void)
+{
+	unsigned long *table;
+
+	table = alloc_large_system_hash("Workingset shadow",
+					sizeof(unsigned long), 0,
+					PAGE_SHIFT + 1, 0, &shadow_shift, NULL,
+					1UL << (BITS_PER_LONG - SHADOW_TAG_BITS));
+	memset(table, 0, sizeof(unsigned long) << shadow_shift);
+	smp_wmb();
+	shadow_table = table;
+	return 0;
+}
+module_init(workingset_init);